@@ -70,7 +70,7 @@ void loop() {
 
   // every second, get the current fasttime, parse and print
   if(millis() - lastPrint > 1000) {
-    time_t fastTime = (time_t)wiThrottleProtocol.getCurrentFastTime();
+    time_t fastTime = (time_t)wiThrottleProtocol.getFastTime();
     Serial.print(hour(fastTime));
     Serial.print(":");
     Serial.print(minute(fastTime));
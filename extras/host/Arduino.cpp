@@ -0,0 +1,31 @@
+/* -*- c++ -*-
+ *
+ * Minimal Arduino core shim used to build WiThrottleProtocol on a host.
+ *
+ */
+
+#include <chrono>
+#include <thread>
+
+#include "Arduino.h"
+
+static unsigned long (*millisSource)() = NULL;
+
+static unsigned long realMillis() {
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return (unsigned long) std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+unsigned long millis() {
+    return millisSource ? millisSource() : realMillis();
+}
+
+void setMillisSource(unsigned long (*source)()) {
+    millisSource = source;
+}
+
+void delay(unsigned long ms) {
+    if (millisSource) return;
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
@@ -0,0 +1,254 @@
+/* -*- c++ -*-
+ *
+ * Minimal Arduino core shim used to build WiThrottleProtocol on a host
+ * (Linux/macOS) machine. Only the parts of String, Print and Stream that
+ * the library uses are provided.
+ *
+ */
+
+#ifndef WITHROTTLE_HOST_ARDUINO_H
+#define WITHROTTLE_HOST_ARDUINO_H
+
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <sys/types.h>
+#include <new>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+/// @brief Milliseconds since start-up, from the injectable clock
+unsigned long millis();
+
+/// @brief Replace the clock used by millis(). Pass NULL to restore the real clock.
+/// @param source function returning the current time in milliseconds
+void setMillisSource(unsigned long (*source)());
+
+void delay(unsigned long ms);
+
+/// @brief Arduino style String. Like the Arduino core (and unlike std::string) any
+/// non-empty contents are held on the heap, so allocation counts match a device
+class String {
+  public:
+    String() {}
+    String(const char *s) { assign(s, s ? strlen(s) : 0); }
+    String(const char *s, size_t len) { assign(s, len); }
+    String(const String &s) { assign(s.buffer, s.len); }
+    String(String &&s) noexcept : buffer(s.buffer), len(s.len), capacity(s.capacity) { s.buffer = NULL; s.len = s.capacity = 0; }
+    explicit String(char c) { assign(&c, 1); }
+    explicit String(int v) { assignFormat("%d", v); }
+    explicit String(unsigned int v) { assignFormat("%u", v); }
+    explicit String(long v) { assignFormat("%ld", v); }
+    explicit String(unsigned long v) { assignFormat("%lu", v); }
+    explicit String(float v, unsigned int decimals = 2) { assignFormat("%.*f", (int) decimals, (double) v); }
+    explicit String(double v, unsigned int decimals = 2) { assignFormat("%.*f", (int) decimals, v); }
+    ~String() { delete[] buffer; }
+
+    String &operator=(const String &s) { if (this != &s) assign(s.buffer, s.len); return *this; }
+    String &operator=(String &&s) noexcept {
+        if (this != &s) {
+            delete[] buffer;
+            buffer = s.buffer; len = s.len; capacity = s.capacity;
+            s.buffer = NULL; s.len = s.capacity = 0;
+        }
+        return *this;
+    }
+    String &operator=(const char *s) { assign(s, s ? strlen(s) : 0); return *this; }
+
+    unsigned int length() const { return len; }
+    const char *c_str() const { return buffer ? buffer : ""; }
+    bool reserve(unsigned int size) {
+        if (size <= capacity) return true;
+        if (size == UINT_MAX) return false;  // no room for the terminator
+        char *b = new (std::nothrow) char[size + 1];
+        if (!b) return false;
+        if (buffer) memcpy(b, buffer, len + 1); else b[0] = 0;
+        delete[] buffer;
+        buffer = b;
+        capacity = size;
+        return true;
+    }
+
+    char charAt(unsigned int i) const { return i < len ? buffer[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+    char &operator[](unsigned int i) { static char dummy; return i < len ? buffer[i] : (dummy = 0); }
+
+    bool equals(const String &o) const { return len == o.len && memcmp(c_str(), o.c_str(), len) == 0; }
+    bool equals(const char *o) const { return strcmp(c_str(), o ? o : "") == 0; }
+    bool operator==(const String &o) const { return equals(o); }
+    bool operator==(const char *o) const { return equals(o); }
+    bool operator!=(const String &o) const { return !equals(o); }
+    bool operator!=(const char *o) const { return !equals(o); }
+    bool startsWith(const String &prefix) const { return prefix.len <= len && memcmp(c_str(), prefix.c_str(), prefix.len) == 0; }
+
+    int indexOf(char c, unsigned int from = 0) const {
+        for (unsigned int i = from; i < len; i++) if (buffer[i] == c) return i;
+        return -1;
+    }
+    int indexOf(const char *str, unsigned int from = 0) const {
+        if (from > len) return -1;
+        const char *found = strstr(c_str() + from, str);
+        return found ? (int) (found - c_str()) : -1;
+    }
+    int indexOf(const String &str, unsigned int from = 0) const { return indexOf(str.c_str(), from); }
+    int lastIndexOf(char c) const {
+        for (int i = (int) len - 1; i >= 0; i--) if (buffer[i] == c) return i;
+        return -1;
+    }
+
+    String substring(unsigned int from) const { return substring(from, len); }
+    String substring(unsigned int from, unsigned int to) const {
+        if (from > to) { unsigned int t = from; from = to; to = t; }
+        if (from >= len) return String();
+        if (to > len) to = len;
+        return String(buffer + from, to - from);
+    }
+    void remove(unsigned int index) { remove(index, len); }
+    void remove(unsigned int index, unsigned int count) {
+        if (index >= len) return;
+        if (count > len - index) count = len - index;
+        memmove(buffer + index, buffer + index + count, len - index - count + 1);
+        len -= count;
+    }
+    void trim() {
+        if (!buffer) return;
+        unsigned int b = 0, e = len;
+        while (b < e && isSpace(buffer[b])) b++;
+        while (e > b && isSpace(buffer[e - 1])) e--;
+        memmove(buffer, buffer + b, e - b);
+        len = e - b;
+        buffer[len] = 0;
+    }
+
+    long toInt() const { return atol(c_str()); }
+    float toFloat() const { return (float) atof(c_str()); }
+    double toDouble() const { return atof(c_str()); }
+
+    bool concat(const char *s, unsigned int n) {
+        if (n == 0) return true;
+        if (!s || n > UINT_MAX - len) return false;
+        if (len + n > capacity && !reserve(len + n)) return false;
+        memcpy(buffer + len, s, n);
+        len += n;
+        buffer[len] = 0;
+        return true;
+    }
+    bool concat(const String &o) { return concat(o.c_str(), o.len); }
+    bool concat(const char *o) { return o ? concat(o, strlen(o)) : true; }
+    bool concat(char c) { return concat(&c, 1); }
+    bool concat(int v) { return concat(String(v)); }
+    bool concat(unsigned int v) { return concat(String(v)); }
+    bool concat(long v) { return concat(String(v)); }
+    bool concat(unsigned long v) { return concat(String(v)); }
+
+    template <typename T> String &operator+=(const T &v) { concat(v); return *this; }
+
+    friend String operator+(const String &a, const String &b) { String r(a); r.concat(b); return r; }
+    friend String operator+(const String &a, const char *b) { String r(a); r.concat(b); return r; }
+    friend String operator+(const char *a, const String &b) { String r(a); r.concat(b); return r; }
+    friend String operator+(const String &a, char b) { String r(a); r.concat(b); return r; }
+    friend String operator+(const String &a, int b) { String r(a); r.concat(b); return r; }
+    friend String operator+(const String &a, unsigned int b) { String r(a); r.concat(b); return r; }
+    friend String operator+(const String &a, long b) { String r(a); r.concat(b); return r; }
+    friend String operator+(const String &a, unsigned long b) { String r(a); r.concat(b); return r; }
+
+  private:
+    char *buffer = NULL;
+    unsigned int len = 0;
+    unsigned int capacity = 0;
+
+    static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+    void assign(const char *s, size_t n) {
+        len = 0;
+        if (buffer) buffer[0] = 0;
+        if (n <= UINT_MAX) concat(s, (unsigned int) n);
+    }
+    void assignFormat(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char b[64];
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(b, sizeof(b), format, args);
+        va_end(args);
+        assign(b, n < 0 ? 0 : ((size_t) n < sizeof(b) ? n : sizeof(b) - 1));
+    }
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+    }
+    size_t write(const char *str) { return str ? write((const uint8_t *) str, strlen(str)) : 0; }
+    size_t write(const char *buffer, size_t size) { return write((const uint8_t *) buffer, size); }
+
+    size_t print(const char *s) { return write(s); }
+    size_t print(const String &s) { return write(s.c_str(), s.length()); }
+    size_t print(char c) { return write((uint8_t) c); }
+    size_t print(int v) { return printf("%d", v); }
+    size_t print(unsigned int v) { return printf("%u", v); }
+    size_t print(long v) { return printf("%ld", v); }
+    size_t print(unsigned long v) { return printf("%lu", v); }
+    size_t print(long long v) { return printf("%lld", v); }
+    size_t print(unsigned long long v) { return printf("%llu", v); }
+    size_t print(double v, int decimals = 2) { return printf("%.*f", decimals, v); }
+
+    size_t println() { return write("\r\n"); }
+    template <typename T> size_t println(const T &v) { size_t n = print(v); return n + println(); }
+
+    size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char buf[256];
+        va_list args;
+        va_start(args, format);
+        int len = vsnprintf(buf, sizeof(buf), format, args);
+        va_end(args);
+        if (len < 0) return 0;
+        if ((size_t) len >= sizeof(buf)) len = sizeof(buf) - 1;
+        return write((const uint8_t *) buf, (size_t) len);
+    }
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+
+    void setTimeout(unsigned long timeout) { this->timeout = timeout; }
+
+    /// @brief Read up to length bytes, waiting at most the stream timeout for each one
+    virtual size_t readBytes(char *buffer, size_t length) {
+        size_t count = 0;
+        while (count < length) {
+            int c = timedRead();
+            if (c < 0) break;
+            *buffer++ = (char) c;
+            count++;
+        }
+        return count;
+    }
+    size_t readBytes(uint8_t *buffer, size_t length) { return readBytes((char *) buffer, length); }
+
+  protected:
+    unsigned long timeout = 1000;
+
+    int timedRead() {
+        unsigned long start = millis();
+        do {
+            int c = read();
+            if (c >= 0) return c;
+        } while (millis() - start < timeout);
+        return -1;
+    }
+};
+
+#endif // WITHROTTLE_HOST_ARDUINO_H
@@ -0,0 +1,116 @@
+/* -*- c++ -*-
+ *
+ * A Stream over a POSIX TCP socket.
+ *
+ */
+
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "SocketStream.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+bool SocketStream::connect(const char *host, uint16_t port) {
+    stop();
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+
+    struct addrinfo *addresses;
+    if (getaddrinfo(host, service, &hints, &addresses) != 0) return false;
+    for (struct addrinfo *a = addresses; a; a = a->ai_next) {
+        int fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            attach(fd);
+            break;
+        }
+        close(fd);
+    }
+    freeaddrinfo(addresses);
+    return connected();
+}
+
+void SocketStream::attach(int fd) {
+    stop();
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    socketFd = fd;
+}
+
+void SocketStream::stop() {
+    if (socketFd >= 0) close(socketFd);
+    socketFd = -1;
+    bufferStart = bufferEnd = 0;
+}
+
+void SocketStream::fill() {
+    if (socketFd < 0 || bufferStart < bufferEnd) return;
+    bufferStart = bufferEnd = 0;
+    ssize_t n = recv(socketFd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n > 0) {
+        bufferEnd = n;
+    }
+    else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+        // closed by the server, or failed
+        stop();
+    }
+}
+
+int SocketStream::available() {
+    fill();
+    return bufferEnd - bufferStart;
+}
+
+int SocketStream::read() {
+    fill();
+    return (bufferStart < bufferEnd) ? (unsigned char) buffer[bufferStart++] : -1;
+}
+
+int SocketStream::peek() {
+    fill();
+    return (bufferStart < bufferEnd) ? (unsigned char) buffer[bufferStart] : -1;
+}
+
+size_t SocketStream::readBytes(char *data, size_t length) {
+    size_t count = 0;
+    while (count < length) {
+        fill();
+        if (bufferStart == bufferEnd) break;
+        size_t n = bufferEnd - bufferStart;
+        if (n > length - count) n = length - count;
+        memcpy(data + count, buffer + bufferStart, n);
+        bufferStart += n;
+        count += n;
+    }
+    return count;
+}
+
+size_t SocketStream::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t SocketStream::write(const uint8_t *data, size_t size) {
+    size_t sent = 0;
+    while (socketFd >= 0 && sent < size) {
+        ssize_t n = send(socketFd, data + sent, size - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            stop();
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
@@ -0,0 +1,56 @@
+/* -*- c++ -*-
+ *
+ * A Stream over a POSIX TCP socket, for connecting WiThrottleProtocol to a
+ * real server from a host build. Reads never block; writes do.
+ *
+ */
+
+#ifndef WITHROTTLE_HOST_SOCKETSTREAM_H
+#define WITHROTTLE_HOST_SOCKETSTREAM_H
+
+#include "Arduino.h"
+
+class SocketStream : public Stream {
+  public:
+    SocketStream() {}
+    ~SocketStream() { stop(); }
+
+    /// @brief Connect to a server
+    /// @param host host name or address
+    /// @param port TCP port
+    /// @return False if the connection failed
+    bool connect(const char *host, uint16_t port);
+
+    /// @brief Use a socket that is already connected (e.g. one returned by accept()). The stream closes it
+    /// @param fd connected socket
+    void attach(int fd);
+
+    /// @brief Close the connection
+    void stop();
+
+    /// @brief Check if the connection is still open
+    bool connected() const { return socketFd >= 0; }
+
+    /// @brief The socket, for poll()/epoll(), or -1 when not connected
+    int fd() const { return socketFd; }
+
+    int available();
+    int read();
+    int peek();
+    size_t readBytes(char *buffer, size_t length);
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    using Print::write;
+    using Stream::readBytes;
+
+  private:
+    int socketFd = -1;
+    char buffer[512];
+    size_t bufferStart = 0;
+    size_t bufferEnd = 0;
+
+    // read whatever the socket has into the buffer, without waiting
+    void fill();
+};
+
+#endif // WITHROTTLE_HOST_SOCKETSTREAM_H
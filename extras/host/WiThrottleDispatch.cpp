@@ -0,0 +1,76 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleDispatch
+ *
+ * Measures what each type of line from the server costs to frame, dispatch
+ * and handle, by feeding the same line to processInput() many times and timing
+ * it, with the logging off and no delegate. The handlers of most of these lines
+ * do little more than parse a number, so the differences between the types are
+ * mostly the dispatch in processCommand(): the lines reached late in a chain of
+ * prefix tests cost more than those reached early.
+ *
+ * Usage: WiThrottleDispatch [-n iterations]   (default 200000 per line, best of 5 runs)
+ *
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WiThrottleProtocol.h"
+
+// the same lines in the same order, so that runs can be compared
+static const char *lines[] = {
+    "M0AL3<;>V50",
+    "M0AL3<;>F112",
+    "M0AL3<;>R1",
+    "M0AL3<;>s1",
+    "MTAL3<;>V50",
+    "PFT1700000000<;>4.0",
+    "PPA1",
+    "PTA2LT1",
+    "PRA2IR1",
+    "PW12080",
+    "*10",
+    "VN2.0",
+    "HTJMRI",
+    "HtJMRI on the layout",
+    "HMa message",
+    "RL0",
+    "M0LL3<;>]\\[Headlight]\\[Bell",
+    "XUNKNOWN",
+};
+
+int main(int argc, char **argv) {
+    long iterations = 200000;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) iterations = atol(argv[++i]);
+        else iterations = 0;
+    }
+    if (iterations <= 0) {
+        fprintf(stderr, "usage: %s [-n iterations]\n", argv[0]);
+        return 2;
+    }
+
+    NullStream stream;
+    WiThrottleProtocol protocol;
+    protocol.setLogLevel(0);
+    protocol.connect(&stream);
+
+    printf("%-30s  %8s\n", "line", "ns/line");
+    for (const char *line : lines) {
+        char input[64];
+        size_t length = snprintf(input, sizeof(input), "%s\n", line);
+        double best = 0;
+        for (int run = 0; run < 5; run++) {
+            auto start = std::chrono::steady_clock::now();
+            for (long i = 0; i < iterations; i++) protocol.processInput(input, length);
+            std::chrono::duration<double, std::nano> taken = std::chrono::steady_clock::now() - start;
+            double each = taken.count() / iterations;
+            if (run == 0 || each < best) best = each;
+        }
+        printf("%-30s  %8.1f\n", line, best);
+    }
+    return 0;
+}
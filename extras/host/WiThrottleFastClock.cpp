@@ -0,0 +1,164 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleFastClock
+ *
+ * Runs the fast clock of WiThrottleProtocol for hours of virtual time at a
+ * range of rates, calling check() at uneven intervals (with the odd gap of
+ * several seconds) the way a busy sketch does, and compares getFastTime() with
+ * the exact fast time worked out from the PFT command and the real time since.
+ * The virtual clock starts just before millis() wraps around.
+ *
+ * For comparison it also runs the clock the library used to have, which added
+ * the rate to a double each time check() found a second had passed, and
+ * reports how far that had drifted by the end.
+ *
+ * Then it runs the clock with setFastTimeGranularity(), sleeping for
+ * getTimeUntilNextEvent() between calls to check() as a clock display would,
+ * and reports how many times it woke, and how late (in real milliseconds)
+ * onFastTime() was called after the fast time reached each multiple.
+ *
+ * Usage: WiThrottleFastClock [-h hours] [-g seconds]   (default 24 hours, 60 seconds)
+ *   exits with 1 if getFastTime() was ever out by a millisecond or more, or a
+ *   notification was missed or a millisecond or more late
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "WiThrottleProtocol.h"
+
+// the library sees this as millis()
+static unsigned long virtualMillis = 0;
+static unsigned long getVirtualMillis() { return virtualMillis; }
+
+// repeatable intervals between the calls to check()
+static uint32_t randomState = 12345;
+static uint32_t nextRandom() {
+    randomState = randomState * 1103515245 + 12345;
+    return randomState >> 8;
+}
+
+/// @brief Counts the fast time notifications, and checks that none is skipped
+class ClockDelegate : public WiThrottleProtocolDelegateV2 {
+  public:
+    uint32_t granularity = 60;
+    uint32_t last = 0;
+    unsigned long notifications = 0;
+    unsigned long missed = 0;
+
+    void onFastTime(uint32_t time) {
+        if (notifications > 0 && time / granularity != last / granularity + 1) missed++;
+        last = time;
+        notifications++;
+    }
+};
+
+int main(int argc, char **argv) {
+    double hours = 24;
+    long granularity = 60;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-h") == 0 && i + 1 < argc) hours = atof(argv[++i]);
+        else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) granularity = atol(argv[++i]);
+        else hours = 0;
+    }
+    if (hours <= 0 || granularity < 1 || granularity > 86400) {
+        fprintf(stderr, "usage: %s [-h hours] [-g seconds (1-86400)]\n", argv[0]);
+        return 2;
+    }
+
+    static const char *rates[] = {"1.0", "0.25", "2.5", "3.3", "4.0", "12.0", "60.0"};
+    const uint32_t startTime = 1700000000;  // seconds, as JMRI sends it
+    const unsigned long long duration = (unsigned long long) (hours * 3600000);
+    setMillisSource(getVirtualMillis);
+    NullStream stream;
+    int failed = 0;
+
+    printf("rate   checks     max error ms  old clock drift s\n");
+    for (const char *rate : rates) {
+        WiThrottleProtocol protocol;
+        protocol.setLogLevel(0);
+        virtualMillis = (unsigned long) -1 - 600000;  // 10 minutes before millis() wraps
+        protocol.connect(&stream, 0);
+
+        char command[48];
+        snprintf(command, sizeof(command), "PFT%lu<;>%s\n", (unsigned long) startTime, rate);
+        protocol.processInput(command, strlen(command));
+        unsigned long long rateThousandths = (unsigned long long) (atof(rate) * 1000 + 0.5);
+
+        // the clock as it was: a second had passed when check() found more than 1000ms since the last tick
+        double oldFastTime = startTime;
+        unsigned long oldTimer = virtualMillis;
+
+        unsigned long long elapsed = 0;
+        unsigned long checks = 0;
+        unsigned long long maxError = 0;
+        while (elapsed < duration) {
+            unsigned long step = 1 + nextRandom() % 97;
+            if (nextRandom() % 1000 == 0) step += 5000;  // a long wait, e.g. for the network
+            virtualMillis += step;
+            elapsed += step;
+            protocol.check();
+            checks++;
+            if (virtualMillis - oldTimer > 1000) {
+                oldTimer = virtualMillis;
+                oldFastTime += (float) atof(rate);
+            }
+
+            uint16_t milliseconds;
+            unsigned long long actual = protocol.getFastTime(&milliseconds) * 1000ULL + milliseconds;
+            unsigned long long expected = startTime * 1000ULL + elapsed * rateThousandths / 1000;
+            unsigned long long error = (actual > expected) ? actual - expected : expected - actual;
+            if (error > maxError) maxError = error;
+        }
+
+        double exact = startTime + elapsed * (rateThousandths / 1000.0) / 1000.0;
+        printf("%-5s  %9lu  %12llu  %17.1f\n", rate, checks, maxError, oldFastTime - exact);
+        if (maxError > 0) failed++;
+    }
+
+    printf("\nrate   wakeups    notifications  missed  max late ms  (every %ld fast seconds)\n", granularity);
+    for (const char *rate : rates) {
+        WiThrottleProtocol protocol;
+        ClockDelegate delegate;
+        delegate.granularity = granularity;
+        protocol.setLogLevel(0);
+        protocol.setDelegate(&delegate);
+        virtualMillis = (unsigned long) -1 - 600000;
+        protocol.connect(&stream, 0);
+        protocol.setFastTimeGranularity(granularity);
+
+        char command[48];
+        snprintf(command, sizeof(command), "PFT%lu<;>%s\n", (unsigned long) startTime, rate);
+        protocol.processInput(command, strlen(command));
+        uint32_t rateThousandths = protocol.getFastTimeRateThousandths();
+        delegate.notifications = 0;
+
+        unsigned long long elapsed = 0;
+        unsigned long wakeups = 0;
+        double maxLate = 0;
+        while (true) {
+            long sleep = protocol.getTimeUntilNextEvent();
+            if (sleep < 0 || elapsed + sleep >= duration) break;
+            virtualMillis += sleep;
+            elapsed += sleep;
+            unsigned long before = delegate.notifications;
+            protocol.check();
+            wakeups++;
+            if (delegate.notifications != before) {
+                // the fast time past the multiple, in real milliseconds
+                uint16_t milliseconds;
+                uint32_t now = protocol.getFastTime(&milliseconds);
+                double late = ((now % granularity) * 1000.0 + milliseconds) * 1000.0 / rateThousandths;
+                if (late > maxLate) maxLate = late;
+            }
+        }
+
+        printf("%-5s  %9lu  %13lu  %6lu  %11.3f\n", rate, wakeups, delegate.notifications, delegate.missed, maxLate);
+        if (delegate.missed > 0 || maxLate >= 1) failed++;
+    }
+
+    printf("%.1f hours: %s\n", hours, failed ? "FAILED" : "no error");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleLogDecode
+ *
+ * Prints a binary WiThrottleEventLog, as saved with dump() or read() (e.g. to
+ * an SD card, or from the serial port of a throttle), as text, one event per
+ * line: the time (millis()) the event was recorded, what it was, its numbers
+ * and its text.
+ *
+ * Bytes that are not a valid event (e.g. the capture started part way through
+ * one) are skipped and counted.
+ *
+ * Usage: WiThrottleLogDecode [logfile]   (standard input if no file is given)
+ *
+ */
+
+#include <stdio.h>
+#include <vector>
+
+#include "WiThrottleEventLog.h"
+
+int main(int argc, char **argv) {
+    if (argc > 2) {
+        fprintf(stderr, "usage: %s [logfile]\n", argv[0]);
+        return 2;
+    }
+    FILE *file = (argc == 2) ? fopen(argv[1], "rb") : stdin;
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) data.insert(data.end(), chunk, chunk + n);
+    if (file != stdin) fclose(file);
+
+    unsigned long events = 0;
+    unsigned long skipped = 0;
+    char text[128];
+    size_t offset = 0;
+    while (offset < data.size()) {
+        size_t length = WiThrottleEventLog::decode(data.data() + offset, data.size() - offset, text, sizeof(text));
+        if (length == 0) {
+            skipped++;
+            offset++;
+            continue;
+        }
+        printf("%s\n", text);
+        events++;
+        offset += length;
+    }
+    if (skipped > 0) fprintf(stderr, "%lu events, %lu bytes skipped\n", events, skipped);
+    return 0;
+}
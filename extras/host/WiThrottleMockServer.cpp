@@ -0,0 +1,381 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleMockServer
+ *
+ * A scriptable WiThrottle server for testing WiThrottleProtocol over loopback
+ * TCP without JMRI. It sends what the script says when a client connects and
+ * in reply to the client's commands, and can inject the faults seen with real
+ * servers: output trickled a few bytes at a time (slow links, lines split
+ * over several reads), a server that is slow to read, and the LnWi's
+ * AT+CIPSENDBUF= garbage. Any number of clients can connect. The commands
+ * received and lines sent per second are printed every few seconds.
+ *
+ * Usage: WiThrottleMockServer [-p port] [-s script] [-i seconds] [-t seconds] [-v]
+ *   -p  port to listen on (default 12090, 0 to pick one; it is printed)
+ *   -s  script file (default: the built in script below)
+ *   -i  how often to print the statistics (default 5, 0 for never)
+ *   -t  stop after this many seconds (default: run until interrupted)
+ *   -v  print every line received and sent
+ *
+ * Script lines (# starts a comment):
+ *   connect <line>          sent to each client when it connects
+ *   on <pattern> <line>     sent when a client's command matches <pattern>, where ? matches any one
+ *                           character and * anything. Only the rules with the first pattern that
+ *                           matches are used. In <line>, {t} is the throttle letter of an M command,
+ *                           {a} its address, and {r} whatever follows its <;> (for other commands,
+ *                           what follows the part of the pattern before its first *).
+ *                           If the address is * the line is sent for each loco on the throttle
+ *   every <ms> <line>       sent to every client every <ms> milliseconds
+ *   fault trickle <n> <ms>  write at most n bytes at a time, with <ms> between writes
+ *                           (e.g. "trickle 5 0" splits lines, "trickle 1 20" is a slow link)
+ *   fault stall <ms>        only read from the clients every <ms> milliseconds
+ *   fault garbage <n>       put AT+CIPSENDBUF= in front of every n'th line sent
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "Arduino.h"
+
+static const char *defaultScript =
+    "connect VN2.0\n"
+    "connect RL2]\\[Big Boy}|{4014}|{L]\\[Switcher}|{3}|{S\n"
+    "connect PPA1\n"
+    "connect PTL]\\[LT1}|{Siding}|{2]\\[LT2}|{Yard}|{4\n"
+    "connect PRL]\\[IR1}|{Yard route}|{4\n"
+    "connect PFT36000<;>4.0\n"
+    "on N* *10\n"
+    // S99 is always on another throttle, so has to be stolen
+    "on M?+S99<;>* M{t}S{a}<;>{a}\n"
+    "on M?S* M{t}+{a}<;>\n"
+    "on M?S* M{t}A{a}<;>V0\n"
+    "on M?+* M{t}+{a}<;>\n"
+    "on M?+* M{t}L{a}<;>]\\[Headlight]\\[Bell]\\[Whistle\n"
+    "on M?+* M{t}A{a}<;>V0\n"
+    "on M?+* M{t}A{a}<;>R1\n"
+    "on M?+* M{t}A{a}<;>s1\n"
+    "on M?-* M{t}-{a}<;>\n"
+    "on M?A*<;>V* M{t}A{a}<;>{r}\n"
+    "on M?A*<;>R* M{t}A{a}<;>{r}\n"
+    "on M?A*<;>X M{t}A{a}<;>V0\n"
+    "on PTA2* PTA4{r}\n"
+    "on PPA* PPA{r}\n";
+
+struct Rule {
+    std::string pattern;
+    std::string line;
+};
+
+struct Repeat {
+    unsigned long period;
+    unsigned long next;
+    std::string line;
+};
+
+struct Client {
+    int fd;
+    std::string input;
+    std::string output;
+    unsigned long nextWrite = 0;
+    unsigned long nextRead = 0;
+    unsigned long linesSent = 0;
+    std::vector<std::string> locos[256];  // what it has been told it holds, per throttle letter
+};
+
+static std::vector<std::string> connectLines;
+static std::vector<Rule> rules;
+static std::vector<Repeat> repeats;
+static int trickleBytes = 0;
+static unsigned long trickleMs = 0;
+static unsigned long stallMs = 0;
+static int garbageEvery = 0;
+static bool verbose = false;
+
+static unsigned long commandsReceived = 0;
+static unsigned long linesSent = 0;
+static unsigned long bytesSent = 0;
+
+// ? matches any one character, and * any number
+static bool matches(const char *pattern, const char *text) {
+    if (*pattern == 0) return *text == 0;
+    if (*pattern == '*') {
+        for (const char *t = text; ; t++) {
+            if (matches(pattern + 1, t)) return true;
+            if (*t == 0) return false;
+        }
+    }
+    if (*text == 0) return false;
+    if (*pattern != '?' && *pattern != *text) return false;
+    return matches(pattern + 1, text + 1);
+}
+
+static bool loadScript(const std::string &script) {
+    size_t start = 0;
+    int lineNumber = 0;
+    while (start < script.size()) {
+        size_t end = script.find('\n', start);
+        if (end == std::string::npos) end = script.size();
+        std::string line = script.substr(start, end - start);
+        start = end + 1;
+        lineNumber++;
+        if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+        if (line.empty() || line[0] == '#') continue;
+
+        size_t space = line.find(' ');
+        std::string keyword = line.substr(0, space);
+        std::string rest = (space == std::string::npos) ? "" : line.substr(space + 1);
+        size_t restSpace = rest.find(' ');
+        std::string first = rest.substr(0, restSpace);
+        std::string second = (restSpace == std::string::npos) ? "" : rest.substr(restSpace + 1);
+
+        if (keyword == "connect" && !rest.empty()) {
+            connectLines.push_back(rest);
+        } else if (keyword == "on" && !second.empty()) {
+            rules.push_back({first, second});
+        } else if (keyword == "every" && atol(first.c_str()) > 0 && !second.empty()) {
+            repeats.push_back({(unsigned long) atol(first.c_str()), 0, second});
+        } else if (keyword == "fault" && first == "trickle" && atoi(second.c_str()) > 0) {
+            trickleBytes = atoi(second.c_str());
+            size_t ms = second.find(' ');
+            trickleMs = (ms == std::string::npos) ? 0 : atol(second.c_str() + ms + 1);
+        } else if (keyword == "fault" && first == "stall") {
+            stallMs = atol(second.c_str());
+        } else if (keyword == "fault" && first == "garbage") {
+            garbageEvery = atoi(second.c_str());
+        } else {
+            fprintf(stderr, "script line %d not understood: %s\n", lineNumber, line.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void queueLine(Client &client, const std::string &line) {
+    // keep track of the locos the client has been told it has
+    if (line.size() > 3 && line[0] == 'M' && (line[2] == '+' || line[2] == '-')) {
+        std::vector<std::string> &locos = client.locos[(unsigned char) line[1]];
+        std::string address = line.substr(3, line.find("<;>") - 3);
+        for (size_t i = 0; i < locos.size(); i++) {
+            if (locos[i] == address) locos.erase(locos.begin() + i--);
+        }
+        if (line[2] == '+') locos.push_back(address);
+    }
+
+    client.linesSent++;
+    if (garbageEvery > 0 && client.linesSent % garbageEvery == 0) client.output += "AT+CIPSENDBUF=";
+    client.output += line;
+    client.output += '\n';
+    linesSent++;
+    if (verbose) printf("%d ==> %s\n", client.fd, line.c_str());
+}
+
+static std::string substitute(const std::string &line, const std::string &throttle, const std::string &address, const std::string &rest) {
+    std::string result;
+    for (size_t i = 0; i < line.size(); i++) {
+        if (line.compare(i, 3, "{t}") == 0) { result += throttle; i += 2; }
+        else if (line.compare(i, 3, "{a}") == 0) { result += address; i += 2; }
+        else if (line.compare(i, 3, "{r}") == 0) { result += rest; i += 2; }
+        else result += line[i];
+    }
+    return result;
+}
+
+static void processCommand(Client &client, const std::string &command) {
+    commandsReceived++;
+    if (verbose) printf("%d <== %s\n", client.fd, command.c_str());
+
+    std::string throttle, address, rest;
+    size_t separator = command.find("<;>");
+    bool locoCommand = command.size() > 3 && command[0] == 'M';
+    if (locoCommand) {
+        throttle = command.substr(1, 1);
+        address = command.substr(3, (separator == std::string::npos ? command.size() : separator) - 3);
+        if (separator != std::string::npos) rest = command.substr(separator + 3);
+    }
+
+    const std::string *pattern = NULL;
+    for (const Rule &rule : rules) {
+        if (pattern == NULL && matches(rule.pattern.c_str(), command.c_str())) pattern = &rule.pattern;
+        if (pattern == NULL || rule.pattern != *pattern) continue;
+        if (!locoCommand) rest = command.substr(std::min(rule.pattern.find('*'), command.size()));
+
+        if (address == "*" && rule.line.find("{a}") != std::string::npos) {
+            std::vector<std::string> locos = client.locos[(unsigned char) throttle[0]];
+            for (const std::string &loco : locos) queueLine(client, substitute(rule.line, throttle, loco, rest));
+        } else {
+            queueLine(client, substitute(rule.line, throttle, address, rest));
+        }
+    }
+}
+
+// write what is waiting, all at once or trickled. Returns false if the client has gone
+static bool writeOutput(Client &client) {
+    while (!client.output.empty() && millis() >= client.nextWrite) {
+        size_t n = client.output.size();
+        if (trickleBytes > 0 && n > (size_t) trickleBytes) n = trickleBytes;
+        ssize_t sent = send(client.fd, client.output.data(), n, MSG_NOSIGNAL);
+        if (sent < 0) return errno == EINTR;
+        client.output.erase(0, sent);
+        bytesSent += sent;
+        if (trickleBytes > 0) client.nextWrite = millis() + trickleMs;
+        if (trickleBytes > 0 && trickleMs > 0) break;
+    }
+    return true;
+}
+
+// read and process what the client has sent. Returns false if the client has gone
+static bool readInput(Client &client) {
+    char buffer[512];
+    ssize_t n = recv(client.fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n == 0) return false;
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    client.input.append(buffer, n);
+
+    size_t start = 0, end;
+    while ((end = client.input.find_first_of("\r\n", start)) != std::string::npos) {
+        if (end > start) processCommand(client, client.input.substr(start, end - start));
+        start = end + 1;
+    }
+    client.input.erase(0, start);
+    if (stallMs > 0) client.nextRead = millis() + stallMs;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    int port = 12090;
+    const char *scriptFile = NULL;
+    long interval = 5;
+    long runFor = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-p") == 0 && i + 1 < argc) port = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) scriptFile = argv[++i];
+        else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) interval = atol(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) runFor = atol(argv[++i]);
+        else if (strcmp(argv[i], "-v") == 0) verbose = true;
+        else port = -1;
+    }
+    if (port < 0 || port > 65535 || interval < 0) {
+        fprintf(stderr, "usage: %s [-p port] [-s script] [-i seconds] [-t seconds] [-v]\n", argv[0]);
+        return 2;
+    }
+
+    std::string script = defaultScript;
+    if (scriptFile) {
+        FILE *f = fopen(scriptFile, "r");
+        if (!f) {
+            perror(scriptFile);
+            return 1;
+        }
+        script.clear();
+        char buffer[4096];
+        size_t n;
+        while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) script.append(buffer, n);
+        fclose(f);
+    }
+    if (!loadScript(script)) return 1;
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(port);
+    socklen_t length = sizeof(address);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 128) != 0
+        || getsockname(listener, (struct sockaddr *) &address, &length) != 0) {
+        perror("listen");
+        return 1;
+    }
+    printf("listening on 127.0.0.1:%u\n", ntohs(address.sin_port));
+    fflush(stdout);
+
+    std::vector<Client *> clients;
+    unsigned long start = millis();
+    unsigned long lastReport = start;
+    unsigned long lastCommands = 0, lastLines = 0;
+    for (Repeat &repeat : repeats) repeat.next = start + repeat.period;
+
+    while (runFor == 0 || millis() - start < (unsigned long) runFor * 1000) {
+        unsigned long now = millis();
+        long timeout = interval > 0 ? (long) (lastReport + interval * 1000 - now) : 1000;
+        std::vector<struct pollfd> fds;
+        fds.push_back({listener, POLLIN, 0});
+        for (Client *client : clients) {
+            short events = 0;
+            if (now >= client->nextRead) events |= POLLIN;
+            else if ((long) (client->nextRead - now) < timeout) timeout = client->nextRead - now;
+            if (!client->output.empty()) {
+                if (now >= client->nextWrite) events |= POLLOUT;
+                else if ((long) (client->nextWrite - now) < timeout) timeout = client->nextWrite - now;
+            }
+            fds.push_back({client->fd, events, 0});
+        }
+        for (Repeat &repeat : repeats) {
+            if ((long) (repeat.next - now) < timeout) timeout = repeat.next - now;
+        }
+        if (timeout < 0) timeout = 0;
+        poll(fds.data(), fds.size(), (int) timeout);
+        now = millis();
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd >= 0) {
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                Client *client = new Client();
+                client->fd = fd;
+                clients.push_back(client);
+                if (verbose) printf("%d connected\n", fd);
+                for (const std::string &line : connectLines) queueLine(*client, line);
+            }
+        }
+
+        for (Repeat &repeat : repeats) {
+            if (now < repeat.next) continue;
+            repeat.next += repeat.period;
+            for (Client *client : clients) queueLine(*client, repeat.line);
+        }
+
+        for (size_t i = 0; i < clients.size(); i++) {
+            Client *client = clients[i];
+            bool open = true;
+            if (now >= client->nextRead) open = readInput(*client);
+            if (open) open = writeOutput(*client);
+            if (!open) {
+                if (verbose) printf("%d disconnected\n", client->fd);
+                close(client->fd);
+                delete client;
+                clients.erase(clients.begin() + i--);
+            }
+        }
+
+        if (interval > 0 && now - lastReport >= (unsigned long) interval * 1000) {
+            double seconds = (now - lastReport) / 1000.0;
+            printf("%lus: %d clients, %.0f commands/s received, %.0f lines/s sent, %lu bytes sent\n", (now - start) / 1000,
+                   (int) clients.size(), (commandsReceived - lastCommands) / seconds, (linesSent - lastLines) / seconds, bytesSent);
+            fflush(stdout);
+            lastReport = now;
+            lastCommands = commandsReceived;
+            lastLines = linesSent;
+        }
+    }
+
+    for (Client *client : clients) {
+        close(client->fd);
+        delete client;
+    }
+    close(listener);
+    return 0;
+}
@@ -0,0 +1,162 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleMonitor
+ *
+ * Connects to one or more WiThrottle servers at once, drives all the
+ * sessions from a single loop with WiThrottleConnectionManager, and prints
+ * the aggregate statistics every few seconds. Between events it sleeps in
+ * poll() until a server sends something or a session's next timer is due, so
+ * an idle monitor uses almost no CPU (reported when it exits).
+ *
+ * Usage: WiThrottleMonitor [-i seconds] [-t seconds] [-v] [-e logfile] host[:port] ...
+ *   -i  how often to print the statistics (default 5)
+ *   -t  stop after this many seconds (default: run until interrupted)
+ *   -v  log each session's traffic
+ *   -e  record the sessions' events in a WiThrottleEventLog, and append it to
+ *       logfile after each wakeup (read it with WiThrottleLogDecode)
+ *
+ */
+
+#include <poll.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include "SocketStream.h"
+#include "WiThrottleConnectionManager.h"
+#include "WiThrottleEventLog.h"
+
+/// @brief Console that writes to stdout
+class StdoutStream : public Stream {
+  public:
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+};
+
+/// @brief Stream that writes to a file
+class FileStream : public Stream {
+  public:
+    FILE *file = NULL;
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    size_t write(uint8_t c) { return fwrite(&c, 1, 1, file); }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, file); }
+};
+
+int main(int argc, char **argv) {
+    long interval = 5;
+    long runFor = 0;
+    bool verbose = false;
+    const char *eventLogFile = NULL;
+    std::vector<std::string> servers;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) interval = atol(argv[++i]);
+        else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) runFor = atol(argv[++i]);
+        else if (strcmp(argv[i], "-v") == 0) verbose = true;
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) eventLogFile = argv[++i];
+        else servers.push_back(argv[i]);
+    }
+    if (servers.empty() || servers.size() > WIT_MAX_SESSIONS || interval < 1) {
+        fprintf(stderr, "usage: %s [-i seconds] [-t seconds] [-v] [-e logfile] host[:port] ... (up to %d servers)\n", argv[0], WIT_MAX_SESSIONS);
+        return 2;
+    }
+
+    StdoutStream console;
+    WiThrottleEventLog eventLog;
+    FileStream eventStream;
+    if (eventLogFile) {
+        eventStream.file = fopen(eventLogFile, "ab");
+        if (eventStream.file == NULL) {
+            perror(eventLogFile);
+            return 1;
+        }
+    }
+    std::vector<SocketStream *> streams;
+    std::vector<WiThrottleProtocol *> sessions;
+    WiThrottleConnectionManager manager;
+
+    for (size_t i = 0; i < servers.size(); i++) {
+        std::string host = servers[i];
+        uint16_t port = 12090;
+        size_t colon = host.rfind(':');
+        if (colon != std::string::npos) {
+            port = atoi(host.c_str() + colon + 1);
+            host = host.substr(0, colon);
+        }
+
+        SocketStream *stream = new SocketStream();
+        if (!stream->connect(host.c_str(), port)) {
+            fprintf(stderr, "cannot connect to %s:%u\n", host.c_str(), port);
+            return 1;
+        }
+        WiThrottleProtocol *session = new WiThrottleProtocol();
+        session->setLogStream(&console);
+        session->setLogLevel(verbose ? 1 : 0);
+        if (eventLogFile) session->setEventLog(&eventLog);
+        session->connect(stream);
+        session->setDeviceName(String("WiThrottleMonitor ") + String((int) i));
+        session->setDeviceID(String("monitor") + String((long) getpid()) + "-" + String((int) i));
+        streams.push_back(stream);
+        sessions.push_back(session);
+        manager.addSession(session);
+    }
+
+    unsigned long start = millis();
+    unsigned long lastReport = start;
+    unsigned long wakeups = 0;
+    while (runFor == 0 || millis() - start < (unsigned long) runFor * 1000) {
+        // sleep until a server sends something, or it is time for the timers to be serviced
+        std::vector<struct pollfd> fds;
+        for (SocketStream *stream : streams) {
+            if (stream->connected()) fds.push_back({stream->fd(), POLLIN, 0});
+        }
+        if (fds.empty()) {
+            fprintf(stderr, "all servers have disconnected\n");
+            break;
+        }
+        long timeout = (long) (interval * 1000 - (millis() - lastReport));
+        long next = manager.getTimeUntilNextEvent();
+        if (next >= 0 && next < timeout) timeout = next;
+        if (timeout < 0) timeout = 0;
+        poll(fds.data(), fds.size(), (int) timeout);
+        wakeups++;
+        manager.check();
+        if (eventLogFile) {
+            eventLog.dump(&eventStream);
+            fflush(eventStream.file);
+        }
+
+        if (millis() - lastReport >= (unsigned long) interval * 1000) {
+            lastReport = millis();
+            WiThrottleSessionStats stats = manager.getStats();
+            printf("%lus: %d/%d connected, %lu commands (%lu bytes) received, %d queued (max %d), %lu dropped, %lu coalesced\n",
+                   (lastReport - start) / 1000, stats.connected, stats.sessions, stats.commandsReceived, stats.bytesReceived,
+                   stats.outboundQueueDepth, stats.outboundQueueHighWaterMark, stats.outboundCommandsDropped, stats.outboundCommandsCoalesced);
+            fflush(stdout);
+        }
+    }
+
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    printf("%lu wakeups, %.1f ms of CPU in %.1f s\n", wakeups,
+           usage.ru_utime.tv_sec * 1000.0 + usage.ru_utime.tv_usec / 1000.0 + usage.ru_stime.tv_sec * 1000.0 + usage.ru_stime.tv_usec / 1000.0,
+           (millis() - start) / 1000.0);
+
+    for (size_t i = 0; i < sessions.size(); i++) {
+        sessions[i]->disconnect();
+        delete sessions[i];
+        delete streams[i];
+    }
+    if (eventLogFile) {
+        eventLog.dump(&eventStream);
+        fclose(eventStream.file);
+    }
+    return 0;
+}
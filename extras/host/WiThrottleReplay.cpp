@@ -0,0 +1,380 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleReplay
+ *
+ * Replays a captured WiThrottle server session through
+ * WiThrottleProtocol::check() on a host computer, and reports the parse
+ * latency (p50/p99) and heap allocations per command type, and the overall
+ * throughput.
+ *
+ * The capture file is the text the server sent, one command per line (as
+ * saved from a terminal, netcat or a packet capture). Lines starting with '#'
+ * are not sent:
+ *   # comment
+ *   #@1500     advance the virtual clock to 1500ms after the start
+ *
+ * -l entries adds synthetic RL, PTL and PRL lists of that many entries to the
+ * replay (after the capture, if one is given), to show how list parsing scales.
+ *
+ * The commands are given to a WiThrottleProtocolDelegate, which copies them
+ * into Strings, or with -2 to a WiThrottleProtocolDelegateV2, which does not.
+ *
+ * -m families only processes those message families (the MessageFamily values
+ * or'ed together, e.g. -m 0x10 for just the fast time), to show what
+ * setMessageFamilies() saves.
+ *
+ * -t prints a trace of what the session did instead: every delegate method
+ * called, with its arguments, and every command it sent (==>). -e file
+ * compares the trace with the expected one in that file, and exits with 1 at
+ * the first difference, for the tests (ctest) to check that a change to the
+ * library has not changed what it does with a capture.
+ *
+ * Usage: WiThrottleReplay [-n iterations] [-l entries] [-2] [-m families] [-v] [-t | -e expectedfile] [capturefile]
+ *
+ */
+
+#include <algorithm>
+#include <cstdarg>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "WiThrottleProtocol.h"
+
+// every heap allocation made while a command is processed is counted
+static unsigned long allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void *operator new[](size_t size) {
+    allocations++;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+// the library sees this as millis()
+static unsigned long virtualMillis = 0;
+static unsigned long getVirtualMillis() { return virtualMillis; }
+
+/// @brief A Stream that reads from a memory buffer and discards what is written
+class MemoryStream : public Stream {
+  public:
+    void feed(const char *data, size_t length) {
+        this->data = data;
+        this->length = length;
+        position = 0;
+    }
+    int available() { return length - position; }
+    int read() { return position < length ? (unsigned char) data[position++] : -1; }
+    int peek() { return position < length ? (unsigned char) data[position] : -1; }
+    size_t readBytes(char *buffer, size_t size) {
+        size_t n = std::min(size, length - position);
+        memcpy(buffer, data + position, n);
+        position += n;
+        return n;
+    }
+    size_t write(uint8_t c) {
+        if (written && c != '\r') *written += (char) c;
+        return 1;
+    }
+    size_t write(const uint8_t *buffer, size_t size) {
+        for (size_t i = 0; i < size; i++) write(buffer[i]);
+        return size;
+    }
+
+    std::string *written = NULL;  // if set, what is written is kept here
+
+  private:
+    const char *data = NULL;
+    size_t length = 0;
+    size_t position = 0;
+};
+
+/// @brief A delegate that writes down every call, one line each. Text is put after a '|'
+class TraceDelegate : public WiThrottleProtocolDelegateV2 {
+  public:
+    std::string trace;
+
+    void onVersion(WiThrottleStringView version) { add("onVersion|%s", text(version).c_str()); }
+    void onServerType(WiThrottleStringView type) { add("onServerType|%s", text(type).c_str()); }
+    void onServerDescription(WiThrottleStringView description) { add("onServerDescription|%s", text(description).c_str()); }
+    void onMessage(WiThrottleStringView message) { add("onMessage|%s", text(message).c_str()); }
+    void onAlert(WiThrottleStringView alert) { add("onAlert|%s", text(alert).c_str()); }
+    void onRosterEntries(int rosterSize) { add("onRosterEntries %d", rosterSize); }
+    void onRosterEntry(int index, WiThrottleStringView name, uint16_t address) {
+        add("onRosterEntry %d %s|%s", index, addressText(address).c_str(), text(name).c_str());
+    }
+    void onTurnoutEntries(int turnoutListSize) { add("onTurnoutEntries %d", turnoutListSize); }
+    void onTurnoutEntry(int index, WiThrottleStringView sysName, WiThrottleStringView userName, int state) {
+        add("onTurnoutEntry %d %d|%s|%s", index, state, text(sysName).c_str(), text(userName).c_str());
+    }
+    void onRouteEntries(int routeListSize) { add("onRouteEntries %d", routeListSize); }
+    void onRouteEntry(int index, WiThrottleStringView sysName, WiThrottleStringView userName, int state) {
+        add("onRouteEntry %d %d|%s|%s", index, state, text(sysName).c_str(), text(userName).c_str());
+    }
+    void onFastTime(uint32_t time) { add("onFastTime %lu", (unsigned long) time); }
+    void onFastTimeRate(double rate) { add("onFastTimeRate %.3f", rate); }
+    void onHeartbeatConfig(int seconds) { add("onHeartbeatConfig %d", seconds); }
+    void onFunctionState(char multiThrottle, uint8_t func, bool state) { add("onFunctionState %c %d %d", multiThrottle, func, state); }
+    void onFunctionLabels(char multiThrottle, const WiThrottleStringView *labels, int count) {
+        std::string named;
+        for (int i = 0; i < count; i++) {
+            if (labels[i].length > 0) named += "|" + std::to_string(i) + "=" + text(labels[i]);
+        }
+        add("onFunctionLabels %c %d%s", multiThrottle, count, named.c_str());
+    }
+    void onSpeed(char multiThrottle, int speed) { add("onSpeed %c %d", multiThrottle, speed); }
+    void onDirection(char multiThrottle, Direction dir) { add("onDirection %c %d", multiThrottle, (int) dir); }
+    void onLocoDirection(char multiThrottle, uint16_t address, Direction dir) {
+        add("onLocoDirection %c %s %d", multiThrottle, addressText(address).c_str(), (int) dir);
+    }
+    void onSpeedSteps(char multiThrottle, int steps) { add("onSpeedSteps %c %d", multiThrottle, steps); }
+    void onWebPort(int port) { add("onWebPort %d", port); }
+    void onTrackPower(TrackPower state) { add("onTrackPower %d", (int) state); }
+    void onAddressAdded(char multiThrottle, uint16_t address, WiThrottleStringView entry) {
+        add("onAddressAdded %c %s|%s", multiThrottle, addressText(address).c_str(), text(entry).c_str());
+    }
+    void onAddressRemoved(char multiThrottle, uint16_t address, char command) {
+        add("onAddressRemoved %c %s %c", multiThrottle, addressText(address).c_str(), command);
+    }
+    void onAddressStealNeeded(char multiThrottle, uint16_t address, WiThrottleStringView entry) {
+        add("onAddressStealNeeded %c %s|%s", multiThrottle, addressText(address).c_str(), text(entry).c_str());
+    }
+    void onTurnoutAction(WiThrottleStringView systemName, TurnoutState state) { add("onTurnoutAction %d|%s", (int) state, text(systemName).c_str()); }
+    void onRouteAction(WiThrottleStringView systemName, RouteState state) { add("onRouteAction %d|%s", (int) state, text(systemName).c_str()); }
+    void onUnknownCommand(WiThrottleStringView unknownCommand) { add("onUnknownCommand|%s", text(unknownCommand).c_str()); }
+
+  private:
+    void add(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        trace += line;
+        trace += "\n";
+    }
+    static std::string text(WiThrottleStringView view) { return std::string(view.data, view.length); }
+    static std::string addressText(uint16_t address) {
+        char text[8];
+        WiThrottleProtocol::formatAddress(address, text);
+        return text;
+    }
+};
+
+/// @brief Per command type results
+struct CommandStats {
+    std::vector<double> nanoseconds;
+    unsigned long allocations = 0;
+    unsigned long bytes = 0;
+};
+
+// the command type a line is reported under, e.g. "MxA V", "PTL", "RL"
+static std::string commandType(const std::string &line) {
+    if (line.empty()) return "(empty)";
+    if (line.size() > 2 && line[0] == 'M') {
+        if (line[2] == 'A') {
+            size_t p = line.find(PROPERTY_SEPARATOR);
+            if (p != std::string::npos && p + 3 < line.size()) return std::string("MxA ") + line[p + 3];
+            return "MxA";
+        }
+        return std::string("Mx") + line[2];
+    }
+    static const char *prefixes[] = {"PFT", "PPA", "PTL", "PTA", "PRL", "PRA", "PW", "RL", "VN", "HT", "Ht", "HM", "Hm", "AT+", "*"};
+    for (const char *prefix : prefixes) {
+        if (line.compare(0, strlen(prefix), prefix) == 0) return prefix;
+    }
+    return "other";
+}
+
+// a synthetic RL, PTL or PRL line with the given number of entries
+static std::string syntheticList(const char *type, int entries) {
+    std::string line = type;
+    if (line == "RL") line += std::to_string(entries);
+    for (int i = 0; i < entries; i++) {
+        line += ENTRY_SEPARATOR;
+        if (line[0] == 'R') {
+            line += "Loco " + std::to_string(i) + SEGMENT_SEPARATOR + std::to_string(100 + i % 9900) + SEGMENT_SEPARATOR + "L";
+        } else {
+            line += std::string(type[1] == 'T' ? "LT" : "IR") + std::to_string(i) + SEGMENT_SEPARATOR + "Entry number " + std::to_string(i) + SEGMENT_SEPARATOR + "2";
+        }
+    }
+    return line;
+}
+
+static double percentile(std::vector<double> &values, double p) {
+    if (values.empty()) return 0;
+    std::sort(values.begin(), values.end());
+    size_t i = (size_t) (p * (values.size() - 1) + 0.5);
+    return values[i];
+}
+
+int main(int argc, char **argv) {
+    int iterations = 1;
+    int listEntries = 0;
+    bool verbose = false;
+    bool delegateV2 = false;
+    int families = MessageFamilyAll;
+    bool trace = false;
+    const char *expectedFilename = NULL;
+    const char *filename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) iterations = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) listEntries = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-2") == 0) delegateV2 = true;
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) families = strtol(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-v") == 0) verbose = true;
+        else if (strcmp(argv[i], "-t") == 0) trace = true;
+        else if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) expectedFilename = argv[++i];
+        else filename = argv[i];
+    }
+    if ((!filename && listEntries < 1) || iterations < 1) {
+        fprintf(stderr, "usage: %s [-n iterations] [-l entries] [-2] [-m families] [-v] [-t | -e expectedfile] [capturefile]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<std::string> lines;
+    if (filename) {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "cannot read %s\n", filename);
+            return 1;
+        }
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            lines.push_back(line);
+        }
+    }
+    if (listEntries > 0) {
+        lines.push_back(syntheticList("RL", listEntries));
+        lines.push_back(syntheticList("PTL", listEntries));
+        lines.push_back(syntheticList("PRL", listEntries));
+    }
+
+    // locos need to be on a throttle for their actions to be processed, so
+    // acquire the first address each throttle sees an action for
+    std::map<char, std::string> acquire;
+    for (const std::string &l : lines) {
+        if (l.size() > 3 && l[0] == 'M' && l[2] == 'A') {
+            size_t p = l.find(PROPERTY_SEPARATOR);
+            if (p != std::string::npos && p > 3 && l.compare(3, p - 3, "*") != 0 && !acquire.count(l[1])) {
+                acquire[l[1]] = l.substr(3, p - 3);
+            }
+        }
+    }
+
+    if (trace || expectedFilename) iterations = 1;
+
+    setMillisSource(getVirtualMillis);
+    std::map<std::string, CommandStats> stats;
+    TraceDelegate traceDelegate;
+    std::string written;
+    unsigned long totalBytes = 0;
+    double totalNanoseconds = 0;
+
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        virtualMillis = 0;
+        MemoryStream stream;
+        WiThrottleProtocolDelegate delegate;
+        WiThrottleProtocolDelegateV2 delegateWithoutCopies;
+        WiThrottleProtocol *protocol = new WiThrottleProtocol();
+        if (trace || expectedFilename) protocol->setDelegate(&traceDelegate);
+        else if (delegateV2) protocol->setDelegate(&delegateWithoutCopies);
+        else protocol->setDelegate(&delegate);
+        if (trace || expectedFilename) stream.written = &written;
+        protocol->setLogLevel(0);
+        protocol->setMessageFamilies(families);
+        protocol->connect(&stream);
+        for (auto &a : acquire) protocol->addLocomotive(a.first, String(a.second.c_str()));
+
+        // the commands sent go into the trace as they are written
+        auto traceWritten = [&]() {
+            size_t end;
+            while ((end = written.find('\n')) != std::string::npos) {
+                if (end > 0) traceDelegate.trace += "==> " + written.substr(0, end) + "\n";
+                written.erase(0, end + 1);
+            }
+        };
+        traceWritten();
+
+        for (const std::string &l : lines) {
+            if (!l.empty() && l[0] == '#') {
+                if (l.size() > 2 && l[1] == '@') virtualMillis = strtoul(l.c_str() + 2, NULL, 10);
+                continue;
+            }
+            std::string data = l + "\n";
+            stream.feed(data.data(), data.size());
+
+            unsigned long allocationsBefore = allocations;
+            auto start = std::chrono::steady_clock::now();
+            protocol->check();
+            auto end = std::chrono::steady_clock::now();
+            unsigned long allocated = allocations - allocationsBefore;
+            traceWritten();
+
+            double ns = std::chrono::duration<double, std::nano>(end - start).count();
+            CommandStats &s = stats[commandType(l)];
+            s.nanoseconds.push_back(ns);
+            s.allocations += allocated;
+            s.bytes += data.size();
+            totalBytes += data.size();
+            totalNanoseconds += ns;
+            if (verbose && iteration == 0) printf("%10.0fns %4lu allocs  %.80s%s\n", ns, allocated, l.c_str(), l.size() > 80 ? "..." : "");
+        }
+        delete protocol;
+    }
+
+    if (trace) {
+        fputs(traceDelegate.trace.c_str(), stdout);
+        return 0;
+    }
+    if (expectedFilename) {
+        std::ifstream file(expectedFilename, std::ios::binary);
+        if (!file) {
+            fprintf(stderr, "cannot read %s\n", expectedFilename);
+            return 1;
+        }
+        std::istringstream actual(traceDelegate.trace);
+        std::string expectedLine, actualLine;
+        for (int n = 1; ; n++) {
+            bool moreExpected = (bool) std::getline(file, expectedLine);
+            bool moreActual = (bool) std::getline(actual, actualLine);
+            if (!moreExpected && !moreActual) break;
+            if (moreExpected && !expectedLine.empty() && expectedLine.back() == '\r') expectedLine.pop_back();
+            if (moreExpected != moreActual || expectedLine != actualLine) {
+                printf("%s:%d: expected: %s\n", expectedFilename, n, moreExpected ? expectedLine.c_str() : "(end)");
+                printf("%s:%d:      got: %s\n", expectedFilename, n, moreActual ? actualLine.c_str() : "(end)");
+                return 1;
+            }
+        }
+        printf("%s: trace matches\n", filename ? filename : "(synthetic lists)");
+        return 0;
+    }
+
+    printf("%-10s %9s %12s %12s %12s\n", "command", "count", "p50 (ns)", "p99 (ns)", "allocs/cmd");
+    for (auto &entry : stats) {
+        CommandStats &s = entry.second;
+        size_t count = s.nanoseconds.size();
+        printf("%-10s %9zu %12.0f %12.0f %12.2f\n", entry.first.c_str(), count,
+               percentile(s.nanoseconds, 0.50), percentile(s.nanoseconds, 0.99), (double) s.allocations / count);
+    }
+    printf("\n%lu bytes in %.3f ms: %.1f MB/s\n", totalBytes, totalNanoseconds / 1e6,
+           totalNanoseconds > 0 ? totalBytes / (totalNanoseconds / 1e9) / 1e6 : 0.0);
+    return 0;
+}
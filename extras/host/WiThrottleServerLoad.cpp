@@ -0,0 +1,276 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleServerLoad
+ *
+ * Load test for WiThrottleServer over loopback TCP. Starts a server and
+ * connects N WiThrottleProtocol clients to it, all driven from one poll()
+ * loop in this process. Every client acquires a loco (pairs of clients share
+ * one by default), then in each round every client sets a new speed. The time
+ * from a client's setSpeed() until the server's echo reaches that client is
+ * recorded, and the latency percentiles and overall throughput are printed.
+ *
+ * With -f it instead measures the broadcast fan-out on its own: 1 to 100
+ * clients (on in-memory streams) all hold the same loco, and the server's
+ * setSpeed() is timed, separately from the flush() that writes the queued
+ * updates to the clients.
+ *
+ * Usage: WiThrottleServerLoad [-c clients] [-r rounds] [-s clients per loco] [-v]
+ *        WiThrottleServerLoad -f [-r rounds]
+ *   -c  number of clients (default 50)
+ *   -r  number of speed changes per client (default 200)
+ *   -s  how many clients share each loco (default 2)
+ *   -v  log the server's traffic
+ *   -f  fan-out benchmark
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "SocketStream.h"
+#include "WiThrottleServer.h"
+
+/// @brief Console that writes to stdout
+class StdoutStream : public Stream {
+  public:
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    size_t write(uint8_t c) { return fwrite(&c, 1, 1, stdout); }
+    size_t write(const uint8_t *buffer, size_t size) { return fwrite(buffer, 1, size, stdout); }
+};
+
+static double nowMicros() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/// @brief A client connection in memory: the commands to give the server, and a count of what it wrote
+class SinkStream : public Stream {
+  public:
+    std::string input;
+    size_t position = 0;
+    unsigned long bytes = 0;
+    unsigned long writes = 0;
+
+    int available() { return input.size() - position; }
+    int read() { return position < input.size() ? (unsigned char) input[position++] : -1; }
+    int peek() { return position < input.size() ? (unsigned char) input[position] : -1; }
+    size_t write(uint8_t c) { bytes++; writes++; return 1; }
+    size_t write(const uint8_t *buffer, size_t size) { bytes += size; writes++; return size; }
+};
+
+static int fanOutBenchmark(int rounds) {
+    static const int clientCounts[] = {1, 2, 5, 10, 20, 50, 100};
+    const int batch = WIT_SERVER_CLIENT_QUEUE;  // changes queued before each flush()
+    rounds = (rounds + batch - 1) / batch * batch;
+
+    printf("clients  setSpeed ns/change  flush ns/update  writes/client/change\n");
+    for (int clientCount : clientCounts) {
+        if (clientCount > WIT_SERVER_MAX_CLIENTS) {
+            printf("%7d  (more than WIT_SERVER_MAX_CLIENTS)\n", clientCount);
+            continue;
+        }
+        WiThrottleServer *server = new WiThrottleServer();
+        server->setLogLevel(0);
+        std::vector<SinkStream> streams(clientCount);
+        for (SinkStream &stream : streams) {
+            server->addClient(&stream);
+            stream.input = "M0+S3<;>\n";
+        }
+        server->check();
+        for (SinkStream &stream : streams) stream.writes = 0;
+
+        double setTime = 0;
+        double flushTime = 0;
+        for (int round = 0; round < rounds; round += batch) {
+            double start = nowMicros();
+            for (int i = 0; i < batch; i++) server->setSpeed(3, 'S', (round + i) % 127);
+            double queued = nowMicros();
+            server->flush();
+            setTime += queued - start;
+            flushTime += nowMicros() - queued;
+        }
+
+        unsigned long writes = 0;
+        for (SinkStream &stream : streams) writes += stream.writes;
+        printf("%7d  %18.0f  %15.1f  %20.3f\n", clientCount, setTime * 1000 / rounds,
+               flushTime * 1000 / ((double) rounds * clientCount), (double) writes / ((double) rounds * clientCount));
+        delete server;
+    }
+    return 0;
+}
+
+/// @brief A client, and the speed it is waiting to see echoed
+class LoadClient : public WiThrottleProtocolDelegate {
+  public:
+    SocketStream stream;
+    WiThrottleProtocol protocol;
+    bool acquired = false;
+    int expectedSpeed = -1;
+    double sentAt = 0;
+    unsigned long received = 0;
+    std::vector<double> *latencies = NULL;
+
+    void addressAddedMultiThrottle(char multiThrottle, String address, String entry) {
+        acquired = true;
+    }
+
+    void receivedSpeedMultiThrottle(char multiThrottle, int speed) {
+        received++;
+        if (speed == expectedSpeed) {
+            latencies->push_back(nowMicros() - sentAt);
+            expectedSpeed = -1;
+        }
+    }
+};
+
+static int listenLoopback(uint16_t *port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = 0;
+    socklen_t length = sizeof(address);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 128) != 0
+        || getsockname(fd, (struct sockaddr *) &address, &length) != 0) {
+        return -1;
+    }
+    *port = ntohs(address.sin_port);
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    int clientCount = 50;
+    int rounds = 200;
+    int share = 2;
+    bool verbose = false;
+    bool fanOut = false;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) clientCount = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) rounds = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) share = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-v") == 0) verbose = true;
+        else if (strcmp(argv[i], "-f") == 0) fanOut = true;
+        else clientCount = 0;
+    }
+    if (clientCount < 1 || clientCount > WIT_SERVER_MAX_CLIENTS || rounds < 1 || share < 1
+        || (clientCount + share - 1) / share > WIT_SERVER_MAX_LOCOS) {
+        fprintf(stderr, "usage: %s [-c clients (1-%d)] [-r rounds] [-s clients per loco] [-v] | -f [-r rounds]\n", argv[0], WIT_SERVER_MAX_CLIENTS);
+        return 2;
+    }
+    if (fanOut) return fanOutBenchmark(rounds * 100);
+
+    uint16_t port;
+    int listener = listenLoopback(&port);
+    if (listener < 0) {
+        perror("listen");
+        return 1;
+    }
+
+    StdoutStream console;
+    WiThrottleServer server;
+    server.setLogStream(&console);
+    server.setLogLevel(verbose ? 2 : 0);
+
+    std::vector<double> latencies;
+    std::vector<LoadClient *> clients;
+    std::vector<SocketStream *> serverStreams;
+    std::vector<struct pollfd> fds;
+
+    for (int i = 0; i < clientCount; i++) {
+        LoadClient *client = new LoadClient();
+        client->latencies = &latencies;
+        if (!client->stream.connect("127.0.0.1", port)) {
+            fprintf(stderr, "cannot connect client %d\n", i);
+            return 1;
+        }
+        int fd = accept(listener, NULL, NULL);
+        SocketStream *serverStream = new SocketStream();
+        serverStream->attach(fd);
+        if (server.addClient(serverStream) < 0) {
+            fprintf(stderr, "server refused client %d\n", i);
+            return 1;
+        }
+        client->protocol.setLogLevel(0);
+        client->protocol.setDelegate(client);
+        client->protocol.connect(&client->stream, 0);
+        client->protocol.setDeviceName(String("load ") + String(i));
+        client->protocol.addLocomotive('0', String("S") + String(1 + i / share));
+        clients.push_back(client);
+        serverStreams.push_back(serverStream);
+        fds.push_back({client->stream.fd(), POLLIN, 0});
+        fds.push_back({fd, POLLIN, 0});
+    }
+
+    // run the server and all the clients until nothing is outstanding, or for at most a second
+    auto pump = [&](bool (*done)(std::vector<LoadClient *> &)) {
+        double deadline = nowMicros() + 1e6;
+        while (!done(clients) && nowMicros() < deadline) {
+            // the clients' commands go out from check(), so run it before sleeping
+            for (LoadClient *client : clients) client->protocol.check();
+            server.check();
+            if (done(clients)) break;
+            long timeout = 10;
+            for (LoadClient *client : clients) {
+                long next = client->protocol.getTimeUntilNextEvent();
+                if (next >= 0 && next < timeout) timeout = next;
+            }
+            poll(fds.data(), fds.size(), (int) timeout);
+        }
+        return done(clients);
+    };
+
+    if (!pump([](std::vector<LoadClient *> &c) { return std::all_of(c.begin(), c.end(), [](LoadClient *l) { return l->acquired; }); })) {
+        fprintf(stderr, "not all the clients acquired their loco\n");
+        return 1;
+    }
+    for (LoadClient *client : clients) client->received = 0;
+
+    int lost = 0;
+    double start = nowMicros();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t i = 0; i < clients.size(); i++) {
+            // clients sharing a loco set different speeds, so each one waits for its own echo
+            LoadClient *client = clients[i];
+            client->expectedSpeed = 1 + (round + i) % 100;
+            client->sentAt = nowMicros();
+            client->protocol.setSpeed('0', client->expectedSpeed, true);
+        }
+        if (!pump([](std::vector<LoadClient *> &c) { return std::all_of(c.begin(), c.end(), [](LoadClient *l) { return l->expectedSpeed < 0; }); })) {
+            for (LoadClient *client : clients) lost += (client->expectedSpeed >= 0);
+        }
+    }
+    double elapsed = (nowMicros() - start) / 1e6;
+
+    unsigned long delivered = 0;
+    for (LoadClient *client : clients) delivered += client->received;
+    std::sort(latencies.begin(), latencies.end());
+    if (latencies.empty()) {
+        fprintf(stderr, "no echoes were received\n");
+        return 1;
+    }
+    printf("%d clients, %d per loco, %d rounds: %d speed changes in %.2f s (%.0f/s), %lu updates delivered (%.0f/s), %d lost\n",
+           clientCount, share, rounds, clientCount * rounds, elapsed, clientCount * rounds / elapsed, delivered, delivered / elapsed, lost);
+    printf("set to echo latency: p50 %.0f us, p99 %.0f us, max %.0f us\n",
+           latencies[latencies.size() / 2], latencies[latencies.size() * 99 / 100], latencies.back());
+
+    for (size_t i = 0; i < clients.size(); i++) {
+        clients[i]->protocol.disconnect();
+        delete clients[i];
+        delete serverStreams[i];
+    }
+    close(listener);
+    return lost ? 1 : 0;
+}
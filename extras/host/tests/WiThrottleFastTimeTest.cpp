@@ -0,0 +1,160 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleFastTimeTest
+ *
+ * Checks getFastTime() and getTimeUntilFastTimeChange() against values worked
+ * out by hand, as the server changes the rate, resyncs the time and stops the
+ * clock, with the virtual millis() wrapping around part way through, and that
+ * onFastTime() sees the rate sent with the time.
+ *
+ * Run by ctest. Exits with 1 if any check fails.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "WiThrottleProtocol.h"
+
+static int failures = 0;
+#define EXPECT_EQ(actual, expected) do { \
+        long long a_ = (actual), e_ = (expected); \
+        if (a_ != e_) { printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, a_, e_); failures++; } \
+    } while (0)
+
+// the library sees this as millis()
+static unsigned long virtualMillis = 0;
+static unsigned long getVirtualMillis() { return virtualMillis; }
+
+// the fast time, in milliseconds
+static unsigned long long fastTime(WiThrottleProtocol &protocol) {
+    uint16_t milliseconds;
+    uint32_t seconds = protocol.getFastTime(&milliseconds);
+    return seconds * 1000ULL + milliseconds;
+}
+
+/// @brief Records the rate the session gives while the delegate is told of the new time
+class RateDelegate : public WiThrottleProtocolDelegateV2 {
+  public:
+    WiThrottleProtocol *protocol = NULL;
+    long rateSeen = -1;
+    void onFastTime(uint32_t time) { rateSeen = protocol->getFastTimeRateThousandths(); }
+};
+
+static void receive(WiThrottleProtocol &protocol, const char *command) {
+    protocol.processInput(command, strlen(command));
+    protocol.processInput("\n", 1);
+}
+
+int main() {
+    setMillisSource(getVirtualMillis);
+    NullStream stream;
+    WiThrottleProtocol protocol;
+    protocol.setLogLevel(0);
+    virtualMillis = (unsigned long) -1 - 1499;  // millis() wraps 1.5s in
+    protocol.connect(&stream, 0);
+
+    // not running until the server sends the time
+    EXPECT_EQ(protocol.getFastTimeRateThousandths(), 0);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), -1);
+
+    // 4:1, across the wrap
+    receive(protocol, "PFT1700000000<;>4.0");
+    EXPECT_EQ(protocol.getFastTimeRateThousandths(), 4000);
+    EXPECT_EQ(fastTime(protocol), 1700000000000ULL);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 1000);
+    virtualMillis += 250;
+    EXPECT_EQ(fastTime(protocol), 1700000001000ULL);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 750);
+    virtualMillis += 1000;  // millis() is now 250ms short of wrapping
+    EXPECT_EQ(fastTime(protocol), 1700000005000ULL);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 0);
+    EXPECT_EQ(protocol.check(), true);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 750);
+    virtualMillis += 583;  // and now 333ms past it
+    EXPECT_EQ(virtualMillis, 333);
+    EXPECT_EQ(fastTime(protocol), 1700000007332ULL);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 167);
+
+    // a resync part way through a second starts the second again
+    receive(protocol, "PFT1700000010<;>4.0");
+    EXPECT_EQ(fastTime(protocol), 1700000010000ULL);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 1000);
+    virtualMillis += 999;
+    EXPECT_EQ(fastTime(protocol), 1700000013996ULL);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 1);
+    virtualMillis += 1;
+    EXPECT_EQ(fastTime(protocol), 1700000014000ULL);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 0);  // reading the time doesn't lose the tick
+    EXPECT_EQ(protocol.check(), true);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 1000);
+
+    // a rate that isn't a whole number of fast milliseconds per real millisecond
+    receive(protocol, "PFT1700000000<;>3.3");
+    EXPECT_EQ(protocol.getFastTimeRateThousandths(), 3300);
+    virtualMillis += 7;
+    EXPECT_EQ(fastTime(protocol), 1700000000023ULL);  // 23.1, truncated
+    virtualMillis += 993;
+    EXPECT_EQ(fastTime(protocol), 1700000003300ULL);
+    virtualMillis += 3 * 3600000UL;  // three hours, nothing lost to rounding
+    EXPECT_EQ(fastTime(protocol), 1700035643300ULL);
+
+    // slower than real time
+    receive(protocol, "PFT1700000000<;>0.25");
+    EXPECT_EQ(protocol.getFastTimeRateThousandths(), 250);
+    virtualMillis += 3999;
+    EXPECT_EQ(fastTime(protocol), 1700000000999ULL);
+    virtualMillis += 1;
+    EXPECT_EQ(fastTime(protocol), 1700000001000ULL);
+
+    // notified at each fast minute: the deadline is the real time until the next one.
+    // 1699999980 is a whole number of minutes
+    protocol.setFastTimeGranularity(60);
+    receive(protocol, "PFT1699999990<;>4.0");
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 50 * 1000 / 4);
+    virtualMillis += 12000;
+    EXPECT_EQ(protocol.getFastTime(), 1699999990 + 48);  // reading the time doesn't move the deadline
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 500);
+    virtualMillis += 500;
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 0);
+    EXPECT_EQ(protocol.check(), true);
+    EXPECT_EQ(protocol.getFastTime(), 1700000040);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 15000);
+
+    // a rate change moves the deadline. At 3.3 fast seconds a second, 48 fast seconds is 14545.45 real ms
+    receive(protocol, "PFT1700000052<;>3.3");
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 14546);
+    virtualMillis += 14545;
+    EXPECT_EQ(protocol.getFastTime(), 1700000099);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 1);
+    virtualMillis += 1;
+    EXPECT_EQ(protocol.getFastTime(), 1700000100);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), 0);
+    protocol.setFastTimeGranularity(0);
+
+    // the fastest rate the library runs at
+    receive(protocol, "PFT1700000000<;>5000.0");
+    EXPECT_EQ(protocol.getFastTimeRateThousandths(), WIT_FAST_TIME_MAX_RATE);
+    virtualMillis += 86400000UL;  // a real day
+    EXPECT_EQ(protocol.getFastTime(), 1700000000UL + 86400UL * (WIT_FAST_TIME_MAX_RATE / 1000));
+
+    // stopped: the time holds, and there is no deadline
+    receive(protocol, "PFT1700000000<;>0.0");
+    EXPECT_EQ(protocol.getFastTimeRateThousandths(), 0);
+    virtualMillis += 60000;
+    EXPECT_EQ(fastTime(protocol), 1700000000000ULL);
+    EXPECT_EQ(protocol.getTimeUntilFastTimeChange(), -1);
+
+    // restarted: onFastTime() already sees the new rate
+    RateDelegate delegate;
+    delegate.protocol = &protocol;
+    protocol.setDelegate(&delegate);
+    receive(protocol, "PFT1700000000<;>2.0");
+    EXPECT_EQ(delegate.rateSeen, 2000);
+    receive(protocol, "PFT1700000000<;>0.0");
+    EXPECT_EQ(delegate.rateSeen, 0);
+
+    if (failures) printf("%d checks failed\n", failures);
+    else printf("all checks passed\n");
+    return failures ? 1 : 0;
+}
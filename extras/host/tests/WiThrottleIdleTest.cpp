@@ -0,0 +1,160 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleIdleTest
+ *
+ * Checks that a host that sleeps for getTimeUntilNextEvent() between calls to
+ * check() (as WiThrottleMonitor does with poll()) is only woken when there is
+ * work to do. The clock is virtual and the server is a script, so the deadlines
+ * can be asserted exactly, and an hour of running takes no time.
+ *
+ * Run by ctest. Exits with 1 if any check fails.
+ *
+ */
+
+#include <stdio.h>
+#include <string>
+
+#include "WiThrottleProtocol.h"
+
+static int failures = 0;
+#define EXPECT_EQ(actual, expected) do { \
+        long long a_ = (actual), e_ = (expected); \
+        if (a_ != e_) { printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, a_, e_); failures++; } \
+    } while (0)
+
+// the library sees this as millis()
+static unsigned long virtualMillis = 1000;
+static unsigned long getVirtualMillis() { return virtualMillis; }
+
+/// @brief The server: what it has sent that the session has not read yet, and what the session wrote
+class ScriptStream : public Stream {
+  public:
+    std::string input;
+    std::string output;
+
+    int available() { return input.size(); }
+    int read() {
+        if (input.empty()) return -1;
+        int c = (unsigned char) input[0];
+        input.erase(0, 1);
+        return c;
+    }
+    int peek() { return input.empty() ? -1 : (unsigned char) input[0]; }
+    size_t write(uint8_t c) { output += (char) c; return 1; }
+    size_t write(const uint8_t *buffer, size_t size) { output.append((const char *) buffer, size); return size; }
+};
+
+/// @brief Counts the fast clock notifications
+class ClockDelegate : public WiThrottleProtocolDelegateV2 {
+  public:
+    unsigned long notifications = 0;
+    void onFastTime(uint32_t time) { notifications++; }
+};
+
+/// @brief What an event loop did: how often it called check(), and how many of those calls found nothing to do
+struct LoopStats {
+    unsigned long wakeups = 0;
+    unsigned long idleWakeups = 0;
+};
+
+// sleep on getTimeUntilNextEvent() until the virtual clock reaches 'until'. With no data
+// arriving, a wakeup that sends nothing and notifies nothing was not needed
+static LoopStats runLoop(WiThrottleProtocol &protocol, ScriptStream &server, ClockDelegate &delegate, unsigned long until) {
+    LoopStats stats;
+    while (true) {
+        long next = protocol.getTimeUntilNextEvent();
+        if (next < 0 || virtualMillis + next > until) break;
+        virtualMillis += next;
+        size_t written = server.output.size();
+        unsigned long notifications = delegate.notifications;
+        int queued = protocol.getOutboundQueueDepth();
+        protocol.check();
+        stats.wakeups++;
+        if (server.output.size() == written && delegate.notifications == notifications
+            && protocol.getOutboundQueueDepth() == queued) {
+            stats.idleWakeups++;
+        }
+    }
+    virtualMillis = until;
+    return stats;
+}
+
+static int count(const std::string &text, const char *what) {
+    int n = 0;
+    for (size_t p = text.find(what); p != std::string::npos; p = text.find(what, p + 1)) n++;
+    return n;
+}
+
+int main() {
+    setMillisSource(getVirtualMillis);
+    ScriptStream server;
+    ClockDelegate delegate;
+    WiThrottleProtocol protocol;
+    protocol.setLogLevel(0);
+    protocol.setDelegate(&delegate);
+    protocol.connect(&server, 50);
+
+    // nothing running: no deadline, so an hour passes without check() being called
+    EXPECT_EQ(protocol.getTimeUntilNextEvent(), -1);
+    LoopStats stats = runLoop(protocol, server, delegate, virtualMillis + 3600000UL);
+    EXPECT_EQ(stats.wakeups, 0);
+
+    // a queued command is due when the minimum delay since the last one has passed
+    protocol.setDeviceName("idle");
+    protocol.setDeviceName("idle 2");
+    EXPECT_EQ(protocol.getOutboundQueueDepth(), 1);
+    EXPECT_EQ(protocol.getTimeUntilNextEvent(), 51);
+    virtualMillis += 50;
+    protocol.check();
+    EXPECT_EQ(protocol.getOutboundQueueDepth(), 1);
+    EXPECT_EQ(protocol.getTimeUntilNextEvent(), 1);
+    virtualMillis += 1;
+    protocol.check();
+    EXPECT_EQ(protocol.getOutboundQueueDepth(), 0);
+    EXPECT_EQ(protocol.getTimeUntilNextEvent(), -1);
+
+    // the server asks for a heartbeat every 10 seconds, so one is due every 5. The timer started
+    // when the session connected, an hour ago, so the first is due straight away
+    server.input = "*10\n";
+    protocol.check();
+    protocol.requireHeartbeat(true);
+    EXPECT_EQ(protocol.getTimeUntilNextEvent(), 0);
+    protocol.check();  // queues the heartbeat behind "*+"
+    EXPECT_EQ(protocol.getOutboundQueueDepth(), 3);
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(protocol.getTimeUntilNextEvent(), 51);
+        virtualMillis += 51;
+        protocol.check();
+    }
+    EXPECT_EQ(protocol.getOutboundQueueDepth(), 0);
+    EXPECT_EQ(protocol.getTimeUntilNextEvent(), 5001 - 153);
+
+    // not a millisecond early
+    virtualMillis += 5001 - 153 - 1;
+    server.output.clear();
+    protocol.check();
+    EXPECT_EQ(server.output.size(), 0);
+    EXPECT_EQ(protocol.getTimeUntilNextEvent(), 1);
+
+    // an hour of heartbeats wakes the loop only to send them
+    stats = runLoop(protocol, server, delegate, virtualMillis + 3600000UL);
+    EXPECT_EQ(stats.idleWakeups, 0);
+    EXPECT_EQ(count(server.output, "*\r\n"), (3600000 - 1) / 5001 + 1);
+    EXPECT_EQ(stats.wakeups, 2 * count(server.output, "*\r\n"));  // the heartbeat, then the device name 51ms later
+
+    // and a fast clock at 4:1, shown to the minute: one notification every 15 (real) seconds, and
+    // the clock does not wake the loop in between
+    server.input = "PFT1700000000<;>4.0\n";
+    protocol.setFastTimeGranularity(60);
+    protocol.check();
+    delegate.notifications = 0;
+    server.output.clear();
+    stats = runLoop(protocol, server, delegate, virtualMillis + 3600000UL);
+    EXPECT_EQ(stats.idleWakeups, 0);
+    EXPECT_EQ(delegate.notifications, 3600 / 15);
+    EXPECT_EQ(stats.wakeups, 2 * count(server.output, "*\r\n") + 3600 / 15);
+
+    if (failures) printf("%d checks failed\n", failures);
+    else printf("all checks passed\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocol
+ *
+ * This package implements a WiThrottle protocol connection,
+ * allow a device to communicate with a JMRI server or other
+ * WiThrottleProtocol device (like the Digitrax LNWI).
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "WiThrottleConnectionManager.h"
+
+WiThrottleConnectionManager::WiThrottleConnectionManager() {
+    sessionCount = 0;
+    nextSession = 0;
+}
+
+int WiThrottleConnectionManager::addSession(WiThrottleProtocol *session) {
+    if (!session || sessionCount >= WIT_MAX_SESSIONS) return -1;
+    sessions[sessionCount] = session;
+    return sessionCount++;
+}
+
+bool WiThrottleConnectionManager::removeSession(WiThrottleProtocol *session) {
+    for (int i = 0; i < sessionCount; i++) {
+        if (sessions[i] == session) {
+            for (int j = i; j < sessionCount - 1; j++) sessions[j] = sessions[j + 1];
+            sessionCount--;
+            if (nextSession >= sessionCount) nextSession = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+WiThrottleProtocol *WiThrottleConnectionManager::getSession(int index) {
+    return (index >= 0 && index < sessionCount) ? sessions[index] : NULL;
+}
+
+bool WiThrottleConnectionManager::check() {
+    bool changed = false;
+    for (int n = 0; n < sessionCount; n++) {
+        changed |= sessions[(nextSession + n) % sessionCount]->check();
+    }
+    if (sessionCount > 0) nextSession = (nextSession + 1) % sessionCount;
+    return changed;
+}
+
+bool WiThrottleConnectionManager::check(int index) {
+    WiThrottleProtocol *session = getSession(index);
+    return session ? session->check() : false;
+}
+
+long WiThrottleConnectionManager::getTimeUntilNextEvent() {
+    long next = -1;
+    for (int i = 0; i < sessionCount; i++) {
+        long t = sessions[i]->getTimeUntilNextEvent();
+        if (t >= 0 && (next < 0 || t < next)) next = t;
+    }
+    return next;
+}
+
+WiThrottleSessionStats WiThrottleConnectionManager::getStats() {
+    WiThrottleSessionStats stats;
+    long now = millis() / 1000;
+    stats.sessions = sessionCount;
+    for (int i = 0; i < sessionCount; i++) {
+        WiThrottleProtocol *session = sessions[i];
+        if (now - session->getLastServerResponseTime() <= responseTimeout) stats.connected++;
+        stats.bytesReceived += session->getBytesReceived();
+        stats.commandsReceived += session->getCommandsReceived();
+        stats.outboundQueueDepth += session->getOutboundQueueDepth();
+        if (session->getOutboundQueueHighWaterMark() > stats.outboundQueueHighWaterMark) {
+            stats.outboundQueueHighWaterMark = session->getOutboundQueueHighWaterMark();
+        }
+        stats.outboundCommandsDropped += session->getOutboundCommandsDropped();
+        stats.outboundCommandsCoalesced += session->getOutboundCommandsCoalesced();
+    }
+    return stats;
+}
@@ -0,0 +1,105 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocol
+ *
+ * This package implements a WiThrottle protocol connection,
+ * allow a device to communicate with a JMRI server or other
+ * WiThrottleProtocol device (like the Digitrax LNWI).
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef WITHROTTLE_CONNECTION_MANAGER_H
+#define WITHROTTLE_CONNECTION_MANAGER_H
+
+#include "WiThrottleProtocol.h"
+
+// Number of sessions a WiThrottleConnectionManager can drive
+#ifndef WIT_MAX_SESSIONS
+#define WIT_MAX_SESSIONS 32
+#endif
+
+/// @brief Totals over all the sessions of a WiThrottleConnectionManager
+struct WiThrottleSessionStats {
+    int sessions = 0;                          ///< number of sessions
+    int connected = 0;                         ///< sessions that have heard from their server within the timeout
+    unsigned long bytesReceived = 0;           ///< bytes read from all the servers
+    unsigned long commandsReceived = 0;        ///< commands received from all the servers
+    int outboundQueueDepth = 0;                ///< commands waiting in all the outbound queues
+    int outboundQueueHighWaterMark = 0;        ///< largest high water mark of any of the outbound queues
+    unsigned long outboundCommandsDropped = 0; ///< outbound commands discarded by all the sessions
+    unsigned long outboundCommandsCoalesced = 0; ///< outbound commands coalesced by all the sessions
+};
+
+/// @brief Drives several WiThrottleProtocol sessions (each connected to a different server) from one loop.
+/// The manager does not own the sessions or their streams.
+class WiThrottleConnectionManager {
+
+  public:
+    /// @brief Create an empty manager
+    WiThrottleConnectionManager();
+
+    /// @brief Add a session. It should already be connected to its stream
+    /// @param session pointer to the session
+    /// @return Index of the session, or -1 if the manager is full (WIT_MAX_SESSIONS)
+    int addSession(WiThrottleProtocol *session);
+
+    /// @brief Remove a session. The sessions after it move down one index
+    /// @param session pointer to the session
+    /// @return False if the session was not found
+    bool removeSession(WiThrottleProtocol *session);
+
+    /// @brief Get the number of sessions
+    int getSessionCount() { return sessionCount; }
+
+    /// @brief Get a session
+    /// @param index index of the session
+    /// @return Pointer to the session, or NULL if there is no such session
+    WiThrottleProtocol *getSession(int index);
+
+    /// @brief Check every session once, starting after the one checked first last time so that a busy server can't starve the others. Should be called repeatedly, and often, in the main loop.
+    /// @return True if there have been updates from any server
+    bool check();
+
+    /// @brief Check one session, e.g. when its stream is known to be readable
+    /// @param index index of the session
+    /// @return True if there have been updates from the server
+    bool check(int index);
+
+    /// @brief Get how long until any session next has timer work to do. See WiThrottleProtocol::getTimeUntilNextEvent()
+    /// @return Milliseconds until the next timer is due (0 if it is due now), or -1 if there are no timers running
+    long getTimeUntilNextEvent();
+
+    /// @brief Set how long a session can go without hearing from its server before it is no longer counted as connected. The default is 30 seconds
+    /// @param seconds timeout in seconds
+    void setResponseTimeout(long seconds) { responseTimeout = seconds; }
+
+    /// @brief Get the totals over all the sessions
+    /// @return Aggregate statistics
+    WiThrottleSessionStats getStats();
+
+  private:
+    WiThrottleProtocol *sessions[WIT_MAX_SESSIONS];
+    int sessionCount;
+    int nextSession;  // the session check() starts with
+    long responseTimeout = 30;
+};
+
+#endif // WITHROTTLE_CONNECTION_MANAGER_H
@@ -0,0 +1,156 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocol
+ *
+ * This package implements a WiThrottle protocol connection,
+ * allow a device to communicate with a JMRI server or other
+ * WiThrottleProtocol device (like the Digitrax LNWI).
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "WiThrottleEventLog.h"
+
+// how to show each type of event as text. A label of NULL means the number is not used
+struct EventFormat {
+    uint8_t event;
+    const char *name;
+    const char *a;
+    const char *b;
+    bool aIsThrottle;   // show a as a character
+};
+
+static const EventFormat eventFormats[] = {
+    { EventConnected,                "connected",        "delay",    NULL,       false },
+    { EventReceived,                 "<==",              NULL,       NULL,       false },
+    { EventSent,                     "==>",              "lane",     "waited",   false },
+    { EventQueueRejected,            "queue full, rejected", "lane", NULL,       false },
+    { EventQueueDropped,             "queue full, dropped",  "lane", NULL,       false },
+    { EventCoalesced,                "coalesced",        "lane",     NULL,       false },
+    { EventHeartbeat,                "heartbeat",        "period",   "silent",   false },
+    { EventUnknownCommand,           "unknown command",  NULL,       NULL,       false },
+    { EventUnknownThrottle,          "unknown throttle", "throttle", NULL,       true },
+    { EventEmergencyStop,            "emergency stop",   "throttle", NULL,       true },
+    { EventFastTime,                 "fast time",        "time",     "rate*1000", false },
+    { EventServerClientConnected,    "server: client connected",    "client", NULL, false },
+    { EventServerClientDisconnected, "server: client disconnected", "client", NULL, false },
+    { EventServerReceived,           "server: <==",      "client",   NULL,       false },
+    { EventServerCommandTooLong,     "server: command too long",    "client", NULL, false },
+    { EventServerUnknownCommand,     "server: unknown command",     "client", NULL, false },
+    { EventServerHeartbeatLost,      "server: heartbeat lost",      "client", NULL, false },
+};
+
+static uint32_t getLittleEndian(const uint8_t *data) {
+    return (uint32_t) data[0] | ((uint32_t) data[1] << 8) | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24);
+}
+
+WiThrottleEventLog::WiThrottleEventLog() {
+    eventsLost = 0;
+    clear();
+}
+
+void WiThrottleEventLog::clear() {
+    head = 0;
+    count = 0;
+}
+
+void WiThrottleEventLog::record(WiThrottleEvent event, long a, long b, const char *text, int len) {
+    if (text == NULL || len < 0) len = 0;
+    if (len > WIT_EVENT_TEXT_SIZE) len = WIT_EVENT_TEXT_SIZE;
+    size_t length = WIT_EVENT_HEADER_SIZE + len;
+
+    // make room by discarding the oldest events
+    while (WIT_EVENT_LOG_SIZE - count < length) {
+        size_t oldest = firstEventLength();
+        head = (head + oldest) % WIT_EVENT_LOG_SIZE;
+        count -= oldest;
+        eventsLost++;
+    }
+
+    size_t offset = count;
+    uint32_t numbers[3] = { (uint32_t) millis(), (uint32_t) a, (uint32_t) b };
+    put(offset++, (uint8_t) event);
+    put(offset++, (uint8_t) len);
+    for (int n = 0; n < 3; n++) {
+        for (int i = 0; i < 4; i++) put(offset++, (uint8_t) (numbers[n] >> (8 * i)));
+    }
+    for (int i = 0; i < len; i++) put(offset++, (uint8_t) text[i]);
+    count += length;
+}
+
+size_t WiThrottleEventLog::read(uint8_t *data, size_t size) {
+    size_t taken = 0;
+    while (count > 0) {
+        size_t length = firstEventLength();
+        if (taken + length > size) break;
+        for (size_t i = 0; i < length; i++) data[taken + i] = get(i);
+        head = (head + length) % WIT_EVENT_LOG_SIZE;
+        count -= length;
+        taken += length;
+    }
+    return taken;
+}
+
+size_t WiThrottleEventLog::dump(Stream *stream) {
+    uint8_t event[WIT_EVENT_HEADER_SIZE + WIT_EVENT_TEXT_SIZE];
+    size_t written = 0;
+    size_t length;
+    while ((length = read(event, sizeof(event))) > 0) {
+        written += stream->write(event, length);
+    }
+    return written;
+}
+
+void WiThrottleEventLog::print(Stream *stream) {
+    uint8_t event[WIT_EVENT_HEADER_SIZE + WIT_EVENT_TEXT_SIZE];
+    char text[64 + WIT_EVENT_TEXT_SIZE];
+    size_t length;
+    while ((length = read(event, sizeof(event))) > 0) {
+        decode(event, length, text, sizeof(text));
+        stream->println(text);
+    }
+}
+
+size_t WiThrottleEventLog::decode(const uint8_t *data, size_t length, char *text, size_t size) {
+    if (size > 0) text[0] = 0;
+    if (length < WIT_EVENT_HEADER_SIZE || data[1] > WIT_EVENT_TEXT_SIZE || length < (size_t) WIT_EVENT_HEADER_SIZE + data[1]) return 0;
+
+    const EventFormat *format = NULL;
+    for (size_t i = 0; i < sizeof(eventFormats) / sizeof(eventFormats[0]); i++) {
+        if (eventFormats[i].event == data[0]) format = &eventFormats[i];
+    }
+    if (format == NULL) return 0;
+
+    unsigned long time = getLittleEndian(data + 2);
+    long a = (int32_t) getLittleEndian(data + 6);
+    long b = (int32_t) getLittleEndian(data + 10);
+    int used = snprintf(text, size, "%10lu %s", time, format->name);
+    if (format->a && used >= 0 && (size_t) used < size) {
+        if (format->aIsThrottle) used += snprintf(text + used, size - used, " %s=%c", format->a, (char) a);
+        else used += snprintf(text + used, size - used, " %s=%ld", format->a, a);
+    }
+    if (format->b && used >= 0 && (size_t) used < size) {
+        used += snprintf(text + used, size - used, " %s=%ld", format->b, b);
+    }
+    if (data[1] > 0 && used >= 0 && (size_t) used < size) {
+        snprintf(text + used, size - used, " %.*s", (int) data[1], (const char *) data + WIT_EVENT_HEADER_SIZE);
+    }
+    return WIT_EVENT_HEADER_SIZE + data[1];
+}
@@ -0,0 +1,143 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocol
+ *
+ * This package implements a WiThrottle protocol connection,
+ * allow a device to communicate with a JMRI server or other
+ * WiThrottleProtocol device (like the Digitrax LNWI).
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef WITHROTTLE_EVENT_LOG_H
+#define WITHROTTLE_EVENT_LOG_H
+
+#include "Arduino.h"
+
+// Size (bytes) of the buffer of a WiThrottleEventLog. Each event takes WIT_EVENT_HEADER_SIZE bytes plus its text
+#ifndef WIT_EVENT_LOG_SIZE
+#define WIT_EVENT_LOG_SIZE 1024
+#endif
+
+// Longest text recorded with an event (longer text is cut short), at most 255
+#ifndef WIT_EVENT_TEXT_SIZE
+#define WIT_EVENT_TEXT_SIZE 24
+#endif
+#if WIT_EVENT_TEXT_SIZE > 255
+#error "WIT_EVENT_TEXT_SIZE can be at most 255"
+#endif
+
+// An event is its type, the length of its text, the time (millis()) and two numbers, all little-endian, then the text
+#define WIT_EVENT_HEADER_SIZE 14
+
+#if WIT_EVENT_LOG_SIZE < WIT_EVENT_HEADER_SIZE + WIT_EVENT_TEXT_SIZE
+#error "WIT_EVENT_LOG_SIZE must be at least WIT_EVENT_HEADER_SIZE + WIT_EVENT_TEXT_SIZE"
+#endif
+
+/// @brief Events recorded in a WiThrottleEventLog, with what their two numbers and text hold
+enum WiThrottleEvent {
+    EventConnected = 1,                 ///< connect(). a: minimum delay between commands (ms)
+    EventReceived = 2,                  ///< command received. text: the command (just the start of a list)
+    EventSent = 3,                      ///< command sent. a: lane, b: time it waited in the queue (ms). text: the command
+    EventQueueRejected = 4,             ///< outbound queue full, new command discarded. a: lane. text: the command
+    EventQueueDropped = 5,              ///< outbound queue full, queued command discarded. a: lane. text: the command
+    EventCoalesced = 6,                 ///< command replaced a queued one for the same loco. a: lane. text: the command
+    EventHeartbeat = 7,                 ///< heartbeat sent. a: heartbeat period (s), b: time since the server was last heard from (s)
+    EventUnknownCommand = 8,            ///< command not recognised. text: the command
+    EventUnknownThrottle = 9,           ///< command for a throttle that does not exist. a: throttle
+    EventEmergencyStop = 10,            ///< emergencyStop(). a: throttle. text: address
+    EventFastTime = 11,                 ///< fast time received. a: time (s), b: rate * 1000
+
+    EventServerClientConnected = 32,    ///< server: client added. a: client
+    EventServerClientDisconnected = 33, ///< server: client removed. a: client
+    EventServerReceived = 34,           ///< server: command received. a: client. text: the command
+    EventServerCommandTooLong = 35,     ///< server: command longer than WIT_SERVER_INPUT_SIZE discarded. a: client
+    EventServerUnknownCommand = 36,     ///< server: command not recognised. a: client. text: the command
+    EventServerHeartbeatLost = 37       ///< server: client's heartbeat lost, its locos stopped. a: client
+};
+
+/// @brief A log of compact binary events, kept in a fixed ring buffer. Recording an event takes constant time and never
+/// writes to a Stream, so it can be left on (unlike a log level that prints to a slow Serial console) while check() runs.
+/// When the buffer is full the oldest events are discarded. The application drains the events when it is idle, with
+/// read() or dump() (binary, for the WiThrottleLogDecode host tool) or print() (as text).
+class WiThrottleEventLog {
+
+  public:
+    /// @brief Create an empty event log
+    WiThrottleEventLog();
+
+    /// @brief Discard all the events
+    void clear();
+
+    /// @brief Record an event
+    /// @param event type of event
+    /// @param a first number (see WiThrottleEvent)
+    /// @param b second number
+    /// @param text text, or NULL. Only the first WIT_EVENT_TEXT_SIZE characters are kept
+    /// @param len length of the text
+    void record(WiThrottleEvent event, long a, long b, const char *text, int len);
+
+    /// @brief Record an event without text
+    /// @param event type of event
+    /// @param a first number (see WiThrottleEvent)
+    /// @param b second number
+    void record(WiThrottleEvent event, long a = 0, long b = 0) { record(event, a, b, NULL, 0); }
+
+    /// @brief Get the number of bytes of events waiting to be read
+    size_t available() const { return count; }
+
+    /// @brief Get the number of events discarded, since the log was created, because the buffer was full
+    unsigned long getEventsLost() const { return eventsLost; }
+
+    /// @brief Take the oldest events (only whole ones) from the log
+    /// @param buffer where to copy the events
+    /// @param size size of the buffer. At least WIT_EVENT_HEADER_SIZE + WIT_EVENT_TEXT_SIZE to be sure of getting an event
+    /// @return Number of bytes copied
+    size_t read(uint8_t *buffer, size_t size);
+
+    /// @brief Write all the events to a stream in their binary form, and remove them from the log
+    /// @param stream stream to write to (e.g. a file, for WiThrottleLogDecode)
+    /// @return Number of bytes written
+    size_t dump(Stream *stream);
+
+    /// @brief Write all the events to a stream as text, one per line, and remove them from the log
+    /// @param stream stream to write to
+    void print(Stream *stream);
+
+    /// @brief Convert an event in its binary form to text
+    /// @param data the event
+    /// @param length number of bytes available at data
+    /// @param text where to put the text
+    /// @param size size of text
+    /// @return Length of the event in bytes, or 0 if data does not start with a whole, valid event
+    static size_t decode(const uint8_t *data, size_t length, char *text, size_t size);
+
+  private:
+    uint8_t buffer[WIT_EVENT_LOG_SIZE];
+    size_t head;    // oldest event
+    size_t count;   // bytes in use
+    unsigned long eventsLost;
+
+    void put(size_t offset, uint8_t b) { buffer[(head + offset) % WIT_EVENT_LOG_SIZE] = b; }
+    uint8_t get(size_t offset) const { return buffer[(head + offset) % WIT_EVENT_LOG_SIZE]; }
+    size_t firstEventLength() const { return WIT_EVENT_HEADER_SIZE + get(1); }
+};
+
+#endif // WITHROTTLE_EVENT_LOG_H
@@ -0,0 +1,298 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocol
+ *
+ * This package implements a WiThrottle protocol connection,
+ * allow a device to communicate with a JMRI server or other
+ * WiThrottleProtocol device (like the Digitrax LNWI).
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "WiThrottleLayoutStore.h"
+
+// FNV-1a hash of a system name
+static uint32_t nameHash(const char *c, int len) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (uint8_t) c[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// roster entries are hashed by address only, so that they can be found without knowing the length
+static uint32_t addressHash(int address) {
+    return (uint32_t) address * 2654435761u;
+}
+
+static bool nameEquals(const char *name, const char *c, int len) {
+    return (strncmp(name, c, len) == 0) && (name[len] == 0);
+}
+
+WiThrottleLayoutStore::WiThrottleLayoutStore(void *arena, size_t arenaSize) {
+    this->arena = (uint8_t *) arena;
+    this->arenaSize = arena ? arenaSize : 0;
+    clear();
+}
+
+void WiThrottleLayoutStore::clear() {
+    arenaUsed = 0;
+    full = false;
+    resetTable(turnouts);
+    resetTable(routes);
+    resetTable(roster);
+}
+
+// the arena can start at any address, so it is the address that is aligned, not the offset
+void *WiThrottleLayoutStore::allocate(size_t size, size_t align) {
+    uintptr_t base = (uintptr_t) arena;
+    size_t start = ((base + arenaUsed + align - 1) & ~(uintptr_t) (align - 1)) - base;
+    if (start + size > arenaSize) return NULL;
+    arenaUsed = start + size;
+    return arena + start;
+}
+
+// names are kept terminated, so that they can be used directly by the sketch
+const char *WiThrottleLayoutStore::copyString(const char *c, int len) {
+    char *s = (char *) allocate(len + 1, 1);
+    if (!s) return NULL;
+    memcpy(s, c, len);
+    s[len] = 0;
+    return s;
+}
+
+template <typename Entry> void WiThrottleLayoutStore::resetTable(Table<Entry> &table) {
+    table.first = NULL;
+    table.last = NULL;
+    table.buckets = NULL;
+    table.bucketCount = 0;
+    table.count = 0;
+    table.generation = 0;
+}
+
+template <typename Entry> void WiThrottleLayoutStore::beginList(Table<Entry> &table) {
+    table.generation++;
+}
+
+// drop the entries that were not in the list just received, and rebuild the hash chains without them
+template <typename Entry> void WiThrottleLayoutStore::endList(Table<Entry> &table) {
+    Entry *entry = table.first;
+    table.first = NULL;
+    table.last = NULL;
+    table.count = 0;
+    for (uint32_t i = 0; i < table.bucketCount; i++) table.buckets[i] = NULL;
+
+    while (entry) {
+        Entry *next = entry->next;
+        if (entry->generation == table.generation) insertEntry(table, entry);
+        entry = next;
+    }
+}
+
+// keep the entries that were not in a list that was cut short, as if they had been
+template <typename Entry> void WiThrottleLayoutStore::abortList(Table<Entry> &table) {
+    for (Entry *entry = table.first; entry; entry = entry->next) entry->generation = table.generation;
+}
+
+// add an entry at the end of the list, growing the buckets when the chains get long
+template <typename Entry> void WiThrottleLayoutStore::insertEntry(Table<Entry> &table, Entry *entry) {
+    entry->next = NULL;
+    if (table.last) table.last->next = entry;
+    else table.first = entry;
+    table.last = entry;
+    table.count++;
+
+    if (table.count > (int) table.bucketCount * 2) {
+        uint32_t bucketCount = table.bucketCount ? table.bucketCount * 2 : WIT_STORE_INITIAL_BUCKETS;
+        Entry **buckets = (Entry **) allocate(bucketCount * sizeof(Entry *), sizeof(Entry *));
+        if (buckets) {
+            // the old buckets are left in the arena until clear()
+            for (uint32_t i = 0; i < bucketCount; i++) buckets[i] = NULL;
+            table.buckets = buckets;
+            table.bucketCount = bucketCount;
+            for (Entry *e = table.first; e; e = e->next) hashEntry(table, e);
+            return;
+        }
+    }
+    hashEntry(table, entry);
+}
+
+template <typename Entry> void WiThrottleLayoutStore::hashEntry(Table<Entry> &table, Entry *entry) {
+    if (!table.buckets) {
+        // no room for any buckets, so lookups fall back to walking the list
+        entry->hashNext = NULL;
+        return;
+    }
+    Entry **bucket = &table.buckets[entry->hash & (table.bucketCount - 1)];
+    entry->hashNext = *bucket;
+    *bucket = entry;
+}
+
+void WiThrottleLayoutStore::beginTurnoutList() {
+    beginList(turnouts);
+}
+
+void WiThrottleLayoutStore::endTurnoutList() {
+    endList(turnouts);
+}
+
+void WiThrottleLayoutStore::abortTurnoutList() {
+    abortList(turnouts);
+}
+
+void WiThrottleLayoutStore::beginRouteList() {
+    beginList(routes);
+}
+
+void WiThrottleLayoutStore::endRouteList() {
+    endList(routes);
+}
+
+void WiThrottleLayoutStore::abortRouteList() {
+    abortList(routes);
+}
+
+void WiThrottleLayoutStore::beginRosterList() {
+    beginList(roster);
+}
+
+void WiThrottleLayoutStore::endRosterList() {
+    endList(roster);
+}
+
+void WiThrottleLayoutStore::abortRosterList() {
+    abortList(roster);
+}
+
+WiThrottleStoreAccessory *WiThrottleLayoutStore::lookupAccessory(const Table<WiThrottleStoreAccessory> &table, const char *systemName, int len) const {
+    uint32_t hash = nameHash(systemName, len);
+    if (!table.buckets) {
+        for (WiThrottleStoreAccessory *entry = table.first; entry; entry = entry->next) {
+            if (entry->hash == hash && nameEquals(entry->systemName, systemName, len)) return entry;
+        }
+        return NULL;
+    }
+    for (WiThrottleStoreAccessory *entry = table.buckets[hash & (table.bucketCount - 1)]; entry; entry = entry->hashNext) {
+        if (entry->hash == hash && nameEquals(entry->systemName, systemName, len)) return entry;
+    }
+    return NULL;
+}
+
+bool WiThrottleLayoutStore::storeAccessory(Table<WiThrottleStoreAccessory> &table, const char *systemName, int systemNameLen, const char *userName, int userNameLen, int state) {
+    WiThrottleStoreAccessory *entry = lookupAccessory(table, systemName, systemNameLen);
+    if (entry) {
+        // already known from an earlier list
+        if (!nameEquals(entry->userName, userName, userNameLen)) {
+            const char *name = copyString(userName, userNameLen);
+            if (name) entry->userName = name;
+            else full = true;
+        }
+        entry->state = state;
+        entry->generation = table.generation;
+        return !full;
+    }
+
+    entry = (WiThrottleStoreAccessory *) allocate(sizeof(WiThrottleStoreAccessory), sizeof(void *));
+    const char *sysName = entry ? copyString(systemName, systemNameLen) : NULL;
+    const char *name = sysName ? copyString(userName, userNameLen) : NULL;
+    if (!name) {
+        full = true;
+        return false;
+    }
+    entry->systemName = sysName;
+    entry->userName = name;
+    entry->state = state;
+    entry->hash = nameHash(systemName, systemNameLen);
+    entry->generation = table.generation;
+    insertEntry(table, entry);
+    return true;
+}
+
+void WiThrottleLayoutStore::setAccessoryState(Table<WiThrottleStoreAccessory> &table, const char *systemName, int len, int state) {
+    WiThrottleStoreAccessory *entry = lookupAccessory(table, systemName, len);
+    if (entry) entry->state = state;
+}
+
+const WiThrottleStoreAccessory *WiThrottleLayoutStore::findTurnout(const char *systemName) const {
+    return lookupAccessory(turnouts, systemName, strlen(systemName));
+}
+
+TurnoutState WiThrottleLayoutStore::getTurnoutState(const char *systemName) const {
+    const WiThrottleStoreAccessory *entry = findTurnout(systemName);
+    return entry ? (TurnoutState) entry->state : TurnoutUnknown;
+}
+
+const WiThrottleStoreAccessory *WiThrottleLayoutStore::findRoute(const char *systemName) const {
+    return lookupAccessory(routes, systemName, strlen(systemName));
+}
+
+RouteState WiThrottleLayoutStore::getRouteState(const char *systemName) const {
+    const WiThrottleStoreAccessory *entry = findRoute(systemName);
+    return entry ? (RouteState) entry->state : RouteInconsistent;
+}
+
+const WiThrottleStoreRosterEntry *WiThrottleLayoutStore::findRosterEntry(int address, char length) const {
+    uint32_t hash = addressHash(address);
+    WiThrottleStoreRosterEntry *entry = roster.buckets ? roster.buckets[hash & (roster.bucketCount - 1)] : roster.first;
+    for (; entry; entry = roster.buckets ? entry->hashNext : entry->next) {
+        if (entry->address == address && (length == 0 || entry->length == length)) return entry;
+    }
+    return NULL;
+}
+
+bool WiThrottleLayoutStore::storeRosterEntry(const char *name, int nameLen, int address, char length) {
+    // an entry from an earlier list not yet seen in this one: the one with the same name, as the
+    // roster can hold more than one entry for an address, otherwise one whose name has changed
+    uint32_t hash = addressHash(address);
+    WiThrottleStoreRosterEntry *entry = NULL;
+    WiThrottleStoreRosterEntry *e = roster.buckets ? roster.buckets[hash & (roster.bucketCount - 1)] : roster.first;
+    for (; e; e = roster.buckets ? e->hashNext : e->next) {
+        if (e->address != address || e->length != length || e->generation == roster.generation) continue;
+        if (nameEquals(e->name, name, nameLen)) {
+            entry = e;
+            break;
+        }
+        if (!entry) entry = e;
+    }
+    if (entry) {
+        if (!nameEquals(entry->name, name, nameLen)) {
+            const char *s = copyString(name, nameLen);
+            if (s) entry->name = s;
+            else full = true;
+        }
+        entry->generation = roster.generation;
+        return !full;
+    }
+
+    entry = (WiThrottleStoreRosterEntry *) allocate(sizeof(WiThrottleStoreRosterEntry), sizeof(void *));
+    const char *s = entry ? copyString(name, nameLen) : NULL;
+    if (!s) {
+        full = true;
+        return false;
+    }
+    entry->name = s;
+    entry->address = address;
+    entry->length = length;
+    entry->hash = hash;
+    entry->generation = roster.generation;
+    insertEntry(roster, entry);
+    return true;
+}
@@ -0,0 +1,244 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocol
+ *
+ * This package implements a WiThrottle protocol connection,
+ * allow a device to communicate with a JMRI server or other
+ * WiThrottleProtocol device (like the Digitrax LNWI).
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef WITHROTTLE_LAYOUT_STORE_H
+#define WITHROTTLE_LAYOUT_STORE_H
+
+#include "WiThrottleProtocol.h"
+
+// Number of hash buckets the layout store starts with for each list. They are doubled (from the arena) as the lists grow
+#ifndef WIT_STORE_INITIAL_BUCKETS
+#define WIT_STORE_INITIAL_BUCKETS 16
+#endif
+
+/// @brief A Turnout/Point or Route held in a WiThrottleLayoutStore
+struct WiThrottleStoreAccessory {
+    const char *systemName;                 ///< system name
+    const char *userName;                   ///< user name
+    int state;                              ///< current state (TurnoutState or RouteState value)
+    WiThrottleStoreAccessory *next;         ///< next entry in list order, NULL after the last
+
+    // used by the store
+    WiThrottleStoreAccessory *hashNext;
+    uint32_t hash;
+    uint16_t generation;
+};
+
+/// @brief A Roster Entry held in a WiThrottleLayoutStore
+struct WiThrottleStoreRosterEntry {
+    const char *name;                       ///< roster entry name
+    int address;                            ///< DCC address
+    char length;                            ///< 'S'|'L' Short or Long address
+    WiThrottleStoreRosterEntry *next;       ///< next entry in list order, NULL after the last
+
+    // used by the store
+    WiThrottleStoreRosterEntry *hashNext;
+    uint32_t hash;
+    uint16_t generation;
+};
+
+/// @brief Optional local copy of the roster, turnout and route lists, kept up to date by WiThrottleProtocol
+/// from the RL, PTL and PRL lists and the PTA and PRA actions.
+/// All entries and names are allocated from an arena supplied by the sketch, so the store never uses the heap.
+/// Turnouts and routes are hashed by system name, and roster entries by DCC address.
+/// Entries that are dropped from a list the server resends are removed, but their space in the arena is only
+/// reused after clear() (which WiThrottleProtocol calls on connect).
+class WiThrottleLayoutStore {
+
+  public:
+    /// @brief Create a store
+    /// @param arena memory to hold the entries, of any alignment (the entries are aligned within it). Must remain valid for the life of the store
+    /// @param arenaSize size of the arena in bytes
+    WiThrottleLayoutStore(void *arena, size_t arenaSize);
+
+    /// @brief Remove all the entries and release all the arena
+    void clear();
+
+    /// @brief Get the number of Turnouts/Points in the store
+    int getTurnoutCount() const { return turnouts.count; }
+
+    /// @brief Get the first Turnout/Point, in the order that the server listed them. Follow ->next for the others
+    /// @return First Turnout/Point, or NULL if there are none
+    const WiThrottleStoreAccessory *firstTurnout() const { return turnouts.first; }
+
+    /// @brief Find a Turnout/Point
+    /// @param systemName system name of the Turnout/Point
+    /// @return The Turnout/Point, or NULL if it is not in the store
+    const WiThrottleStoreAccessory *findTurnout(const char *systemName) const;
+
+    /// @brief Get the state of a Turnout/Point
+    /// @param systemName system name of the Turnout/Point
+    /// @return Last known state, or TurnoutUnknown if it is not in the store
+    TurnoutState getTurnoutState(const char *systemName) const;
+
+    /// @brief Get the number of Routes in the store
+    int getRouteCount() const { return routes.count; }
+
+    /// @brief Get the first Route, in the order that the server listed them. Follow ->next for the others
+    /// @return First Route, or NULL if there are none
+    const WiThrottleStoreAccessory *firstRoute() const { return routes.first; }
+
+    /// @brief Find a Route
+    /// @param systemName system name of the Route
+    /// @return The Route, or NULL if it is not in the store
+    const WiThrottleStoreAccessory *findRoute(const char *systemName) const;
+
+    /// @brief Get the state of a Route
+    /// @param systemName system name of the Route
+    /// @return Last known state, or RouteInconsistent if it is not in the store
+    RouteState getRouteState(const char *systemName) const;
+
+    /// @brief Get the number of Roster Entries in the store
+    int getRosterCount() const { return roster.count; }
+
+    /// @brief Get the first Roster Entry, in the order that the server listed them. Follow ->next for the others
+    /// @return First Roster Entry, or NULL if there are none
+    const WiThrottleStoreRosterEntry *firstRosterEntry() const { return roster.first; }
+
+    /// @brief Find a Roster Entry by DCC address
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address, or 0 to match either
+    /// @return The Roster Entry, or NULL if it is not in the store
+    const WiThrottleStoreRosterEntry *findRosterEntry(int address, char length = 0) const;
+
+    /// @brief Get the number of bytes of the arena in use
+    size_t getArenaUsed() const { return arenaUsed; }
+
+    /// @brief Get the size of the arena
+    size_t getArenaSize() const { return arenaSize; }
+
+    /// @brief Check if any entry could not be stored because the arena was full
+    /// @return True if an entry has been lost since the last clear()
+    bool isFull() const { return full; }
+
+    // The methods below are used by WiThrottleProtocol to keep the store up to date
+
+    /// @brief Start receiving a new Turnout/Point list
+    void beginTurnoutList();
+
+    /// @brief Add or update a Turnout/Point from the list
+    /// @param systemName system name (not terminated)
+    /// @param systemNameLen length of the system name
+    /// @param userName user name (not terminated)
+    /// @param userNameLen length of the user name
+    /// @param state state from the list
+    /// @return False if the arena is full
+    bool storeTurnout(const char *systemName, int systemNameLen, const char *userName, int userNameLen, int state) {
+        return storeAccessory(turnouts, systemName, systemNameLen, userName, userNameLen, state);
+    }
+
+    /// @brief Finish receiving a Turnout/Point list, removing any that were not in it
+    void endTurnoutList();
+
+    /// @brief Give up receiving a Turnout/Point list that was cut short, keeping the entries that were not in it
+    void abortTurnoutList();
+
+    /// @brief Record the new state of a Turnout/Point
+    /// @param systemName system name (not terminated)
+    /// @param len length of the system name
+    /// @param state new state
+    void setTurnoutState(const char *systemName, int len, int state) { setAccessoryState(turnouts, systemName, len, state); }
+
+    /// @brief Start receiving a new Route list
+    void beginRouteList();
+
+    /// @brief Add or update a Route from the list
+    /// @param systemName system name (not terminated)
+    /// @param systemNameLen length of the system name
+    /// @param userName user name (not terminated)
+    /// @param userNameLen length of the user name
+    /// @param state state from the list
+    /// @return False if the arena is full
+    bool storeRoute(const char *systemName, int systemNameLen, const char *userName, int userNameLen, int state) {
+        return storeAccessory(routes, systemName, systemNameLen, userName, userNameLen, state);
+    }
+
+    /// @brief Finish receiving a Route list, removing any that were not in it
+    void endRouteList();
+
+    /// @brief Give up receiving a Route list that was cut short, keeping the entries that were not in it
+    void abortRouteList();
+
+    /// @brief Record the new state of a Route
+    /// @param systemName system name (not terminated)
+    /// @param len length of the system name
+    /// @param state new state
+    void setRouteState(const char *systemName, int len, int state) { setAccessoryState(routes, systemName, len, state); }
+
+    /// @brief Start receiving a new Roster list
+    void beginRosterList();
+
+    /// @brief Add or update a Roster Entry from the list
+    /// @param name roster entry name (not terminated)
+    /// @param nameLen length of the name
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    /// @return False if the arena is full
+    bool storeRosterEntry(const char *name, int nameLen, int address, char length);
+
+    /// @brief Finish receiving a Roster list, removing any entries that were not in it
+    void endRosterList();
+
+    /// @brief Give up receiving a Roster list that was cut short, keeping the entries that were not in it
+    void abortRosterList();
+
+  private:
+    // a list in arrival order, hashed into buckets allocated from the arena
+    template <typename Entry> struct Table {
+        Entry *first;
+        Entry *last;
+        Entry **buckets;
+        uint32_t bucketCount;  // always a power of two
+        int count;
+        uint16_t generation;   // entries not seen since beginList() have an older generation
+    };
+
+    uint8_t *arena;
+    size_t arenaSize;
+    size_t arenaUsed;
+    bool full;
+    Table<WiThrottleStoreAccessory> turnouts;
+    Table<WiThrottleStoreAccessory> routes;
+    Table<WiThrottleStoreRosterEntry> roster;
+
+    void *allocate(size_t size, size_t align);
+    const char *copyString(const char *c, int len);
+
+    template <typename Entry> void resetTable(Table<Entry> &table);
+    template <typename Entry> void beginList(Table<Entry> &table);
+    template <typename Entry> void endList(Table<Entry> &table);
+    template <typename Entry> void abortList(Table<Entry> &table);
+    template <typename Entry> void insertEntry(Table<Entry> &table, Entry *entry);
+    template <typename Entry> void hashEntry(Table<Entry> &table, Entry *entry);
+
+    WiThrottleStoreAccessory *lookupAccessory(const Table<WiThrottleStoreAccessory> &table, const char *systemName, int len) const;
+    bool storeAccessory(Table<WiThrottleStoreAccessory> &table, const char *systemName, int systemNameLen, const char *userName, int userNameLen, int state);
+    void setAccessoryState(Table<WiThrottleStoreAccessory> &table, const char *systemName, int len, int state);
+};
+
+#endif // WITHROTTLE_LAYOUT_STORE_H
@@ -28,14 +28,132 @@
 
 //#include <ArduinoTime.h>
 //#include <TimeLib.h>
-#include <vector>  //https://github.com/arduino-libraries/Arduino_AVRSTL
 
 #include "WiThrottleProtocol.h"
+#include "WiThrottleEventLog.h"
+#include "WiThrottleLayoutStore.h"
 
 static const int MIN_SPEED = 0;
 static const int MAX_SPEED = 126;
 static const char *rosterSegmentDesc[] = {"Name", "Address", "Length"};
 
+// The inbound parsers work on (pointer, length) views into the input buffer
+// so that the frequent loco action messages don't need any heap allocation.
+
+// position of the first occurrence of sep within the first len chars of c, or -1
+static int viewIndexOf(const char *c, int len, const char *sep, int from = 0) {
+    int sepLen = strlen(sep);
+    for (int i = from; i <= len - sepLen; i++) {
+        if (c[i] == sep[0] && strncmp(c + i, sep, sepLen) == 0) return i;
+    }
+    return -1;
+}
+
+// same as String::toInt(), but only looks at the first len chars
+static long viewToInt(const char *c, int len) {
+    int i = 0;
+    while (i < len && (c[i] == ' ' || c[i] == '\t')) i++;
+    bool negative = false;
+    if (i < len && (c[i] == '-' || c[i] == '+')) {
+        negative = (c[i] == '-');
+        i++;
+    }
+    long value = 0;
+    while (i < len && c[i] >= '0' && c[i] <= '9') {
+        value = value * 10 + (c[i] - '0');
+        i++;
+    }
+    return negative ? -value : value;
+}
+
+// copy a view into a String, for the delegate methods that need one
+static String viewToString(const char *c, int len) {
+    String s;
+    s.reserve(len);
+    for (int i = 0; i < len; i++) s += c[i];
+    return s;
+}
+
+#if WIT_PARSE_LOCOS
+// the view without leading and trailing white space (as String::trim())
+static bool viewIsSpace(char c) {
+    return (c == ' ') || (c >= '\t' && c <= '\r');
+}
+
+static WiThrottleStringView viewTrim(const char *c, int len) {
+    while (len > 0 && viewIsSpace(c[0])) { c++; len--; }
+    while (len > 0 && viewIsSpace(c[len-1])) len--;
+    return {c, len};
+}
+#endif
+
+#if WIT_PARSE_ROSTER || WIT_PARSE_TURNOUTS || WIT_PARSE_ROUTES
+// split a list entry into its SEGMENT_SEPARATOR delimited segments in a single
+// pass. Segments missing from the end of the entry are returned empty
+static void viewSplitSegments(const char *c, int len, const char *segments[], int lengths[], int count) {
+    int start = 0;
+    for (int j = 0; j < count; j++) {
+        int p = viewIndexOf(c, len, SEGMENT_SEPARATOR, start);
+        int end = (p >= 0) ? p : len;
+        segments[j] = c + start;
+        lengths[j] = end - start;
+        start = (p >= 0) ? p + 3 : len;
+    }
+}
+#endif
+
+// the MessageFamily of a command from the server, or 0 for one that is always processed
+static int messageFamily(const char *c, int len) {
+    if (len < 2) return 0;
+    switch (c[0]) {
+        case 'M': return MessageFamilyLocos;
+        case 'R': return (c[1]=='L') ? MessageFamilyRoster : 0;
+        case 'V': return MessageFamilyServerInfo;
+        case 'P':
+            switch (c[1]) {
+                case 'T': return MessageFamilyTurnouts;
+                case 'R': return MessageFamilyRoutes;
+                case 'F': return MessageFamilyFastTime;
+                case 'P': return MessageFamilyTrackPower;
+                case 'W': return MessageFamilyServerInfo;
+            }
+            return 0;
+        case 'H':
+            switch (c[1]) {
+                case 'T': case 't': return MessageFamilyServerInfo;
+                case 'M': case 'm': return MessageFamilyMessages;
+            }
+            return 0;
+    }
+    return 0;
+}
+
+// the families whose parsers are compiled in
+static const int parsedMessageFamilies = MessageFamilyAll
+    & ~(WIT_PARSE_ROSTER ? 0 : MessageFamilyRoster) & ~(WIT_PARSE_TURNOUTS ? 0 : MessageFamilyTurnouts)
+    & ~(WIT_PARSE_ROUTES ? 0 : MessageFamilyRoutes) & ~(WIT_PARSE_LOCOS ? 0 : MessageFamilyLocos);
+
+// true if the view is made up of only (at least one) digits
+static bool viewIsNumber(const char *c, int len) {
+    if (len <= 0) return false;
+    for (int i = 0; i < len; i++) {
+        if (c[i] < '0' || c[i] > '9') return false;
+    }
+    return true;
+}
+
+
+int WiThrottleProtocol::packAddress(const char *address, int len) {
+    if (len < 2 || len > 6 || (address[0] != 'S' && address[0] != 'L')) return -1;
+    if (!viewIsNumber(address+1, len-1)) return -1;
+    long number = viewToInt(address+1, len-1);
+    if (number > WIT_ADDRESS_MASK) return -1;
+    return (address[0] == 'L' ? WIT_LONG_ADDRESS : 0) | number;
+}
+
+int WiThrottleProtocol::formatAddress(uint16_t packed, char *buffer) {
+    return sprintf(buffer, "%c%d", (packed & WIT_LONG_ADDRESS) ? 'L' : 'S', packed & WIT_ADDRESS_MASK);
+}
 
 WiThrottleProtocol::WiThrottleProtocol(bool server) {
 
@@ -49,15 +167,34 @@ WiThrottleProtocol::WiThrottleProtocol(bool server) {
 
 // init the WiThrottleProtocol instance after connection to the server
 void WiThrottleProtocol::init() {
-    if (logLevel>0) console->println("init()");
+    if (WIT_LOG_AT(1)) console->println("init()");
     
 	// allocate input buffer and init position variable
 	memset(inputbuffer, 0, sizeof(inputbuffer));
 	nextChar = 0;
-
-    // output buffer
-    outboundBuffer = "";
+    inputDiscarding = false;
+    inputLineType = InputLineUnknown;
+
+    // outbound command queue
+    for (int slot = 0; slot < WIT_OUTBOUND_QUEUE_SIZE; slot++) {
+        outboundFreeSlots[slot] = WIT_OUTBOUND_QUEUE_SIZE - 1 - slot;
+    }
+    outboundFreeCount = WIT_OUTBOUND_QUEUE_SIZE;
+    for (int lane = 0; lane < WIT_OUTBOUND_LANES; lane++) {
+        outboundLaneHead[lane] = 0;
+        outboundLaneCount[lane] = 0;
+        outboundLaneStats[lane] = OutboundLaneStats();
+    }
+    outboundQueueCount = 0;
+    outboundSequence = 0;
+    outboundQueueHighWaterMark = 0;
+    outboundCmdsCoalesced = 0;
+    bytesReceived = 0;
+    commandsReceived = 0;
     outboundCmdsTimeLastSent = millis();
+
+    // the store holds the lists from this connection only
+    if (layoutStore) layoutStore->clear();
 	
 	// init heartbeat
 	heartbeatTimer = millis();
@@ -66,19 +203,22 @@ void WiThrottleProtocol::init() {
                            
 	
 	// init fasttime
-	fastTimeTimer = millis();
-    currentFastTime = 0.0;
-    currentFastTimeRate = 0.0;
+	fastTimeSyncMillis = millis();
+    fastTimeTickMillis = fastTimeSyncMillis;
+    fastTimeSeconds = 0;
+    fastTimeMillis = 0;
+    fastTimeRate = 0;
+    fastTimeNotified = 0;
 
 
 	// init global variables
-    for (int multiThrottleIndex=0; multiThrottleIndex<6; multiThrottleIndex++) {
-        locomotiveSelected[multiThrottleIndex] = false;
-        currentSpeed[multiThrottleIndex] = 0;
-        speedSteps[multiThrottleIndex] = 1;  //1=128 steps
-        currentDirection[multiThrottleIndex] = Forward;
-        locomotives[multiThrottleIndex].resize(0);
-        locomotivesFacing[multiThrottleIndex].resize(0);
+    for (int multiThrottleIndex=0; multiThrottleIndex<MAX_WIT_THROTTLES; multiThrottleIndex++) {
+        ThrottleState &throttle = throttles[multiThrottleIndex];
+        throttle.consistSize = 0;
+        throttle.reversed = 0;
+        throttle.speed = 0;
+        throttle.speedSteps = 1;  //1=128 steps
+        throttle.direction = Forward;
     }
 
     //last Response time
@@ -87,16 +227,20 @@ void WiThrottleProtocol::init() {
 	// init change flags
     resetChangeFlags();
 
-    if (logLevel>0) console->println("init(): end");
+    if (WIT_LOG_AT(1)) console->println("init(): end");
 }
 
 
 // Set the delegate instance for callbasks
-void WiThrottleProtocol::setDelegate(WiThrottleProtocolDelegate *delegate) {
+void WiThrottleProtocol::setDelegate(WiThrottleProtocolDelegateV2 *delegate) {
 	
     this->delegate = delegate;
 }
 
+void WiThrottleProtocol::setLayoutStore(WiThrottleLayoutStore *store) {
+    layoutStore = store;
+}
+
 
 // Set the Stream used for logging
 void WiThrottleProtocol::setLogStream(Stream *console) {
@@ -109,6 +253,10 @@ void WiThrottleProtocol::setLogLevel(int level) {
     logLevel = level;
 }
 
+void WiThrottleProtocol::setEventLog(WiThrottleEventLog *eventLog) {
+    this->eventLog = eventLog;
+}
+
 void WiThrottleProtocol::resetChangeFlags() {
     clockChanged = false;
     heartbeatChanged = false;
@@ -125,9 +273,10 @@ void WiThrottleProtocol::connect(Stream *stream, int delayBetweenCommandsSent) {
     this->stream = stream;
 
     outboundCmdsMininumDelay = delayBetweenCommandsSent;
-    if (logLevel>0) {
+    if (WIT_LOG_AT(1)) {
         console->print("WiT:: connect(): Outbound commands minimum delay: "); console->println(outboundCmdsMininumDelay);
     }
+    if (eventLog) eventLog->record(EventConnected, outboundCmdsMininumDelay);
 }
 
 void WiThrottleProtocol::disconnect() {
@@ -160,39 +309,229 @@ bool WiThrottleProtocol::check() {
         changed |= checkFastTime();
         changed |= checkHeartbeat();
 
-        while(stream->available()) {
-            char b = stream->read();
-            if (logLevel>3) { console->print("WiT:: check() : "); console->println(b); }
-            if (b == NEWLINE || b==CR) {
-                // server sends TWO newlines after each command, we trigger on the
-                // first, and this skips the second one
-                if (nextChar != 0) {
-                    inputbuffer[nextChar] = 0;
-                    changed |= processCommand(inputbuffer, nextChar);
-                }
+        // read in chunks rather than a byte at a time. Never ask for more than is
+        // available, so that readBytes() doesn't wait for its timeout
+        int available;
+        while ((available = stream->available()) > 0) {
+            char chunk[WIT_READ_CHUNK_SIZE];
+            size_t n = stream->readBytes(chunk, ((size_t) available < sizeof(chunk)) ? available : sizeof(chunk));
+            if (n == 0) break;
+            changed |= processInput(chunk, n);
+        }
+        sendQueuedCommand();  // force the outbound queue to be flushed if needed.
+
+        return changed;
+
+    }
+    else {
+        return false;
+    }
+}
+
+bool WiThrottleProtocol::processInput(const char *data, size_t length) {
+    bool changed = false;
+    const char *end = data + length;
+    bytesReceived += length;
+
+    if (WIT_LOG_AT(4)) { console->print("WiT:: processInput() : "); console->write(data, length); console->println(); }
+
+    while (data < end) {
+        // find the end of the current line, if it is in this chunk
+        const char *eol = data;
+        while (eol < end && *eol != NEWLINE && *eol != CR) eol++;
+
+        // append whatever we have of the line to the input buffer
+        if (inputDiscarding) data = eol;
+        while (data < eol) {
+            size_t space = sizeof(inputbuffer) - 1 - nextChar;
+            size_t n = eol - data;
+            if (n > space) n = space;
+            memcpy(inputbuffer + nextChar, data, n);
+            nextChar += n;
+            data += n;
+
+            // the long lists are processed as each entry arrives, which makes room in the buffer
+            changed |= processListEntries();
+            if (inputLineType == InputLineDiscard) {
                 nextChar = 0;
+                inputDiscarding = true;  // skip the rest of the line
+                data = eol;
             }
-            else {
-                inputbuffer[nextChar] = b;
-                nextChar += 1;
-                if (nextChar == (sizeof(inputbuffer)-1) ) {
-                    inputbuffer[sizeof(inputbuffer)-1] = 0;
-                    console->print("WiT:: ERROR LINE TOO LONG: >");
-                    console->print(sizeof(inputbuffer));
-                    console->print(": ");
-                    console->println(inputbuffer);
-                    nextChar = 0;
+
+            if (nextChar == (sizeof(inputbuffer)-1)) {
+                inputbuffer[sizeof(inputbuffer)-1] = 0;
+                console->print("WiT:: ERROR LINE TOO LONG: >");
+                console->print(sizeof(inputbuffer));
+                console->print(": ");
+                console->println(inputbuffer);
+                if (inputLineType == InputLineRosterList || inputLineType == InputLineTurnoutList || inputLineType == InputLineRouteList) {
+                    changed |= finishList(false);  // an entry too long for the buffer ends the list
+                    inputLineType = InputLineDiscard;
                 }
+                nextChar = 0;
+                inputDiscarding = true;  // skip the rest of the line
+                data = eol;
             }
         }
-        sendDelayedCommand("");  // force the outbound buffer to be flushed if needed.
 
-        return changed;
+        if (eol == end) break;  // the rest of the line is in a later chunk
 
+        // server sends TWO newlines after each command, we trigger on the
+        // first, and this skips the second one
+        if (nextChar != 0) {
+            inputbuffer[nextChar] = 0;
+            commandsReceived++;
+            if (inputLineType == InputLineRosterList || inputLineType == InputLineTurnoutList || inputLineType == InputLineRouteList) {
+                changed |= finishList(true);
+            } else {
+                changed |= processCommand(inputbuffer, nextChar);
+            }
+        }
+        nextChar = 0;
+        inputDiscarding = false;
+        inputLineType = InputLineUnknown;
+        data = eol + 1;
     }
-    else {
+
+    return changed;
+}
+
+// Work out if the line being received is one of the (potentially very long)
+// roster, turnout or route lists, and if so process and discard each entry as
+// soon as it is complete, so that the whole list never needs to be in the buffer
+bool WiThrottleProtocol::processListEntries() {
+    if (inputLineType == InputLineUnknown) {
+        // look past any LnWi garbage
+        const char *garbage = "AT+CIPSENDBUF=";
+        int garbageLen = strlen(garbage);
+        int offset = 0;
+        while ((nextChar - offset >= garbageLen) && (strncmp(inputbuffer + offset, garbage, garbageLen) == 0)) offset += garbageLen;
+        int remaining = nextChar - offset;
+        if ((remaining < garbageLen) && (strncmp(inputbuffer + offset, garbage, remaining) == 0)) return false;  // can't tell yet
+        if (remaining < 3) return false;
+
+        const char *c = inputbuffer + offset;
+        int family = messageFamily(c, remaining);
+        if (family & ~(messageFamilies & parsedMessageFamilies)) {
+            // not wanted, so don't copy any more of it
+            if (WIT_LOG_AT(2)) { console->print("WiT:: ignoring "); console->write(c, 3); console->println("..."); }
+            inputLineType = InputLineDiscard;
+            lastServerResponseTime = millis()/1000;
+            return false;
+        }
+
+        if (c[0]=='R' && c[1]=='L') {
+            inputLineType = InputLineRosterList;
+            listStart = offset + 2;
+        } else if (c[0]=='P' && c[1]=='T' && c[2]=='L') {
+            inputLineType = InputLineTurnoutList;
+            listStart = offset + 3;
+        } else if (c[0]=='P' && c[1]=='R' && c[2]=='L') {
+            inputLineType = InputLineRouteList;
+            listStart = offset + 3;
+        } else {
+            inputLineType = InputLineCommand;
+            return false;
+        }
+
+        if (WIT_LOG_AT(1)) { console->print("WiT:: <== "); console->write(c, listStart - offset); console->println(" (list)"); }
+        if (eventLog) eventLog->record(EventReceived, 0, 0, c, listStart - offset);
+        lastServerResponseTime = millis()/1000;
+        listSegment = 0;
+        listScanFrom = listStart;
+
+        if (layoutStore) {
+            if (inputLineType == InputLineRosterList) layoutStore->beginRosterList();
+            else if (inputLineType == InputLineTurnoutList) layoutStore->beginTurnoutList();
+            else layoutStore->beginRouteList();
+        }
+    }
+    else if (inputLineType == InputLineCommand) {
         return false;
     }
+
+    // process every complete entry in place, then drop them all with one move
+    bool changed = false;
+    int entryStart = listStart;
+    int p;
+    while ((p = viewIndexOf(inputbuffer, nextChar, ENTRY_SEPARATOR, listScanFrom)) >= 0) {
+        processListSegment(inputbuffer + entryStart, p - entryStart);
+        entryStart = p + 3;
+        listScanFrom = entryStart;
+        changed = true;
+    }
+    if (entryStart > listStart) {
+        memmove(inputbuffer + listStart, inputbuffer + entryStart, nextChar - entryStart);
+        nextChar -= entryStart - listStart;
+    }
+    // a separator may be split over the next chunk
+    listScanFrom = (nextChar - 2 > listStart) ? nextChar - 2 : listStart;
+    return changed;
+}
+
+// the first segment of a list is its header (the number of entries for the
+// roster, empty for turnouts and routes), the others are the entries
+void WiThrottleProtocol::processListSegment(const char *c, int len) {
+    int index = listSegment++;
+
+    if (index == 0) {
+        if (inputLineType == InputLineRosterList) {
+            int entries = viewToInt(c, len);
+            if (WIT_LOG_AT(1)) { console->print("WiT:: Entries in roster: "); console->println(entries);}
+            if (delegate) delegate->onRosterEntries(entries);
+        }
+        return;
+    }
+
+    switch (inputLineType) {
+#if WIT_PARSE_ROSTER
+        case InputLineRosterList:
+            processRosterEntry(index-1, c, len);
+            break;
+#endif
+#if WIT_PARSE_TURNOUTS
+        case InputLineTurnoutList:
+            processTurnoutEntry(index-1, c, len);
+            break;
+#endif
+#if WIT_PARSE_ROUTES
+        case InputLineRouteList:
+            processRouteEntry(index-1, c, len);
+            break;
+#endif
+        default:
+            break;
+    }
+}
+
+// the last entry of a list ends at the end of the line. A list cut short still
+// ends, so that the store and the delegate are not left part way through it
+bool WiThrottleProtocol::finishList(bool complete) {
+    if (complete) processListSegment(inputbuffer + listStart, nextChar - listStart);
+    int entries = (listSegment > 0) ? listSegment - 1 : 0;
+
+    if (layoutStore) {
+        if (complete) {
+            if (inputLineType == InputLineRosterList) layoutStore->endRosterList();
+            else if (inputLineType == InputLineTurnoutList) layoutStore->endTurnoutList();
+            else layoutStore->endRouteList();
+        } else {
+            if (inputLineType == InputLineRosterList) layoutStore->abortRosterList();
+            else if (inputLineType == InputLineTurnoutList) layoutStore->abortTurnoutList();
+            else layoutStore->abortRouteList();
+        }
+    }
+
+    if (inputLineType == InputLineTurnoutList) {
+        if (WIT_LOG_AT(1)) { console->print("WiT:: Entries in Turnouts List: "); console->println(entries); }
+        if (delegate) delegate->onTurnoutEntries(entries);
+    }
+    else if (inputLineType == InputLineRouteList) {
+        if (WIT_LOG_AT(1)) { console->print("WiT:: Entries in Routes List: "); console->println(entries); }
+        if (delegate) delegate->onRouteEntries(entries);
+    }
+    if (WIT_LOG_AT(2)) console->println("WiT:: finishList(): end");
+    return true;
 }
 
 void WiThrottleProtocol::sendCommand(String cmd) {
@@ -207,77 +546,417 @@ void WiThrottleProtocol::sendCommand(String cmd) {
 }
 
 void WiThrottleProtocol::sendDelayedCommand(String cmd) {
-    if (stream) {
-        // TODO: what happens when the write fails?
+    sendDelayedCommand(cmd, outboundLaneFor(cmd.c_str(), cmd.length()));
+}
 
+void WiThrottleProtocol::sendDelayedCommand(String cmd, OutboundLane lane) {
+    if (stream) {
         if (cmd.length()>0) {
-            outboundBuffer = outboundBuffer + cmd + '\n';
+            queueOutboundCommand(cmd.c_str(), cmd.length(), lane);
+        }
+        sendQueuedCommand();
+    }
+}
+
+// length of the part of a loco action ("MxA<addr><;>V..") that says what it
+// acts on, up to and including the action letter. Only for the actions where
+// a later command replaces an earlier one (speed, direction and speed steps),
+// otherwise -1
+static int outboundCommandKeyLength(const char *cmd, int len) {
+    if (len < 4 || cmd[0] != 'M' || cmd[2] != 'A') return -1;
+    int p = viewIndexOf(cmd, len, PROPERTY_SEPARATOR, 3);
+    if (p < 0 || p+3 >= len) return -1;
+    char action = cmd[p+3];
+    if (action != 'V' && action != 'R' && action != 's') return -1;
+    return p+4;
+}
+
+// the action letter of a loco action ("MxA<addr><;>F.."), otherwise 0
+static char outboundLocoAction(const char *cmd, int len) {
+    if (len < 4 || cmd[0] != 'M' || cmd[2] != 'A') return 0;
+    int p = viewIndexOf(cmd, len, PROPERTY_SEPARATOR, 3);
+    return ((p > 0) && (p+3 < len)) ? cmd[p+3] : 0;
+}
+
+OutboundLane WiThrottleProtocol::outboundLaneFor(const char *cmd, int len) {
+    if (len == 0) return OutboundLaneHousekeeping;
+    switch (cmd[0]) {
+        case 'M': {
+            char action = outboundLocoAction(cmd, len);
+            if (action == 'X') return OutboundLaneSafety;
+            if (action == 'F' || action == 'f') return OutboundLaneFunction;
+            return OutboundLaneMotion;  // speed, direction, acquire, release, steal
         }
+        case 'P':
+            if (len > 2 && cmd[1] == 'P' && cmd[2] == 'A') return OutboundLaneSafety;  // track power
+            return OutboundLaneAccessory;
+        case 'N':
+        case 'Q':
+            return OutboundLaneSession;
+        case 'H':
+            return (len > 1 && cmd[1] == 'U') ? OutboundLaneSession : OutboundLaneAccessory;
+        case '*':
+            return (len > 1) ? OutboundLaneSession : OutboundLaneHousekeeping;  // *+ / *- vs the heartbeat itself
+        default:
+            return OutboundLaneAccessory;
+    }
+}
+
+int WiThrottleProtocol::outboundLaneSlot(int lane, int i) {
+    return outboundLaneSlots[lane][(outboundLaneHead[lane] + i) % WIT_OUTBOUND_QUEUE_SIZE];
+}
+
+// remove the i'th (0 = oldest) command of a lane and free its slot
+void WiThrottleProtocol::removeOutboundCommand(int lane, int i) {
+    int slot = outboundLaneSlot(lane, i);
+    for (int j = i; j > 0; j--) {
+        outboundLaneSlots[lane][(outboundLaneHead[lane] + j) % WIT_OUTBOUND_QUEUE_SIZE] =
+            outboundLaneSlots[lane][(outboundLaneHead[lane] + j - 1) % WIT_OUTBOUND_QUEUE_SIZE];
+    }
+    outboundLaneHead[lane] = (outboundLaneHead[lane] + 1) % WIT_OUTBOUND_QUEUE_SIZE;
+    outboundLaneCount[lane]--;
+    outboundQueueCount--;
+    outboundFreeSlots[outboundFreeCount++] = slot;
+}
+
+bool WiThrottleProtocol::outboundThrottleQueuedAfter(char multiThrottle, int slot) {
+    for (int lane = 0; lane < WIT_OUTBOUND_LANES; lane++) {
+        for (int i = 0; i < outboundLaneCount[lane]; i++) {
+            int other = outboundLaneSlot(lane, i);
+            const char *queued = outboundQueue[other];
+            if ( (queued[0] == 'M') && (queued[1] == multiThrottle)
+              && ((long) (outboundQueueSequence[other] - outboundQueueSequence[slot]) > 0) ) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
 
-        if ( (outboundBuffer.length()>0) &&((millis()-outboundCmdsTimeLastSent) > outboundCmdsMininumDelay) ) {
-            if (logLevel>1) {
-                console->print("WiT:: sendDelayedCommand() : Flushing outbound buffer - delay: "); console->print(outboundCmdsMininumDelay); console->print(" Buffer: ");  console->println(outboundBuffer);
+// acquire, release and steal: what a throttle's loco actions act on changes here, so its
+// other commands are not sent out of order across them
+static bool outboundSessionBoundary(const char *cmd) {
+    return (cmd[0] == 'M') && (cmd[1] != 0) && (cmd[2] != 'A');
+}
+
+int WiThrottleProtocol::outboundSessionOrder(int *lane) {
+    int slot = outboundLaneSlot(*lane, 0);
+    const char *cmd = outboundQueue[slot];
+    if ( (*lane == OutboundLaneSafety) || (cmd[0] != 'M') ) return 0;
+
+    // the throttle's oldest command queued before this one, and whether there is an acquire or release between
+    bool crossing = outboundSessionBoundary(cmd);
+    int oldestLane = *lane;
+    int oldestIndex = 0;
+    int oldestSlot = slot;
+    for (int l = 0; l < WIT_OUTBOUND_LANES; l++) {
+        for (int i = 0; i < outboundLaneCount[l]; i++) {
+            int other = outboundLaneSlot(l, i);
+            const char *queued = outboundQueue[other];
+            if ( (queued[0] != 'M') || (queued[1] != cmd[1])
+              || ((long) (outboundQueueSequence[other] - outboundQueueSequence[slot]) >= 0) ) {
+                continue;
             }
-            int end = outboundBuffer.indexOf("\n");
-            String thisCmd = outboundBuffer; // default to sending the lot
-            if (end>0) {
-                thisCmd = outboundBuffer.substring(0,end);
-                end++;
-                outboundBuffer = outboundBuffer.substring(end);
-                if (outboundBuffer.length()>0) {
-                    if (logLevel>1) {
-                        console->print("WiT:: sendDelayedCommand() : deferring cmds: "); console->println(outboundCmdsMininumDelay); 
-                        console->println("WiT::  Buffer: ");  console->println(outboundBuffer);
-                    }
-                }
-            } else if (end==0) {
-                thisCmd = "";
-                outboundBuffer = outboundBuffer.substring(end+1);
-            } else {
-                thisCmd = outboundBuffer;
-                outboundBuffer = "";
+            if (outboundSessionBoundary(queued)) crossing = true;
+            if ((long) (outboundQueueSequence[other] - outboundQueueSequence[oldestSlot]) < 0) {
+                oldestLane = l;
+                oldestIndex = i;
+                oldestSlot = other;
             }
+        }
+    }
+    if (!crossing) return 0;
+    *lane = oldestLane;
+    return oldestIndex;
+}
 
-            if (thisCmd.length()>0) {
-                outboundCmdsTimeLastSent = millis();
-                if (commandsNeedLeadingCrLf) {
-                    stream->write(0x0D);
-                    stream->write(0x0A);
-                }
-                stream->println(thisCmd);
+bool WiThrottleProtocol::queueOutboundCommand(const char *cmd, int len, OutboundLane lane) {
+    if (len >= WIT_OUTBOUND_COMMAND_SIZE) {
+        console->print("WiT:: ERROR COMMAND TOO LONG: >");
+        console->print(WIT_OUTBOUND_COMMAND_SIZE);
+        console->print(": ");
+        console->println(cmd);
+        outboundLaneStats[lane].dropped++;
+        return false;
+    }
+
+    // a speed or direction command replaces one still waiting for the same
+    // loco, unless something else for that throttle has been queued since, in
+    // any lane, so that acquire/release keep their order
+    int keyLen = outboundCommandKeyLength(cmd, len);
+    if (keyLen > 0) {
+        for (int i = outboundLaneCount[lane]-1; i >= 0; i--) {
+            int slot = outboundLaneSlot(lane, i);
+            const char *queued = outboundQueue[slot];
+            int queuedLen = strlen(queued);
+            if ( (outboundCommandKeyLength(queued, queuedLen) == keyLen) && (strncmp(queued, cmd, keyLen) == 0) ) {
+                if (outboundThrottleQueuedAfter(cmd[1], slot)) break;
+                if (WIT_LOG_AT(2)) { console->print("WiT:: coalescing: "); console->print(queued); console->print(" -> "); console->println(cmd); }
+                if (eventLog) eventLog->record(EventCoalesced, lane, 0, cmd, len);
+                memcpy(outboundQueue[slot], cmd, len);
+                outboundQueue[slot][len] = 0;
+                outboundCmdsCoalesced++;
+                return true;
+            }
+            if ( (queuedLen > 2) && (queued[0] == 'M') && (queued[1] == cmd[1]) ) {
+                break;
+            }
+        }
+    }
 
-                if (server) {
-                    stream->println("");
+    if (outboundFreeCount == 0) {
+        // full, so make room according to the overflow policy
+        int victimLane = -1;
+        int victimIndex = 0;
+        if (outboundOverflowPolicy == OutboundDropOldest) {
+            // the oldest command of the lowest priority lane, as long as that isn't more important than the new one
+            for (int l = OutboundLaneHousekeeping; l >= lane; l--) {
+                if (outboundLaneCount[l] > 0) {
+                    victimLane = l;
+                    break;
                 }
-                if (logLevel>0) {
-                    console->print("WiT:: ==> "); console->print(thisCmd);
-                    console->print(" ("); console->print(millis()); console->println(")");
+            }
+        }
+        else if (outboundOverflowPolicy == OutboundCoalesce) {
+            // the newest command in the same lane that this one can replace
+            for (int i = outboundLaneCount[lane]-1; i >= 0; i--) {
+                const char *queued = outboundQueue[outboundLaneSlot(lane, i)];
+                if ( (strcmp(queued, cmd) == 0)
+                  || ( (keyLen > 0) && (strncmp(queued, cmd, keyLen) == 0) && (outboundCommandKeyLength(queued, strlen(queued)) == keyLen) ) ) {
+                    victimLane = lane;
+                    victimIndex = i;
+                    break;
                 }
             }
         }
+
+        if (victimLane < 0) {
+            if (WIT_LOG_AT(1)) { console->print("WiT:: outbound queue full, rejecting: "); console->println(cmd); }
+            if (eventLog) eventLog->record(EventQueueRejected, lane, 0, cmd, len);
+            outboundLaneStats[lane].dropped++;
+            return false;
+        }
+        if (WIT_LOG_AT(1)) { console->print("WiT:: outbound queue full, dropping: "); console->println(outboundQueue[outboundLaneSlot(victimLane, victimIndex)]); }
+        if (eventLog) {
+            const char *victim = outboundQueue[outboundLaneSlot(victimLane, victimIndex)];
+            eventLog->record(EventQueueDropped, victimLane, 0, victim, strlen(victim));
+        }
+        removeOutboundCommand(victimLane, victimIndex);
+        outboundLaneStats[victimLane].dropped++;
+    }
+
+    int slot = outboundFreeSlots[--outboundFreeCount];
+    memcpy(outboundQueue[slot], cmd, len);
+    outboundQueue[slot][len] = 0;
+    outboundQueueTime[slot] = millis();
+    outboundQueueSequence[slot] = outboundSequence++;
+    outboundLaneSlots[lane][(outboundLaneHead[lane] + outboundLaneCount[lane]) % WIT_OUTBOUND_QUEUE_SIZE] = slot;
+    outboundLaneCount[lane]++;
+    outboundQueueCount++;
+    if (outboundQueueCount > outboundQueueHighWaterMark) {
+        outboundQueueHighWaterMark = outboundQueueCount;
     }
+    return true;
 }
 
-bool WiThrottleProtocol::checkFastTime() {
-	
-    bool changed = true;
-    
-	// check if a second has passed
-	if ((millis() - fastTimeTimer) > 1000) { 
-        
-		fastTimeTimer = millis();
-        
-		// no FastTime
-		if (currentFastTimeRate == 0.0) clockChanged = false;
-		
-		// FastTime, update accordingly to rate
-        else {
-            currentFastTime += currentFastTimeRate;
-            clockChanged = true;
+// remove any speed commands for a throttle ('*' for all) that are still in the queue
+void WiThrottleProtocol::purgeQueuedSpeedCommands(char multiThrottle) {
+    for (int i = outboundLaneCount[OutboundLaneMotion]-1; i >= 0; i--) {
+        const char *queued = outboundQueue[outboundLaneSlot(OutboundLaneMotion, i)];
+        if ( (outboundLocoAction(queued, strlen(queued)) == 'V') && ((multiThrottle == '*') || (queued[1] == multiThrottle)) ) {
+            if (WIT_LOG_AT(2)) { console->print("WiT:: purging: "); console->println(queued); }
+            removeOutboundCommand(OutboundLaneMotion, i);
         }
     }
+}
 
-    return changed;
+void WiThrottleProtocol::sendQueuedCommand() {
+    if ( stream && (outboundQueueCount>0) && ((millis()-outboundCmdsTimeLastSent) > outboundCmdsMininumDelay) ) {
+        // the highest priority lane goes first, but below the safety lane a
+        // command that has waited too long goes ahead so that nothing starves
+        int lane = -1;
+        int agedLane = -1;
+        for (int l = 0; l < WIT_OUTBOUND_LANES; l++) {
+            if (outboundLaneCount[l] == 0) continue;
+            if (lane < 0) lane = l;
+            unsigned long queued = outboundQueueTime[outboundLaneSlot(l, 0)];
+            if ( (l != OutboundLaneSafety) && (millis() - queued > WIT_OUTBOUND_MAX_WAIT)
+              && ((agedLane < 0) || (queued < outboundQueueTime[outboundLaneSlot(agedLane, 0)])) ) {
+                agedLane = l;
+            }
+        }
+        if ( (agedLane >= 0) && (lane != OutboundLaneSafety) ) lane = agedLane;
+
+        // a throttle's lower priority commands (e.g. functions) still go before its release or acquire
+        int index = outboundSessionOrder(&lane);
+
+        int slot = outboundLaneSlot(lane, index);
+        const char *thisCmd = outboundQueue[slot];
+        unsigned long wait = millis() - outboundQueueTime[slot];
+        removeOutboundCommand(lane, index);  // the slot isn't reused until the next command is queued
+
+        outboundLaneStats[lane].sent++;
+        outboundLaneStats[lane].totalWaitMs += wait;
+        if (wait > outboundLaneStats[lane].maxWaitMs) outboundLaneStats[lane].maxWaitMs = wait;
+
+        if (WIT_LOG_AT(2)) {
+            console->print("WiT:: sendQueuedCommand() : Flushing outbound queue - delay: "); console->print(outboundCmdsMininumDelay);
+            console->print(" lane: "); console->print(lane);
+            console->print(" Queued: ");  console->println(outboundQueueCount);
+        }
+
+        outboundCmdsTimeLastSent = millis();
+        if (commandsNeedLeadingCrLf) {
+            stream->write(0x0D);
+            stream->write(0x0A);
+        }
+        stream->println(thisCmd);
+
+        if (server) {
+            stream->println("");
+        }
+        if (WIT_LOG_AT(1)) {
+            console->print("WiT:: ==> "); console->print(thisCmd);
+            console->print(" ("); console->print(millis()); console->println(")");
+        }
+        if (eventLog) eventLog->record(EventSent, lane, wait, thisCmd, strlen(thisCmd));
+    }
+}
+
+void WiThrottleProtocol::setMessageFamilies(int families) {
+    messageFamilies = families;
+}
+
+void WiThrottleProtocol::setOutboundOverflowPolicy(OutboundOverflowPolicy policy) {
+    outboundOverflowPolicy = policy;
+}
+
+int WiThrottleProtocol::getOutboundQueueDepth() {
+    return outboundQueueCount;
+}
+
+int WiThrottleProtocol::getOutboundQueueDepth(OutboundLane lane) {
+    return outboundLaneCount[lane];
+}
+
+int WiThrottleProtocol::getOutboundQueueHighWaterMark() {
+    return outboundQueueHighWaterMark;
+}
+
+unsigned long WiThrottleProtocol::getOutboundCommandsDropped() {
+    unsigned long dropped = 0;
+    for (int l = 0; l < WIT_OUTBOUND_LANES; l++) dropped += outboundLaneStats[l].dropped;
+    return dropped;
+}
+
+// time left before a timer that started at 'since' passes 'period', and so the
+// next check() has work to do
+static long timeRemaining(unsigned long since, unsigned long period) {
+    unsigned long elapsed = millis() - since;
+    return (elapsed > period) ? 0 : (long) (period - elapsed + 1);
+}
+
+long WiThrottleProtocol::getTimeUntilNextEvent() {
+    long next = -1;
+
+    // heartbeat, at half the period the server asked for (see checkHeartbeat())
+    if (heartbeatPeriod > 0) {
+        next = timeRemaining(heartbeatTimer, heartbeatPeriod * 500UL);
+    }
+
+    // fast clock tick (see checkFastTime())
+    if (fastTimeRate != 0) {
+        long t = getTimeUntilFastTimeChange();
+        if (next < 0 || t < next) next = t;
+    }
+
+    // queued commands waiting for the minimum delay between commands
+    if (outboundQueueCount > 0) {
+        long t = timeRemaining((unsigned long) outboundCmdsTimeLastSent, outboundCmdsMininumDelay);
+        if (next < 0 || t < next) next = t;
+    }
+
+    return next;
+}
+
+unsigned long WiThrottleProtocol::getBytesReceived() {
+    return bytesReceived;
+}
+
+unsigned long WiThrottleProtocol::getCommandsReceived() {
+    return commandsReceived;
+}
+
+unsigned long WiThrottleProtocol::getOutboundCommandsCoalesced() {
+    return outboundCmdsCoalesced;
+}
+
+OutboundLaneStats WiThrottleProtocol::getOutboundLaneStats(OutboundLane lane) {
+    return outboundLaneStats[lane];
+}
+
+bool WiThrottleProtocol::checkFastTime() {
+    if (fastTimeRate == 0) return false;
+
+    if (fastTimeGranularity == 0) {
+        // tick when a (real) second has passed since the last tick. It moves on by whole
+        // seconds, so the ticks stay a second apart however late check() is called
+        unsigned long elapsed = millis() - fastTimeTickMillis;
+        if (elapsed < 1000) return false;
+        fastTimeTickMillis += elapsed - elapsed % 1000;
+        notifyFastTime(getFastTime());
+        return true;
+    }
+
+    // tick when the fast time reaches the next multiple of the granularity
+    uint32_t t = getFastTime();
+    if (t / fastTimeGranularity == fastTimeNotified / fastTimeGranularity) return false;
+    notifyFastTime(t);
+    return true;
+}
+
+void WiThrottleProtocol::notifyFastTime(uint32_t t) {
+    fastTimeNotified = t;
+    clockChanged = true;
+    if (delegate) delegate->onFastTime(t);
+}
+
+void WiThrottleProtocol::setFastTimeGranularity(uint32_t seconds) {
+    fastTimeGranularity = (seconds > 86400) ? 86400 : seconds;
+    fastTimeNotified = getFastTime();
+}
+
+long WiThrottleProtocol::getTimeUntilFastTimeChange() {
+    if (fastTimeRate == 0) return -1;
+    if (fastTimeGranularity == 0) {
+        unsigned long elapsed = millis() - fastTimeTickMillis;
+        return (elapsed >= 1000) ? 0 : (long) (1000 - elapsed);
+    }
+
+    advanceFastTime();
+    unsigned long elapsed = millis() - fastTimeSyncMillis;
+
+    // fast milliseconds from the sync point to the next multiple of the granularity, then the
+    // (real) milliseconds that takes, rounded up. Split so that it stays in 32 bits
+    uint32_t next = (fastTimeNotified / fastTimeGranularity + 1) * fastTimeGranularity;
+    if (next <= fastTimeSeconds) return 0;
+    uint32_t fast = (next - fastTimeSeconds) * 1000 - fastTimeMillis;
+    uint32_t whole = fast / fastTimeRate;
+    if (whole >= 2000000) return 2000000000L;  // at very slow rates, over 23 days
+    uint32_t real = whole * 1000 + ((fast % fastTimeRate) * 1000 + fastTimeRate - 1) / fastTimeRate;
+    return (elapsed >= real) ? 0 : (long) (real - elapsed);
+}
+
+void WiThrottleProtocol::advanceFastTime() {
+    // a real second is exactly fastTimeRate fast milliseconds, so nothing is lost. Moving on
+    // keeps the arithmetic in 32 bits: seconds * 999 + 999 fits even after 49 days
+    unsigned long seconds = (millis() - fastTimeSyncMillis) / 1000;
+    if (seconds == 0) return;
+
+    fastTimeSyncMillis += seconds * 1000;
+    uint32_t fraction = seconds * (fastTimeRate % 1000) + fastTimeMillis;
+    fastTimeSeconds += seconds * (fastTimeRate / 1000) + fraction / 1000;
+    fastTimeMillis = fraction % 1000;
 }
 
 
@@ -298,84 +977,99 @@ WiThrottleProtocol::fastTimeMinutes()
 
 
 double WiThrottleProtocol::getCurrentFastTime() {
+    uint16_t milliseconds;
+    uint32_t seconds = getFastTime(&milliseconds);
+	return seconds + milliseconds / 1000.0;
+}
 
-	return currentFastTime;
+uint32_t WiThrottleProtocol::getFastTime(uint16_t *milliseconds) {
+    advanceFastTime();
+
+    // less than a (real) second since the sync point now, so this is at most about 10^9
+    uint32_t fraction = fastTimeMillis + (millis() - fastTimeSyncMillis) * fastTimeRate / 1000;
+    if (milliseconds) *milliseconds = fraction % 1000;
+    return fastTimeSeconds + fraction / 1000;
 }
 
 float WiThrottleProtocol::getFastTimeRate() {
-    return currentFastTimeRate;
+    return fastTimeRate / 1000.0f;
+}
+
+uint32_t WiThrottleProtocol::getFastTimeRateThousandths() {
+    return fastTimeRate;
 }
 
+#if WIT_PARSE_LOCOS
 bool WiThrottleProtocol::processLocomotiveAction(char multiThrottle, char *c, int len) {
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    String remainder(c);  // the leading "MTA" was not passed to this method
+    // the leading "MTA" was not passed to this method
 
-    if (logLevel>0) console->printf("WiT:: processLocomotiveAction(): remainder at first is %s\n", remainder.c_str());
+    if (WIT_LOG_AT(1)) console->printf("WiT:: processLocomotiveAction(): remainder at first is %.*s\n", len, c);
 
-    if (currentAddress[multiThrottleIndex].equals("")) {
-        if (logLevel>0) console->printf("WiT::   skipping due to no selected address\n");
+    const ThrottleState &throttle = throttles[multiThrottleIndex];
+    if (throttle.consistSize == 0) {
+        if (WIT_LOG_AT(1)) console->printf("WiT::   skipping due to no selected address\n");
         return true;
     }
     else {
-        if (logLevel>1) console->printf("WiT::   currentAddress is '%s'\n", currentAddress[multiThrottleIndex].c_str());
+        if (WIT_LOG_AT(2)) { console->print("WiT::   currentAddress is "); console->println(addressToString(throttle.consist[0])); }
     }
 
     bool isLeadOrAll = true;
-    String address = "";
-    String addrCheck = currentAddress[multiThrottleIndex] + PROPERTY_SEPARATOR;
-    String allCheck = "*";
-    allCheck.concat(PROPERTY_SEPARATOR);
-    if (remainder.startsWith(addrCheck)) {
-        remainder.remove(0, addrCheck.length());
-    } else if (remainder.startsWith(allCheck)) {
-        remainder.remove(0, allCheck.length());
-    } else {
-        int p = remainder.indexOf(PROPERTY_SEPARATOR);
-        if (p > 0) { // non-lead loco
-            address = remainder.substring(0, p);
-            addrCheck = address + PROPERTY_SEPARATOR;
-            remainder.remove(0, addrCheck.length());
+    const char *address = NULL;
+    int addressLen = 0;
+    const char *remainder = c;
+    int remainderLen = len;
+
+    int p = viewIndexOf(c, len, PROPERTY_SEPARATOR);
+    if (p > 0) {
+        if ((packAddress(c, p) != throttle.consist[0])
+                && !(p == 1 && c[0] == '*')) { // non-lead loco
+            address = c;
+            addressLen = p;
             isLeadOrAll = false;
         }
+        remainder = c + p + 3;
+        remainderLen = len - p - 3;
     }
 
-    if (logLevel>1) console->printf("WiT:: processLocomotiveAction: after separator is %s\n", remainder.c_str());
+    if (WIT_LOG_AT(2)) console->printf("WiT:: processLocomotiveAction: after separator is %.*s\n", remainderLen, remainder);
 
-    if (remainder.length() > 0) {
+    if (remainderLen > 0) {
         char action = remainder[0];
 
         if (isLeadOrAll) {
             switch (action) {
                 case 'F':
-                    if (logLevel>1) console->printf("WiT:: processing function state\n");
-                    processFunctionState(multiThrottle, remainder);
+                    if (WIT_LOG_AT(2)) console->printf("WiT:: processing function state\n");
+                    processFunctionState(multiThrottle, remainder, remainderLen);
                     break;
                 case 'V':
-                    processSpeed(multiThrottle, remainder);
+                    processSpeed(multiThrottle, remainder, remainderLen);
                     break;
                 case 's':
-                    processSpeedSteps(multiThrottle, remainder);
+                    processSpeedSteps(multiThrottle, remainder, remainderLen);
                     break;
                 case 'R':
-                    processDirection(multiThrottle, remainder);
+                    processDirection(multiThrottle, remainder, remainderLen);
                     break;
                 default:
-                    if (logLevel>0) console->printf("WiT:: unrecognized action '%c'\n", action);
+                    if (WIT_LOG_AT(1)) console->printf("WiT:: unrecognized action '%c'\n", action);
                     // no processing on unrecognized actions
                     break;
             }
         } else { // non-lead loco
-            if (logLevel>0) console->printf("WiT:: Non-lead loco action '%c'\n", action);
+            if (WIT_LOG_AT(1)) console->printf("WiT:: Non-lead loco action '%c'\n", action);
             switch (action) {
                 case 'F':
                 case 'V':
                 case 's':
                     break;
                 case 'R':
-                    processDirection(multiThrottle, address, remainder);
+                    processDirection(multiThrottle, address, addressLen, remainder, remainderLen);
                     break;
                 default:
-                    if (logLevel>0) console->printf("WiT:: unrecognized action '%c'\n", action);
+                    if (WIT_LOG_AT(1)) console->printf("WiT:: unrecognized action '%c'\n", action);
                     // no processing on unrecognized actions
                     break;
             }
@@ -383,61 +1077,63 @@ bool WiThrottleProtocol::processLocomotiveAction(char multiThrottle, char *c, in
         return true;
     }
     else {
-        if (logLevel>0) console->printf("WiT:: insufficient action to process\n");
+        if (WIT_LOG_AT(1)) console->printf("WiT:: insufficient action to process\n");
         return false;
     }
 }
 
 bool WiThrottleProtocol::processRosterFunctionList(char multiThrottle, char *c, int len) {
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    String remainder(c);  // the leading "MTL" was not passed to this method
+    // the leading "MTL" was not passed to this method
 
-    if (logLevel>0) console->printf("WiT:: processRosterFunctionList(): remainder at first is %s\n", remainder.c_str());
+    if (WIT_LOG_AT(1)) console->printf("WiT:: processRosterFunctionList(): remainder at first is %.*s\n", len, c);
 
-    if (currentAddress[multiThrottleIndex].equals("")) {
-        if (logLevel>0) console->printf("WiT::   skipping due to no selected address\n");
+    const ThrottleState &throttle = throttles[multiThrottleIndex];
+    if (throttle.consistSize == 0) {
+        if (WIT_LOG_AT(1)) console->printf("WiT::   skipping due to no selected address\n");
         return true;
     }
     else {
-        if (logLevel>0) console->printf("WiT::   currentAddress is '%s'\n", currentAddress[multiThrottleIndex].c_str());
+        if (WIT_LOG_AT(1)) { console->print("WiT::   currentAddress is "); console->println(addressToString(throttle.consist[0])); }
     }
 
-    String addrCheck = currentAddress[multiThrottleIndex] + PROPERTY_SEPARATOR;
-    String allCheck = "*";
-    allCheck.concat(PROPERTY_SEPARATOR);
-    if (remainder.startsWith(addrCheck)) {
-        remainder.remove(0, addrCheck.length());
-    }
-    else if (remainder.startsWith(allCheck)) {
-        remainder.remove(0, allCheck.length());
+    const char *remainder = c;
+    int remainderLen = len;
+
+    int p = viewIndexOf(c, len, PROPERTY_SEPARATOR);
+    if (p > 0 && ((packAddress(c, p) == throttle.consist[0]) || (p == 1 && c[0] == '*'))) {
+        remainder = c + p + 3;
+        remainderLen = len - p - 3;
     }
 
-    if (logLevel>1) console->printf("WiT:: processRosterFunctionList(): after separator is %s\n", remainder.c_str());
+    if (WIT_LOG_AT(2)) console->printf("WiT:: processRosterFunctionList(): after separator is %.*s\n", remainderLen, remainder);
 
-    if (remainder.length() > 0) {
+    if (remainderLen > 0) {
         char action = remainder[0];
 
         if (action == ']') {
-            processRosterFunctionListEntries(multiThrottle, remainder);
+            processRosterFunctionListEntries(multiThrottle, remainder, remainderLen);
         } else {
-            if (logLevel>0) console->printf("WiT:: unrecognized L action '%c'\n", action);
+            if (WIT_LOG_AT(1)) console->printf("WiT:: unrecognized L action '%c'\n", action);
             // no processing on unrecognized actions
         }
         return true;
     }
     else {
-        if (logLevel>0) console->printf("WiT:: insufficient action to process\n");
+        if (WIT_LOG_AT(1)) console->printf("WiT:: insufficient action to process\n");
         return false;
     }
 }
+#endif // WIT_PARSE_LOCOS
 
 bool WiThrottleProtocol::processCommand(char *c, int len) {
     bool changed = false;
 
-    if (logLevel>0) {
+    if (WIT_LOG_AT(1)) {
         console->print("WiT:: <== ");
         console->println(c);
     }
+    if (eventLog) eventLog->record(EventReceived, 0, 0, c, len);
 
     lastServerResponseTime = millis()/1000;
 
@@ -445,111 +1141,174 @@ bool WiThrottleProtocol::processCommand(char *c, int len) {
     // by a Digitrax LnWi.  Remove it, and try again.
     const char *ignoreThisGarbage = "AT+CIPSENDBUF=";
     while (strncmp(c, ignoreThisGarbage, strlen(ignoreThisGarbage)) == 0) {
-        if (logLevel>0) console->printf("WiT:: removed one instance of %s\n", ignoreThisGarbage);
+        if (WIT_LOG_AT(1)) console->printf("WiT:: removed one instance of %s\n", ignoreThisGarbage);
         c += strlen(ignoreThisGarbage);
+        len -= strlen(ignoreThisGarbage);
         changed = true;
     }
 
     if (changed) {
-        if (logLevel>0) console->printf("WiT:: input string is now: '%s'\n", c);
-    }
+        if (WIT_LOG_AT(1)) console->printf("WiT:: input string is now: '%s'\n", c);
+    }
+
+    // a command too short to be classified as it arrived
+    if (messageFamily(c, len) & ~(messageFamilies & parsedMessageFamilies)) return false;
+
+    // dispatch on the first character and then the second or third, with the
+    // loco actions first. The switches compile to jump tables, so every command
+    // is reached after a fixed number of comparisons
+    switch (c[0]) {
+        case 'M':
+#if !WIT_PARSE_LOCOS
+            return false;  // not compiled in
+#else
+            if (len > 6 && getMultiThrottleIndex(c[1]) < 0) {
+                if (WIT_LOG_AT(1)) console->printf("WiT:: ignoring command for unknown throttle '%c'\n", c[1]);
+                if (eventLog) eventLog->record(EventUnknownThrottle, c[1]);
+                return false;
+            }
+            if (len > 6) {
+                switch (c[2]) {
+                    case 'A':
+                        if (len > 8) return processLocomotiveAction(c[1], c+3, len-3);
+                        break;
+                    case 'L':
+                        if (len > 8) return processRosterFunctionList(c[1], c+3, len-3);
+                        break;
+                    case 'S':
+                        processStealNeeded(c[1], c+3, len-3);
+                        return true;
+                    case '+':
+                    case '-':
+                        // we want to make sure the + or - is passed in as part of the string to process
+                        processAddRemove(c[1], c+2, len-2);
+                        return true;
+                }
+            }
+            break;
+#endif
+
+        case '*':
+            if (len > 1) return processHeartbeat(c+1, len-1);
+            break;
+
+        case 'P':
+            if (len > 2) {
+                switch (c[1]) {
+                    case 'F':
+                        if (len > 3 && c[2]=='T') return processFastTime(c+3, len-3);
+                        break;
+                    case 'P':
+                        if (len > 3 && c[2]=='A') {
+                            processTrackPower(c+3, len-3);
+                            return true;
+                        }
+                        break;
+                    case 'T':
+                        if (len > 5 && c[2]=='A') {
+#if WIT_PARSE_TURNOUTS
+                            processTurnoutAction(c+3, len-3);
+                            return true;
+#else
+                            return false;  // not compiled in
+#endif
+                        }
+                        break;
+                    case 'R':
+                        if (len > 4 && c[2]=='A') {
+#if WIT_PARSE_ROUTES
+                            processRouteAction(c+3, len-3);
+                            return true;
+#else
+                            return false;  // not compiled in
+#endif
+                        }
+                        break;
+                    case 'W':
+                        processWebPort(c+2, len-2);
+                        return true;
+                }
+            }
+            break;
+
+        case 'H':
+            if (len > 2) {
+                switch (c[1]) {
+                    case 'T':
+                        processServerType(c+2, len-2);
+                        return true;
+                    case 't':
+                        processServerDescription(c+2, len-2);
+                        return true;
+                    case 'M':
+                        processAlert(c+2, len-2);
+                        return true;
+                    case 'm':
+                        processMessage(c+2, len-2);
+                        return true;
+                }
+            }
+            break;
 
-    if (len > 3 && c[0]=='P' && c[1]=='F' && c[2]=='T') {
-        return processFastTime(c+3, len-3);
-    }
-    else if (len > 3 && c[0]=='P' && c[1]=='P' && c[2]=='A') {
-        processTrackPower(c+3, len-3);
-        return true;
-    }
-    else if (len > 1 && c[0]=='*') {
-        return processHeartbeat(c+1, len-1);
-    }
-    else if (len > 2 && c[0]=='V' && c[1]=='N') {
-        processProtocolVersion(c+2, len-2);
-        return true;
-    }
-    else if (len > 2 && c[0]=='H' && c[1]=='T') {
-        processServerType(c+2, len-2);
-        return true;
-    }
-    else if (len > 2 && c[0]=='H' && c[1]=='t') {
-        processServerDescription(c+2, len-2);
-        return true;
-    }	
-    else if (len > 2 && c[0]=='H' && c[1]=='M') {
-        processAlert(c+2, len-2);
-        return true;
-    }	
-    else if (len > 2 && c[0]=='H' && c[1]=='m') {
-        processMessage(c+2, len-2);
-        return true;
-    }	
-    else if (len > 2 && c[0]=='P' && c[1]=='W') {
-        processWebPort(c+2, len-2);
-        return true;
-    }
-    else if (len > 2 && c[0]=='R' && c[1]=='L') {
-        processRosterList(c+2, len-2);
-        return true;
-    }	
-    else if (len > 3 && c[0]=='P' && c[1]=='T' && c[2]=='L') {
-        processTurnoutList(c+2, len-2);
-        return true;
-    }	
-    else if (len > 3 && c[0]=='P' && c[1]=='R' && c[2]=='L') {
-        processRouteList(c+2, len-2);
-        return true;
-    }	
-    else if (len > 6 && c[0]=='M' && c[2]=='S') {
-        processStealNeeded(c[1], c+3, len-3);
-        return true;
-    }
-    else if (len > 6 && c[0]=='M' && (c[2]=='+' || c[2]=='-')) {
-        // we want to make sure the + or - is passed in as part of the string to process
-        processAddRemove(c[1], c+2, len-2);
-        return true;
-    }
-    else if (len > 8 && c[0]=='M' && c[2]=='A') {
-        return processLocomotiveAction(c[1], c+3, len-3);
-    }
-    else if (len > 8 && c[0]=='M' && c[2]=='L') {
-        return processRosterFunctionList(c[1], c+3, len-3);
-    }
-    else if (len > 5 && c[0]=='P' && c[1]=='T' && c[2]=='A') {
-        processTurnoutAction(c+3, len-3);
-        return true;
-    }
-    else if (len > 4 && c[0]=='P' && c[1]=='R' && c[2]=='A') {
-        processRouteAction(c+3, len-3);
-        return true;
-    }
-    else if (len > 3 && c[0]=='A' && c[1]=='T' && c[2]=='+') {
-        // this is an AT+.... command that the LnWi sometimes emits and we
-        processUnknownCommand(c, len);
-        // ignore these commands altogether
-    }
-    else {
-        if (logLevel>0) console->printf("WiT:: unknown command '%s'\n", c);
-        processUnknownCommand(c, len);
-        // all other commands are explicitly ignored
+        case 'V':
+            if (len > 2 && c[1]=='N') {
+                processProtocolVersion(c+2, len-2);
+                return true;
+            }
+            break;
+
+        case 'A':
+            if (len > 3 && c[1]=='T' && c[2]=='+') {
+                // this is an AT+.... command that the LnWi sometimes emits and we
+                // ignore these commands altogether
+                processUnknownCommand(c, len);
+                return false;
+            }
+            break;
     }
+
+    if (WIT_LOG_AT(1)) console->printf("WiT:: unknown command '%s'\n", c);
+    if (eventLog) eventLog->record(EventUnknownCommand, 0, 0, c, len);
+    processUnknownCommand(c, len);
+    // all other commands are explicitly ignored
     return false;
 }
 
 
-void WiThrottleProtocol::setCurrentFastTime(const String& s) {
-    int t = s.toInt();
-    if (currentFastTime == 0.0) {
-        if (logLevel>0) { console->print("WiT:: set fast time to "); console->println(t); }
+void WiThrottleProtocol::setCurrentFastTime(long t, uint32_t rate) {
+    if (fastTimeSeconds == 0) {
+        if (WIT_LOG_AT(1)) { console->print("WiT:: set fast time to "); console->println(t); }
     }
     else {
-        if (logLevel>0) {
+        if (WIT_LOG_AT(1)) {
             console->print("WiT:: updating fast time (should be "); console->print(t);
-            console->print(" is "); console->print(currentFastTime);  console->println(")");
+            console->print(" is "); console->print(getFastTime());  console->println(")");
             console->printf("currentTime is %ld\n", millis());
         }
     }
-    currentFastTime = t;
+    fastTimeSyncMillis = millis();
+    fastTimeTickMillis = fastTimeSyncMillis;
+    fastTimeSeconds = t;
+    fastTimeMillis = 0;
+    fastTimeRate = rate;  // before the delegate is called, so that it sees the new rate
+    notifyFastTime(t);
+}
+
+// the fast clock rate as the server sends it ("4.0", "0.25"), in thousandths, without floating point
+static uint32_t parseFastTimeRate(const char *c) {
+    while (*c == ' ') c++;
+    uint32_t rate = 0;
+    while (*c >= '0' && *c <= '9') {
+        rate = rate * 10 + (*c++ - '0');
+        if (rate > WIT_FAST_TIME_MAX_RATE / 1000) return WIT_FAST_TIME_MAX_RATE;
+    }
+    rate *= 1000;
+    if (*c == '.') {
+        c++;
+        for (uint32_t scale = 100; scale > 0 && *c >= '0' && *c <= '9'; scale /= 10) rate += (*c++ - '0') * scale;
+        if (*c >= '5' && *c <= '9') rate++;  // round on the fourth decimal place
+    }
+    return (rate > WIT_FAST_TIME_MAX_RATE) ? WIT_FAST_TIME_MAX_RATE : rate;
 }
 
 
@@ -559,21 +1318,16 @@ bool WiThrottleProtocol::processFastTime(char *c, int len) {
 
     bool changed = false;
 
-    String s(c);
-
-    int p = s.indexOf(PROPERTY_SEPARATOR);
+    int p = viewIndexOf(c, len, PROPERTY_SEPARATOR);
     if (p > 0) {
-        String timeval = s.substring(0, p);
-        String rate    = s.substring(p+3);
-
-        setCurrentFastTime(timeval);
-        currentFastTimeRate = rate.toFloat();
-        if (logLevel>0) { console->print("WiT:: set clock rate to "); console->println(currentFastTimeRate); }
+        setCurrentFastTime(viewToInt(c, p), parseFastTimeRate(c+p+3));  // the rate runs to the end of the (terminated) line
+        if (WIT_LOG_AT(1)) { console->print("WiT:: set clock rate to "); console->println(getFastTimeRate()); }
+        if (eventLog) eventLog->record(EventFastTime, (long) fastTimeSeconds, (long) fastTimeRate);
+        if (delegate) delegate->onFastTimeRate(getFastTimeRate());
         changed = true;
-        clockChanged = true;
     }
     else {
-        setCurrentFastTime(s);
+        setCurrentFastTime(viewToInt(c, len), fastTimeRate);
         changed = true;
     }
 
@@ -583,14 +1337,13 @@ bool WiThrottleProtocol::processFastTime(char *c, int len) {
 
 bool WiThrottleProtocol::processHeartbeat(char *c, int len) {
     bool changed = false;
-    String s(c);
 
-    heartbeatPeriod = s.toInt();
+    heartbeatPeriod = viewToInt(c, len);
     if (heartbeatPeriod > 0) {
         heartbeatChanged = true;
         changed = true;
         if (delegate) {
-            delegate->heartbeatConfig(heartbeatPeriod);
+            delegate->onHeartbeatConfig(heartbeatPeriod);
         }
     }
     return changed;
@@ -599,308 +1352,207 @@ bool WiThrottleProtocol::processHeartbeat(char *c, int len) {
 
 void WiThrottleProtocol::processProtocolVersion(char *c, int len) {
     if (delegate && len > 0) {
-        String protocolVersion = String(c);
-        delegate->receivedVersion(protocolVersion);
+        delegate->onVersion({c, len});
     }
 }
 
 void WiThrottleProtocol::processServerType(char *c, int len) {
 	
     if (delegate && len > 0) {
-        String serverType = String(c);
-        delegate->receivedServerType(serverType);
+        delegate->onServerType({c, len});
     }
 }
 
 void WiThrottleProtocol::processServerDescription(char *c, int len) {
 	
     if (delegate && len > 0) {
-        String serverDescription = String(c);
-        delegate->receivedServerDescription(serverDescription);
+        delegate->onServerDescription({c, len});
     }
 }
 
 void WiThrottleProtocol::processMessage(char *c, int len) {
-    if (logLevel>1) console->println("WiT:: processMessage()");
+    if (WIT_LOG_AT(2)) console->println("WiT:: processMessage()");
 	
     if (delegate && len > 0) {
-        String message = String(c);
-        delegate->receivedMessage(message);
+        delegate->onMessage({c, len});
     }
 }
 
 void WiThrottleProtocol::processAlert(char *c, int len) {
-    if (logLevel>1) console->println("WiT:: processAlert()");
+    if (WIT_LOG_AT(2)) console->println("WiT:: processAlert()");
 	
     if (delegate && len > 0) {
-        String alert = String(c);
-        delegate->receivedAlert(alert);
+        delegate->onAlert({c, len});
     }
 }
 
 void WiThrottleProtocol::processWebPort(char *c, int len) {
-    if (logLevel>1) console->println("WiT:: processWebPort()");
+    if (WIT_LOG_AT(2)) console->println("WiT:: processWebPort()");
     if (delegate && len > 0) {
-        String port_string = String(c);
-        int port = port_string.toInt();
-
-        delegate->receivedWebPort(port);
+        delegate->onWebPort(viewToInt(c, len));
     }
 }
 
-void WiThrottleProtocol::processRosterList(char *c, int len) {
-    if (logLevel>0) console->println("WiT:: processRosterList()");
+#if WIT_PARSE_ROSTER
+void WiThrottleProtocol::processRosterEntry(int index, const char *c, int len) {
+	if (WIT_LOG_AT(1)) { console->print("WiT:: Roster Entry: "); console->println(index + 1); }
 
-	String s(c);
+	// split element in segments: name, address, length
+	const char *segment[3];
+	int segmentLen[3];
+	viewSplitSegments(c, len, segment, segmentLen, 3);
+	logListSegments(segment, segmentLen);
+	int address = viewToInt(segment[1], segmentLen[1]);
+	char length = (segmentLen[2] > 0) ? segment[2][0] : 0;
+	if(layoutStore) layoutStore->storeRosterEntry(segment[0], segmentLen[0], address, length);
 
-	// get the number of entries
-    int indexSeperatorPosition = s.indexOf(ENTRY_SEPARATOR,1);
-	int entries = s.substring(0, indexSeperatorPosition).toInt();
-	if (logLevel>0) { console->print("WiT:: Entries in roster: "); console->println(entries);}
-	
 	// if set, call the delegate method
-	if (delegate) delegate->receivedRosterEntries(entries);	
-	
-	// loop
-	int entryStartPosition = 4; //ignore the first entry separator
-	for(int i = 0; i < entries; i++) {
-	
-		// get element
-		int entrySeparatorPosition = s.indexOf(ENTRY_SEPARATOR, entryStartPosition);
-		String entry = s.substring(entryStartPosition, entrySeparatorPosition);
-		if (logLevel>0) { console->print("WiT:: Roster Entry: "); console->println(i + 1); }
-		
-		// split element in segments and parse them		
-		String name;
-		int address = 0;
-		char length = 0;
-		int segmentStartPosition = 0;
-		for(int j = 0; j < 3; j++) {
-		
-			// get segment
-			int segmentSeparatorPosition = entry.indexOf(SEGMENT_SEPARATOR, segmentStartPosition);
-			String segment = entry.substring(segmentStartPosition, segmentSeparatorPosition);
-			if (logLevel>0) { console->print("WiT:: "); console->print(rosterSegmentDesc[j]); console->print(": "); console->println(segment); }
-			segmentStartPosition = segmentSeparatorPosition + 3;
-			
-			// parse the segments
-			if(j == 0) name = segment;
-			else if(j == 1) address = segment.toInt();
-			else if(j == 2) length = segment[0];
-		}
-		
-		// if set, call the delegate method
-		if(delegate) delegate->receivedRosterEntry(i, name, address, length);
-		
-		entryStartPosition = entrySeparatorPosition + 3;
-	}
-
-    if (logLevel>0) console->println("WiT:: processRosterList(): end");
+	if(delegate) delegate->onRosterEntry(index, {segment[0], segmentLen[0]}, (address & WIT_ADDRESS_MASK) | ((length == 'L') ? WIT_LONG_ADDRESS : 0));
 }
+#endif // WIT_PARSE_ROSTER
 
-void WiThrottleProtocol::processTurnoutList(char *c, int len) {
-    if (logLevel>0) console->println("WiT:: processTurnoutList()");
-
-  	String s(c);
-
-    // loop
-    int entries = -1;
-    boolean entryFound = true;
-	int entryStartPosition = 4; //ignore the first entry separator
-    if (sizeof(c) <= 3) entryFound =false;
+#if WIT_PARSE_TURNOUTS
+void WiThrottleProtocol::processTurnoutEntry(int index, const char *c, int len) {
+	if (WIT_LOG_AT(1)) { console->print("WiT:: Turnout Entry: "); console->println(index + 1); }
 
-    while (entryFound) {
-	    entries++;
+	// split element in segments: system name, user name, state
+	const char *segment[3];
+	int segmentLen[3];
+	viewSplitSegments(c, len, segment, segmentLen, 3);
+	logListSegments(segment, segmentLen);
+	int state = viewToInt(segment[2], segmentLen[2]);
+	if(layoutStore) layoutStore->storeTurnout(segment[0], segmentLen[0], segment[1], segmentLen[1], state);
 
-		// get element
-		int entrySeparatorPosition = s.indexOf(ENTRY_SEPARATOR, entryStartPosition);
-        if (entrySeparatorPosition==-1) entrySeparatorPosition = s.length();
-		String entry = s.substring(entryStartPosition, entrySeparatorPosition);
-		if (logLevel>0) { console->print("WiT:: Turnout Entry: "); console->println(entries + 1); }
-		
-		// split element in segments and parse them		
-		String sysName;
-		String userName;
-        int state = 0;
-		int segmentStartPosition = 0;
-		for(int j = 0; j < 3; j++) {
-		
-			// get segment
-			int segmentSeparatorPosition = entry.indexOf(SEGMENT_SEPARATOR, segmentStartPosition);
-			String segment = entry.substring(segmentStartPosition, segmentSeparatorPosition);
-			if (logLevel>0) { console->print("WiT:: "); console->print(rosterSegmentDesc[j]); console->print(": "); console->println(segment); }
-			segmentStartPosition = segmentSeparatorPosition + 3;
-			
-			// parse the segments
-			if(j == 0) sysName = segment;
-			else if(j == 1) userName = segment;
-			else if(j == 2) state = segment.toInt();
-		}
-		
-		// if set, call the delegate method
-		if(delegate) delegate->receivedTurnoutEntry(entries, sysName, userName, state);
-		
-		entryStartPosition = entrySeparatorPosition + 3;
-        if (logLevel>0) {
-            console->print("WiT:: "); console->println(entryStartPosition);
-            console->print("WiT:: "); console->println(s.length());
-        }
-        if (entryStartPosition >= s.length()) entryFound = false;
-	}
-
-	// get the number of entries
-	if (logLevel>0) { console->print("WiT:: Entries in Turnouts List: "); console->println(entries+1); }
 	// if set, call the delegate method
-	if (delegate) delegate->receivedTurnoutEntries(entries+1);	
-
-    if (logLevel>1) console->println("WiT:: processTurnoutList(): end");
+	if(delegate) delegate->onTurnoutEntry(index, {segment[0], segmentLen[0]}, {segment[1], segmentLen[1]}, state);
 }
+#endif // WIT_PARSE_TURNOUTS
 
-void WiThrottleProtocol::processRouteList(char *c, int len) {
-    if (logLevel>0) console->println("WiT:: processRouteList()");
-  	String s(c);
+#if WIT_PARSE_ROUTES
+void WiThrottleProtocol::processRouteEntry(int index, const char *c, int len) {
+	if (WIT_LOG_AT(1)) { console->print("WiT:: Route Entry: "); console->println(index + 1); }
 
-    // loop
-    int entries = -1;
-    boolean entryFound = true;
-	int entryStartPosition = 4; //ignore the first entry separator
-    if (sizeof(c) <= 3) entryFound =false;
+	// split element in segments: system name, user name, state
+	const char *segment[3];
+	int segmentLen[3];
+	viewSplitSegments(c, len, segment, segmentLen, 3);
+	logListSegments(segment, segmentLen);
+	int state = viewToInt(segment[2], segmentLen[2]);
+	if(layoutStore) layoutStore->storeRoute(segment[0], segmentLen[0], segment[1], segmentLen[1], state);
 
-    while (entryFound) {
-	    entries++;
+	// if set, call the delegate method
+	if(delegate) delegate->onRouteEntry(index, {segment[0], segmentLen[0]}, {segment[1], segmentLen[1]}, state);
+}
+#endif // WIT_PARSE_ROUTES
 
-		// get element
-		int entrySeparatorPosition = s.indexOf(ENTRY_SEPARATOR, entryStartPosition);
-        if (entrySeparatorPosition==-1) entrySeparatorPosition = s.length();
-		String entry = s.substring(entryStartPosition, entrySeparatorPosition);
-		if (logLevel>0) { console->print("WiT:: Route Entry: "); console->println(entries + 1); }
-		
-		// split element in segments and parse them		
-		String sysName;
-		String userName;
-        int state = 0;
-		int segmentStartPosition = 0;
+void WiThrottleProtocol::logListSegments(const char *segment[], int segmentLen[]) {
+	if (WIT_LOG_AT(1)) {
 		for(int j = 0; j < 3; j++) {
-		
-			// get segment
-			int segmentSeparatorPosition = entry.indexOf(SEGMENT_SEPARATOR, segmentStartPosition);
-			String segment = entry.substring(segmentStartPosition, segmentSeparatorPosition);
-			if (logLevel>0) { console->print("WiT:: "); console->print(rosterSegmentDesc[j]); console->print(": "); console->println(segment); }
-			segmentStartPosition = segmentSeparatorPosition + 3;
-			
-			// parse the segments
-			if(j == 0) sysName = segment;
-			else if(j == 1) userName = segment;
-			else if(j == 2) state = segment.toInt();
+			console->print("WiT:: "); console->print(rosterSegmentDesc[j]); console->print(": "); console->write(segment[j], segmentLen[j]); console->println("");
 		}
-		
-		// if set, call the delegate method
-		if(delegate) delegate->receivedRouteEntry(entries, sysName, userName, state);
-		
-		entryStartPosition = entrySeparatorPosition + 3;
-        if (logLevel>0) {
-            console->print("WiT:: "); console->println(entryStartPosition);
-            console->print("WiT:: "); console->println(s.length());
-        }
-        if (entryStartPosition >= s.length()) entryFound = false;
 	}
-
-	// get the number of entries
-	if (logLevel>0) { console->print("WiT:: Entries in Turnouts List: "); console->println(entries+1); }
-	// if set, call the delegate method
-	if (delegate) delegate->receivedRouteEntries(entries+1);	
-
-    if (logLevel>1) console->println("WiT:: processRouteList(): end");
 }
 
-// supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.
+// the throttles are '0'-'9', then 'A'-'Z' (without 'T') and 'a'-'z', up to MAX_WIT_THROTTLES.
+// 'T', the throttle of the non multiThrottle methods, is the same as '0'
+static const char multiThrottleIds[] = "0123456789ABCDEFGHIJKLMNOPQRSUVWXYZabcdefghijklmnopqrstuvwxyz";
+
 int WiThrottleProtocol::getMultiThrottleIndex(char multiThrottle) {
-    if (logLevel>1) { console->print("WiT:: getMultiThrottleIndex(): "); console->println(multiThrottle); }
-    int mThrottle = multiThrottle - '0';
+    if (WIT_LOG_AT(5)) { console->print("WiT:: getMultiThrottleIndex(): "); console->println(multiThrottle); }
 
+    int index;
+    if (multiThrottle >= '0' && multiThrottle <= '9') index = multiThrottle - '0';
+    else if (multiThrottle == DEFAULT_MULTITHROTTLE) index = 0;
+    else if (multiThrottle >= 'A' && multiThrottle < 'T') index = 10 + (multiThrottle - 'A');
+    else if (multiThrottle > 'T' && multiThrottle <= 'Z') index = 9 + (multiThrottle - 'A');
+    else if (multiThrottle >= 'a' && multiThrottle <= 'z') index = 35 + (multiThrottle - 'a');
+    else return -1;
 
-    if ((mThrottle >= 0) && (mThrottle<=5)) {
-        return mThrottle;
-    } else {
-        return 0;
+    return (index < MAX_WIT_THROTTLES) ? index : -1;
+}
+
+char WiThrottleProtocol::getMultiThrottleId(int index) {
+    return (index >= 0 && index < MAX_WIT_THROTTLES) ? multiThrottleIds[index] : 0;
+}
+
+// position of a loco in a throttle's consist, or -1
+int WiThrottleProtocol::findConsistLoco(const ThrottleState &throttle, int packed) {
+    for (int i = 0; i < throttle.consistSize; i++) {
+        if (throttle.consist[i] == packed) return i;
     }
+    return -1;
+}
+
+void WiThrottleProtocol::removeConsistLoco(ThrottleState &throttle, int index) {
+    for (int i = index; i < throttle.consistSize - 1; i++) throttle.consist[i] = throttle.consist[i+1];
+    uint32_t below = throttle.reversed & ((1UL << index) - 1);
+    throttle.reversed = below | ((throttle.reversed >> (index+1)) << index);
+    throttle.consistSize--;
 }
 
+String WiThrottleProtocol::addressToString(uint16_t packed) {
+    char buffer[8];
+    formatAddress(packed, buffer);
+    return String(buffer);
+}
+
+#if WIT_PARSE_LOCOS
 // the string passed in will look 'F03' (meaning turn off Function 3) or
 // 'F112' (turn on function 12)
-void WiThrottleProtocol::processFunctionState(char multiThrottle, const String& functionData) {
-    if (logLevel>1) { console->print("WiT:: processFunctionState(): "); console->println(multiThrottle); }
+void WiThrottleProtocol::processFunctionState(char multiThrottle, const char *functionData, int len) {
+    if (WIT_LOG_AT(2)) { console->print("WiT:: processFunctionState(): "); console->println(multiThrottle); }
 
     // F[0|1]nn - where nn is 0-31
-    if (delegate && functionData.length() >= 3) {
+    if (delegate && len >= 3) {
         bool state = functionData[1]=='1' ? true : false;
 
-        String funcNumStr = functionData.substring(2);
-        uint8_t funcNum = funcNumStr.toInt();
-
-        if (funcNum == 0 && funcNumStr != "0") {
+        if (!viewIsNumber(functionData+2, len-2)) {
             // error in parsing
         }
         else {
-            if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-                delegate->receivedFunctionState(funcNum, state);
-            } else {
-                delegate->receivedFunctionStateMultiThrottle(multiThrottle,funcNum, state);
-            }
+            uint8_t funcNum = viewToInt(functionData+2, len-2);
+            delegate->onFunctionState(multiThrottle, funcNum, state);
         }
     }
-    if (logLevel>1)  console->println("WiT:: processFunctionState(): end");
+    if (WIT_LOG_AT(2))  console->println("WiT:: processFunctionState(): end");
 }
 
 
 // the string passed in will look ']\[Headlight]\[Bell]\[Whistle]\[Short Whistle]\[Steam Release]\[FX5 Light]\[FX6 Light]\[Dimmer]\[Mute]\[Water Stop]\[Injectors]\[Brake Squeal]\[Coupler]\[]\[]\[]\[]\[]\[]\[]\[]\[]\[]\[]\[]\[]\[]\[]\['
-void WiThrottleProtocol::processRosterFunctionListEntries(char multiThrottle, const String& s) {
-    if (logLevel>0) { console->print("WiT:: processRosterFunctionListEntries(): "); console->println(multiThrottle); }
+void WiThrottleProtocol::processRosterFunctionListEntries(char multiThrottle, const char *s, int len) {
+    if (WIT_LOG_AT(1)) { console->print("WiT:: processRosterFunctionListEntries(): "); console->println(multiThrottle); }
 
-    String functions[MAX_FUNCTIONS];
+    WiThrottleStringView functions[MAX_FUNCTIONS];
 
     // loop
-    int entries = -1;
-    boolean entryFound = true;
+    int entries = 0;
 	int entryStartPosition = 3; //ignore the first entry separator
-    if (s.length() <= 3) entryFound =false;
-
-    while ((entryFound) && (entries < MAX_FUNCTIONS)) {
-	    entries++;
 
+    while ((entryStartPosition <= len) && (entries < MAX_FUNCTIONS)) {
 		// get element
-		int entrySeparatorPosition = s.indexOf(ENTRY_SEPARATOR, entryStartPosition);
-        if (entrySeparatorPosition == -1) entrySeparatorPosition = s.length();
-		String entry = s.substring(entryStartPosition, entrySeparatorPosition);
-        functions[entries] = entry;
-		if (logLevel>1) { console->print("WiT:: Function Entry: "); console->print(entries); console->print(" - "); console->println(entry); }
-        
+		int entrySeparatorPosition = viewIndexOf(s, len, ENTRY_SEPARATOR, entryStartPosition);
+        if (entrySeparatorPosition == -1) entrySeparatorPosition = len;
+        functions[entries] = {s + entryStartPosition, entrySeparatorPosition - entryStartPosition};
+		if (WIT_LOG_AT(2)) { console->print("WiT:: Function Entry: "); console->print(entries); console->print(" - "); console->write(functions[entries].data, functions[entries].length); console->println(); }
+
+        entries++;
         entryStartPosition = entrySeparatorPosition + 3;
     }
 
-    if (logLevel>0) { console->print("WiT:: Functions for roster entry: "); console->println(entries); }
-
-    for(int i = entries+1; i < MAX_FUNCTIONS; i++) {
-        functions[i] = "";
-    } 
+    if (WIT_LOG_AT(1)) { console->print("WiT:: Functions for roster entry: "); console->println(entries); }
 
-    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-        delegate->receivedRosterFunctionList(functions);
-    } else {
-        delegate->receivedRosterFunctionListMultiThrottle(multiThrottle, functions);
-    }
+    if (delegate) delegate->onFunctionLabels(multiThrottle, functions, entries);
 
-    if (logLevel>1) console->println("WiT:: processRosterFunctionListEntries(): end");
+    if (WIT_LOG_AT(2)) console->println("WiT:: processRosterFunctionListEntries(): end");
 }
 
 
-void WiThrottleProtocol::processSpeed(char multiThrottle, const String& speedData) {
-    if (logLevel>0) { console->print("WiT:: processSpeed(): "); console->println(multiThrottle); }
+void WiThrottleProtocol::processSpeed(char multiThrottle, const char *speedData, int len) {
+    if (WIT_LOG_AT(1)) { console->print("WiT:: processSpeed(): "); console->println(multiThrottle); }
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
 
-    if (delegate && speedData.length() >= 2) {
-        String speedStr = speedData.substring(1);
-        int speed = speedStr.toInt();
+    if (delegate && len >= 2) {
+        int speed = viewToInt(speedData+1, len-1);
 
         if (speed < MIN_SPEED) {
             speed = 0;
@@ -908,111 +1560,87 @@ void WiThrottleProtocol::processSpeed(char multiThrottle, const String& speedDat
             speed = MAX_SPEED;
         }
 
-        currentSpeed[multiThrottleIndex] = speed;
-        if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-            currentSpeed[multiThrottleIndex] = speed;
-            delegate->receivedSpeed(speed);
-        } else {
-            delegate->receivedSpeedMultiThrottle(multiThrottle, speed);
-        }
+        throttles[multiThrottleIndex].speed = speed;
+        delegate->onSpeed(multiThrottle, speed);
     }
 
-    if (logLevel>1)  console->println("WiT:: processSpeed(): end");
+    if (WIT_LOG_AT(2))  console->println("WiT:: processSpeed(): end");
 }
 
 
-void WiThrottleProtocol::processSpeedSteps(char multiThrottle, const String& speedStepData) {
-    if (logLevel>0) { console->print("WiT:: processSpeedSteps(): "); console->print(multiThrottle); console->print(" : "); console->println(speedStepData); }
+void WiThrottleProtocol::processSpeedSteps(char multiThrottle, const char *speedStepData, int len) {
+    if (WIT_LOG_AT(1)) { console->print("WiT:: processSpeedSteps(): "); console->print(multiThrottle); console->printf(" : %.*s\n", len, speedStepData); }
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
 
-    if (delegate && speedStepData.length() >= 2) {
-        String speedStepStr = speedStepData.substring(1);
-        int steps = speedStepStr.toInt();
+    if (delegate && len >= 2) {
+        int steps = viewToInt(speedStepData+1, len-1);
 
         // 1 = 128step, 2 = 28step, 4 = 27step or 8 = 14step
         if (steps != 1 && steps != 2 && steps != 4 && steps != 8) {
             // error, not one of the known values
         }
         else {
-            if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-                delegate->receivedSpeedSteps(steps);
-                speedSteps[0] = steps;
-            } else {
-                delegate->receivedSpeedStepsMultiThrottle(multiThrottle, steps);
-                speedSteps[multiThrottleIndex] = steps;
-            }
+            throttles[multiThrottleIndex].speedSteps = steps;
+            delegate->onSpeedSteps(multiThrottle, steps);
         }
     }
 
-    if (logLevel>1) console->println("WiT:: processSpeedSteps(): end");
+    if (WIT_LOG_AT(2)) console->println("WiT:: processSpeedSteps(): end");
 }
 
 
-void WiThrottleProtocol::processDirection(char multiThrottle, const String& directionStr) {
-    if (logLevel>0) {  }
-
+void WiThrottleProtocol::processDirection(char multiThrottle, const char *directionStr, int len) {
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    if (logLevel>0) {
+    if (WIT_LOG_AT(1)) {
         console->print("WiT:: processDirection(): throttle: "); console->println(multiThrottle);
-        console->print("  DIRECTION STRING: "); console->println(directionStr);
-        console->print("  LENGTH: "); console->println(directionStr.length());
+        console->printf("  DIRECTION STRING: %.*s\n", len, directionStr);
+        console->print("  LENGTH: "); console->println(len);
     }
 
     // R[0|1]
-    if (delegate && directionStr.length() == 2) {
-        if (directionStr.charAt(1) == '0') {
-            currentDirection[multiThrottleIndex] = Reverse;
-        }
-        else {
-            currentDirection[multiThrottleIndex] = Forward;
-        }
+    if (delegate && len == 2) {
+        Direction direction = (directionStr[1] == '0') ? Reverse : Forward;
+        throttles[multiThrottleIndex].direction = direction;
 
-        if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-            delegate->receivedDirection(currentDirection[multiThrottleIndex]);
-        } else {
-            delegate->receivedDirectionMultiThrottle(multiThrottle, currentDirection[multiThrottleIndex]);
-        }
+        delegate->onDirection(multiThrottle, direction);
     }
 
-    if (logLevel>1) console->println("WiT:: processDirection(): end"); 
+    if (WIT_LOG_AT(2)) console->println("WiT:: processDirection(): end"); 
 }
 
 // should only ever be called for the non-lead locos
-void WiThrottleProtocol::processDirection(char multiThrottle, String& address, const String& directionStr) {
+void WiThrottleProtocol::processDirection(char multiThrottle, const char *address, int addressLen, const char *directionStr, int len) {
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
     Direction direction = Forward;
-    if (directionStr.charAt(1) == '0') direction = Reverse;
+    if (len > 1 && directionStr[1] == '0') direction = Reverse;
 
-    if (logLevel>0) {
+    if (WIT_LOG_AT(1)) {
         console->print("WiT:: processDirection(): (facing) throttle: "); console->println(multiThrottle);
-        console->print("  Address: "); console->println(address); ; 
-        console->print("  DIRECTION STRING: "); console->println(directionStr); 
-        console->print(" LENGTH: "); console->println(directionStr.length());
+        console->printf("  Address: %.*s\n", addressLen, address);
+        console->printf("  DIRECTION STRING: %.*s\n", len, directionStr);
+        console->print(" LENGTH: "); console->println(len);
     }
 
     // R[0|1]
-    if (delegate && directionStr.length() == 2) {
-        for(int i=0;i<locomotives[multiThrottleIndex].size();i++) {
-            if (locomotives[multiThrottleIndex][i].equals(address)) {
-                locomotivesFacing[multiThrottleIndex][i] = direction;
-
-                if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-                    delegate->receivedDirection(address, direction);
-                } else {
-                    delegate->receivedDirectionMultiThrottle(multiThrottle, address, direction);
-                }
-                break;
-            }
+    if (delegate && len == 2) {
+        ThrottleState &throttle = throttles[multiThrottleIndex];
+        int i = findConsistLoco(throttle, packAddress(address, addressLen));
+        if (i >= 0) {
+            if (direction == Reverse) throttle.reversed |= (1UL << i);
+            else throttle.reversed &= ~(1UL << i);
+
+            delegate->onLocoDirection(multiThrottle, throttle.consist[i], direction);
         }
     }
 
-    if (logLevel>1) console->println("WiT:: processDirection(): end"); 
+    if (WIT_LOG_AT(2)) console->println("WiT:: processDirection(): end"); 
 }
+#endif // WIT_PARSE_LOCOS
 
 
 
 void WiThrottleProtocol::processTrackPower(char *c, int len) {
-    if (logLevel>0) console->println("WiT:: processTrackPower()");
+    if (WIT_LOG_AT(1)) console->println("WiT:: processTrackPower()");
 
     if (delegate) {
         if (len > 0) {
@@ -1024,141 +1652,133 @@ void WiThrottleProtocol::processTrackPower(char *c, int len) {
                 state = PowerOn;
             }
 
-            delegate->receivedTrackPower(state);
+            delegate->onTrackPower(state);
         }
     }
 }
 
 
+#if WIT_PARSE_LOCOS
 void WiThrottleProtocol::processAddRemove(char multiThrottle, char *c, int len) {
-    if (logLevel>0) { console->print("WiT:: processAddRemove(): "); console->println(multiThrottle); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: processAddRemove(): "); console->println(multiThrottle); }
 
     if (!delegate) {
         // If no one is listening, don't do the work to parse the string
         return;
     }
 
-    if (logLevel>0) console->printf("WiT:: processing add/remove command %s\n", c);
-
-    String s(c);
+    if (WIT_LOG_AT(1)) console->printf("WiT:: processing add/remove command %s\n", c);
 
     bool add = (c[0] == '+');
     bool remove = (c[0] == '-');
 
-    int p = s.indexOf(PROPERTY_SEPARATOR);
+    int p = viewIndexOf(c, len, PROPERTY_SEPARATOR);
     if (p > 0) {
-        String address = s.substring(1, p);
-        String entry   = s.substring(p+3);
-
-        address.trim();
-        entry.trim();
+        WiThrottleStringView address = viewTrim(c+1, p-1);
+        WiThrottleStringView entry   = viewTrim(c+p+3, len-p-3);
+        int packed = packAddress(address.data, address.length);
+        if (packed < 0) {
+            if (WIT_LOG_AT(1)) console->printf("WiT:: ignoring add/remove of invalid address %.*s\n", address.length, address.data);
+            return;
+        }
 
         if (add) {
-            if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-                delegate->addressAdded(address, entry);
-            } else {
-                delegate->addressAddedMultiThrottle(multiThrottle, address, entry);
-            }
+            delegate->onAddressAdded(multiThrottle, packed, entry);
         }
         if (remove) {
-            if (entry.equals("d\n") || entry.equals("r\n")) {
-                if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-                    delegate->addressRemoved(address, entry);
-                } else {
-                    delegate->addressRemovedMultiThrottle(multiThrottle, address, entry);
-                }
+            // the line terminator has already been removed by check()
+            if (entry.equals("d") || entry.equals("r")) {
+                delegate->onAddressRemoved(multiThrottle, packed, entry.data[0]);
             } else {
-                console->printf("WiT:: malformed address removal: command is %s\n", entry.c_str());
-                console->printf("entry length is %d\n", entry.length());
-                for (int i = 0; i < entry.length(); i++) {
-                    console->printf("  char at %d is %d\n", i, entry.charAt(i));
+                console->printf("WiT:: malformed address removal: command is %.*s\n", entry.length, entry.data);
+                console->printf("entry length is %d\n", entry.length);
+                for (int i = 0; i < entry.length; i++) {
+                    console->printf("  char at %d is %d\n", i, entry.data[i]);
                 }
             }
         }
     }
 
-    if (logLevel>1) console->println("WiT:: processAddRemove(): end"); 
+    if (WIT_LOG_AT(2)) console->println("WiT:: processAddRemove(): end"); 
 }
 
 void WiThrottleProtocol::processStealNeeded(char multiThrottle, char *c, int len) {
-    if (logLevel>0) { console->print("WiT:: processStealNeeded(): "); console->println(multiThrottle); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: processStealNeeded(): "); console->println(multiThrottle); }
 
     if (!delegate) {
         // If no one is listening, don't do the work to parse the string
         return;
     }
 
-    if (logLevel>1) console->printf("WiT:: processing steal needed command %s\n", c);
-
-    String s(c);
+    if (WIT_LOG_AT(2)) console->printf("WiT:: processing steal needed command %s\n", c);
 
-    int p = s.indexOf(PROPERTY_SEPARATOR);
+    int p = viewIndexOf(c, len, PROPERTY_SEPARATOR);
     if (p > 0) {
-        String address = s.substring(0, p);
-        String entry   = s.substring(p+3);
-
-        if (multiThrottle == DEFAULT_MULTITHROTTLE) {
-            delegate->addressStealNeeded(address, entry);
-        } else {
-            delegate->addressStealNeededMultiThrottle(multiThrottle, address, entry);
+        int packed = packAddress(c, p);
+        if (packed < 0) {
+            if (WIT_LOG_AT(1)) console->printf("WiT:: ignoring steal of invalid address %.*s\n", p, c);
+            return;
         }
+        delegate->onAddressStealNeeded(multiThrottle, packed, {c+p+3, len-p-3});
     }
 
-    if (logLevel>1) console->println("WiT:: processStealNeeded(): end");
+    if (WIT_LOG_AT(2)) console->println("WiT:: processStealNeeded(): end");
 }
+#endif // WIT_PARSE_LOCOS
 
+#if WIT_PARSE_TURNOUTS
+// PTA<state><system name>
 void WiThrottleProtocol::processTurnoutAction(char *c, int len) {
-    if (delegate) {
-        String s(c);
-        String systemName = s.substring(1,s.length()-1);
-        TurnoutState state = TurnoutUnknown;
-        if (c[0]=='2') {
-            state = TurnoutClosed;
-        }
-        else if (c[0]=='4') {
-            state = TurnoutThrown;
-        }
-        else if (c[0]=='1') {
-            state = TurnoutUnknown;
-        }
-        else if (c[0]=='8') {
-            state = TurnoutInconsistent;
-        }
-
-        delegate->receivedTurnoutAction(systemName, state);
+    TurnoutState state = TurnoutUnknown;
+    if (c[0]=='2') {
+        state = TurnoutClosed;
+    }
+    else if (c[0]=='4') {
+        state = TurnoutThrown;
     }
+    else if (c[0]=='1') {
+        state = TurnoutUnknown;
+    }
+    else if (c[0]=='8') {
+        state = TurnoutInconsistent;
+    }
+
+    if (layoutStore) layoutStore->setTurnoutState(c+1, len-1, state);
+    if (delegate) delegate->onTurnoutAction({c+1, len-1}, state);
 }
+#endif // WIT_PARSE_TURNOUTS
 
+#if WIT_PARSE_ROUTES
+// PRA<state><system name>
 void WiThrottleProtocol::processRouteAction(char *c, int len) {
-    if (delegate) {
-        String s(c);
-        String systemName = s.substring(1,s.length()-1);
-        RouteState state = RouteInconsistent;
-        if (c[0]=='2') {
-            state = RouteActive;
-        }
-        else if (c[0]=='4') {
-            state = RouteInactive;
-        }
-
-        delegate->receivedRouteAction(systemName, state);
+    RouteState state = RouteInconsistent;
+    if (c[0]=='2') {
+        state = RouteActive;
+    }
+    else if (c[0]=='4') {
+        state = RouteInactive;
     }
+
+    if (layoutStore) layoutStore->setRouteState(c+1, len-1, state);
+    if (delegate) delegate->onRouteAction({c+1, len-1}, state);
 }
+#endif // WIT_PARSE_ROUTES
 
 bool WiThrottleProtocol::checkHeartbeat() {
 
 	// if heartbeat is required and half of heartbeat period has passed, send a heartbeat and reset the timer
     if ((heartbeatPeriod > 0) && ((millis() - heartbeatTimer) > 0.5 * heartbeatPeriod * 1000)) {
-    	if (logLevel>0) console->println("WiT:: checkHeartbeat(): ");
+    	if (WIT_LOG_AT(1)) console->println("WiT:: checkHeartbeat(): ");
 
         if (!heartbeatEnabled) {
-            if (logLevel>1) console->println("WiT:: checkHeartbeat(): heartbeat not enabled");
+            if (WIT_LOG_AT(2)) console->println("WiT:: checkHeartbeat(): heartbeat not enabled");
             heartbeatTimer = millis();
             return true;
         }
 
-        sendDelayedCommand("*");
-        setDeviceName(currentDeviceName);  // resent the device name instead of the heartbeat.  this forces the wit server to respond
+        if (eventLog) eventLog->record(EventHeartbeat, heartbeatPeriod, millis()/1000 - lastServerResponseTime);
+        sendDelayedCommand("*", OutboundLaneHousekeeping);
+        sendDelayedCommand("N" + currentDeviceName, OutboundLaneHousekeeping);  // resent the device name instead of the heartbeat.  this forces the wit server to respond
 
         // // if there are any locos under control, resend all their speeds
         // if ( (timeLastLocoAcquired!=0) && ((millis() - timeLastLocoAcquired) > 5000) ) { // wait at least 5 seconds from the last time that a loco was aqcuired, to give the server time to send any existing speeds
@@ -1181,7 +1801,7 @@ bool WiThrottleProtocol::checkHeartbeat() {
 
 		heartbeatTimer = millis();
 		
-    	if (logLevel>1) console->println("WiT:: checkHeartbeat(): end: true");
+    	if (WIT_LOG_AT(2)) console->println("WiT:: checkHeartbeat(): end: true");
         return true;
     }
 
@@ -1202,8 +1822,7 @@ void WiThrottleProtocol::requireHeartbeat(bool needed) {
 
 void WiThrottleProtocol::processUnknownCommand(char *c, int len) {
     if (delegate && len > 0) {
-        String unknownCommand = String(c);
-        delegate->receivedUnknownCommand(unknownCommand);
+        delegate->onUnknownCommand({c, len});
     }
     heartbeatTimer = millis();
 }
@@ -1215,34 +1834,33 @@ bool WiThrottleProtocol::addLocomotive(String address) {
 }
 
 bool WiThrottleProtocol::addLocomotive(char multiThrottle, String address) {
-    if (logLevel>0) { console->print("WiT:: addLocomotive(): "); console->print(multiThrottle); console->print(" : "); console->println(address); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: addLocomotive(): "); console->print(multiThrottle); console->print(" : "); console->println(address); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
+    if (multiThrottleIndex < 0) return false;
+    ThrottleState &throttle = throttles[multiThrottleIndex];
+    int packed = packAddress(address.c_str(), address.length());
     bool ok = false;
 
-    if (address[0] == 'S' || address[0] == 'L') {
+    if (packed >= 0) {
+        bool locoAlreadyInList = (findConsistLoco(throttle, packed) >= 0);
+        if (!locoAlreadyInList && throttle.consistSize >= WIT_MAX_CONSIST) {
+            if (WIT_LOG_AT(1)) console->println("WiT:: addLocomotive(): consist is full (WIT_MAX_CONSIST)");
+            return false;
+        }
+
         String rosterName = address; 
         String cmd = "M" + String(multiThrottle) + "+" + address + PROPERTY_SEPARATOR + rosterName;
         sendDelayedCommand(cmd);
 
-        boolean locoAlreadyInList = false;
-        for(int i=0;i<locomotives[multiThrottleIndex].size();i++) {
-            if (locomotives[multiThrottleIndex][i].equals(address)) {
-                locoAlreadyInList = true;
-                break;
-            }
-        } 
         if (!locoAlreadyInList) {
-            locomotives[multiThrottleIndex].push_back(address);
-            currentAddress[multiThrottleIndex] = locomotives[multiThrottleIndex].front();
-            locomotivesFacing[multiThrottleIndex].push_back(Forward);
-            locomotiveSelected[multiThrottleIndex] = true;
+            throttle.consist[throttle.consistSize++] = packed;  // facing forward
             timeLastLocoAcquired = millis();
         }
         ok = true;
     }
 
-    if (logLevel>1) { console->print("WiT:: addLocomotive(): end : ");  console->println(ok); }
+    if (WIT_LOG_AT(2)) { console->print("WiT:: addLocomotive(): end : ");  console->println(ok); }
     return ok;
 }
 
@@ -1253,7 +1871,9 @@ bool WiThrottleProtocol::stealLocomotive(String address) {
 }
 
 bool WiThrottleProtocol::stealLocomotive(char multiThrottle, String address) {
-    if (logLevel>0) { console->print("WiT:: stealLocomotive(): "); console->print(multiThrottle); console->print(" : "); console->println(address); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: stealLocomotive(): "); console->print(multiThrottle); console->print(" : "); console->println(address); }
+
+    if (getMultiThrottleIndex(multiThrottle) < 0) return false;
 
     bool ok = true;
     // MTSxxxx<;>xxxxx
@@ -1270,9 +1890,11 @@ bool WiThrottleProtocol::releaseLocomotive(String address) {
 }
 
 bool WiThrottleProtocol::releaseLocomotive(char multiThrottle, String address) {
-    if (logLevel>0) { console->print("WiT:: releaseLocomotive(): "); console->print(multiThrottle); console->print(" : "); console->println(address); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: releaseLocomotive(): "); console->print(multiThrottle); console->print(" : "); console->println(address); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
+    if (multiThrottleIndex < 0) return false;
+    ThrottleState &throttle = throttles[multiThrottleIndex];
     // MT-*<;>r
     String cmd = "M" + String(multiThrottle) + "-";
     cmd.concat(address);
@@ -1281,26 +1903,14 @@ bool WiThrottleProtocol::releaseLocomotive(char multiThrottle, String address) {
     sendDelayedCommand(cmd);
 
     if (address.equals(ALL_LOCOS_ON_THROTTLE)) {
-            locomotives[multiThrottleIndex].clear();
-            locomotivesFacing[multiThrottleIndex].clear();
+        throttle.consistSize = 0;
+        throttle.reversed = 0;
     } else {
-        for(int i=0;i<locomotives[multiThrottleIndex].size();i++) {
-            if (locomotives[multiThrottleIndex][i].equals(address)) {
-                locomotives[multiThrottleIndex].erase(locomotives[multiThrottleIndex].begin()+i);
-                locomotivesFacing[multiThrottleIndex].erase(locomotivesFacing[multiThrottleIndex].begin()+i);
-                break;
-            }
-        } 
-    }
-    
-    if (locomotives[multiThrottleIndex].size()==0) { 
-        locomotiveSelected[multiThrottleIndex] = false;
-        currentAddress[multiThrottleIndex] = "";
-    } else {        
-        currentAddress[multiThrottleIndex] = locomotives[multiThrottleIndex].front();
+        int i = findConsistLoco(throttle, packAddress(address.c_str(), address.length()));
+        if (i >= 0) removeConsistLoco(throttle, i);
     }
 
-    if (logLevel>1) console->println("WiT:: releaseLocomotive(): end"); 
+    if (WIT_LOG_AT(2)) console->println("WiT:: releaseLocomotive(): end"); 
     return true;
 }
 
@@ -1311,11 +1921,13 @@ String WiThrottleProtocol::getLeadLocomotive() {
 }
 
 String WiThrottleProtocol::getLeadLocomotive(char multiThrottle) {
-    if (logLevel>0) { console->print("WiT:: getLeadLocomotive(): "); console->println(multiThrottle); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: getLeadLocomotive(): "); console->println(multiThrottle); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    if (locomotives[multiThrottleIndex].size()>0) { 
-        return locomotives[multiThrottleIndex].front();
+    if (multiThrottleIndex < 0) return {};
+    const ThrottleState &throttle = throttles[multiThrottleIndex];
+    if (throttle.consistSize>0) { 
+        return addressToString(throttle.consist[0]);
     }
     return {};
 }
@@ -1327,13 +1939,16 @@ String WiThrottleProtocol::getLocomotiveAtPosition(int position) {
 }
 
 String WiThrottleProtocol::getLocomotiveAtPosition(char multiThrottle, int position) {
-    if (logLevel>1) { console->print("WiT:: getLocomotiveAtPosition(): "); console->print(multiThrottle); console->print(" : "); console->println(position); }
+    if (WIT_LOG_AT(2)) { console->print("WiT:: getLocomotiveAtPosition(): "); console->print(multiThrottle); console->print(" : "); console->println(position); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    if (logLevel>1) { console->print("WiT:: getLocomotiveAtPosition(): vector size: "); console->println(locomotives[multiThrottleIndex].size()); }
-    if (locomotives[multiThrottleIndex].size()>0) { 
-        if (logLevel>1) { console->print("WiT:: getLocomotiveAtPosition(): return: "); console->println(locomotives[multiThrottleIndex][position]); }
-        return locomotives[multiThrottleIndex][position];
+    if (multiThrottleIndex < 0) return {};
+    const ThrottleState &throttle = throttles[multiThrottleIndex];
+    if (WIT_LOG_AT(2)) { console->print("WiT:: getLocomotiveAtPosition(): consist size: "); console->println(throttle.consistSize); }
+    if (position >= 0 && position < throttle.consistSize) { 
+        String address = addressToString(throttle.consist[position]);
+        if (WIT_LOG_AT(2)) { console->print("WiT:: getLocomotiveAtPosition(): return: "); console->println(address); }
+        return address;
     }
     return {};
 }
@@ -1345,12 +1960,12 @@ int WiThrottleProtocol::getNumberOfLocomotives() {
 }
 
 int WiThrottleProtocol::getNumberOfLocomotives(char multiThrottle) {
-    if (logLevel>1) { console->print("WiT:: getNumberOfLocomotives(): "); console->println(multiThrottle); }
+    if (WIT_LOG_AT(2)) { console->print("WiT:: getNumberOfLocomotives(): "); console->println(multiThrottle); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-
-    int size = locomotives[multiThrottleIndex].size();
-    if (logLevel>1) { console->print("WiT:: getNumberOfLocomotives(): end "); console->println(size); }
+    if (multiThrottleIndex < 0) return 0;
+    int size = throttles[multiThrottleIndex].consistSize;
+    if (WIT_LOG_AT(2)) { console->print("WiT:: getNumberOfLocomotives(): end "); console->println(size); }
     return size;
 }
 
@@ -1361,10 +1976,11 @@ int WiThrottleProtocol::getSpeedSteps() {
 }
 
 int WiThrottleProtocol::getSpeedSteps(char multiThrottle) {
-    if (logLevel>0) { console->print("WiT:: getSpeedSteps(): "); console->println(multiThrottle); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: getSpeedSteps(): "); console->println(multiThrottle); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    return speedSteps[multiThrottleIndex];
+    if (multiThrottleIndex < 0) return 0;
+    return throttles[multiThrottleIndex].speedSteps;
 }
 
 // ******************************************************************************************************
@@ -1374,9 +1990,10 @@ bool WiThrottleProtocol::setSpeedSteps(int steps) {
 }
 
 bool WiThrottleProtocol::setSpeedSteps(char multiThrottle, int steps) {
-    if (logLevel>0) { console->print("WiT:: setSpeedSteps(): "); console->print(multiThrottle); console->print(" : "); console->println(steps); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: setSpeedSteps(): "); console->print(multiThrottle); console->print(" : "); console->println(steps); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
+    if (multiThrottleIndex < 0) return false;
 
     // 1 = 128step, 2 = 28step, 4 = 27step or 8 = 14step
     if (steps != 1 && steps != 2 && steps != 4 && steps != 8) {
@@ -1389,7 +2006,7 @@ bool WiThrottleProtocol::setSpeedSteps(char multiThrottle, int steps) {
         + "s"
         + String(steps);
     sendDelayedCommand(cmd);
-    speedSteps[multiThrottleIndex] = steps;
+    throttles[multiThrottleIndex].speedSteps = steps;
 
     return true;
 }
@@ -1406,23 +2023,25 @@ bool WiThrottleProtocol::setSpeed(char multiThrottle, int speed) {
 }
 
 bool WiThrottleProtocol::setSpeed(char multiThrottle, int speed, bool forceSend) {
-    if (logLevel>0) { console->print("WiT:: setSpeed(): "); console->print(multiThrottle); console->print(" : "); console->print(speed); console->print(" : "); console->println(forceSend); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: setSpeed(): "); console->print(multiThrottle); console->print(" : "); console->print(speed); console->print(" : "); console->println(forceSend); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
+    if (multiThrottleIndex < 0) return false;
+    ThrottleState &throttle = throttles[multiThrottleIndex];
     if (speed < 0 || speed > 126) {
         return false;
     }
-    if (!locomotiveSelected[multiThrottleIndex]) {
+    if (throttle.consistSize == 0) {
         return false;
     }
 
-    if ( (speed != currentSpeed[multiThrottleIndex]) || (forceSend) ) {
+    if ( (speed != throttle.speed) || (forceSend) ) {
         String cmd = "M" + String(multiThrottle) + "A*" 
             + PROPERTY_SEPARATOR
             + "V"
             + String(speed);
         sendDelayedCommand(cmd);
-        currentSpeed[multiThrottleIndex] = speed;
+        throttle.speed = speed;
     }
     return true;
 }
@@ -1434,10 +2053,11 @@ int WiThrottleProtocol::getSpeed() {
 }
 
 int WiThrottleProtocol::getSpeed(char multiThrottle) {
-    if (logLevel>0) { console->print("WiT:: getSpeed(): "); console->println(multiThrottle); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: getSpeed(): "); console->println(multiThrottle); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    return currentSpeed[multiThrottleIndex];
+    if (multiThrottleIndex < 0) return 0;
+    return throttles[multiThrottleIndex].speed;
 }
 
 // ******************************************************************************************************
@@ -1459,25 +2079,22 @@ bool WiThrottleProtocol::setDirection(char multiThrottle, String address, Direct
 }
 
 bool WiThrottleProtocol::setDirection(char multiThrottle, String address, Direction direction, bool forceSend) {
-    if (logLevel>0) { console->print("WiT:: setDirection(): address: "); console->print(address); console->print(" throttle: "); 
+    if (WIT_LOG_AT(1)) { console->print("WiT:: setDirection(): address: "); console->print(address); console->print(" throttle: "); 
     console->print(multiThrottle); console->print(" direction: "); console->println(direction); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    if (!locomotiveSelected[multiThrottleIndex]) {
+    if (multiThrottleIndex < 0) return false;
+    ThrottleState &throttle = throttles[multiThrottleIndex];
+    if (throttle.consistSize == 0) {
         return false;
     }
 
     String directionString = (direction == Reverse) ? "0" : "1";
-    Direction currentDir = currentDirection[multiThrottleIndex];
+    Direction currentDir = throttle.direction;
     int locoIndex = -1;
     if (!address.equals(ALL_LOCOS_ON_THROTTLE)) {
-        for(int i=0;i<locomotives[multiThrottleIndex].size();i++) {
-            if (locomotives[multiThrottleIndex][i].equals(address)) {
-                locoIndex = i;
-                currentDir = locomotivesFacing[multiThrottleIndex][i];
-                break;
-            }
-        }
+        locoIndex = findConsistLoco(throttle, packAddress(address.c_str(), address.length()));
+        if (locoIndex >= 0) currentDir = (throttle.reversed & (1UL << locoIndex)) ? Reverse : Forward;
     }
 
     if ( (direction != currentDir) || (forceSend) ) {
@@ -1485,9 +2102,11 @@ bool WiThrottleProtocol::setDirection(char multiThrottle, String address, Direct
         sendDelayedCommand(cmd);
 
         if (locoIndex == -1) { // all locos
-            currentDirection[multiThrottleIndex] = direction;
+            throttle.direction = direction;
+        } else if (direction == Reverse) {
+            throttle.reversed |= (1UL << locoIndex);
         } else {
-            locomotivesFacing[multiThrottleIndex][locoIndex] = direction;
+            throttle.reversed &= ~(1UL << locoIndex);
         }
     }
     return true;
@@ -1504,22 +2123,20 @@ Direction WiThrottleProtocol::getDirection(char multiThrottle) {
 }
 
 Direction WiThrottleProtocol::getDirection(char multiThrottle, String address) {
-    if (logLevel>0) { console->print("WiT:: getDirection(): addr: "); console->print(address); console->print(" throttle: "); console->println(multiThrottle); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: getDirection(): addr: "); console->print(address); console->print(" throttle: "); console->println(multiThrottle); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
+    if (multiThrottleIndex < 0) return Forward;
+    const ThrottleState &throttle = throttles[multiThrottleIndex];
 
     if (address.equals(ALL_LOCOS_ON_THROTTLE)) {
-        if (logLevel>0) { console->print("WiT:: getDirection(): all dir: "); console->println(currentDirection[multiThrottleIndex]); }
-        return currentDirection[multiThrottleIndex];
+        if (WIT_LOG_AT(1)) { console->print("WiT:: getDirection(): all dir: "); console->println(throttle.direction); }
+        return throttle.direction;
     } else {
-        Direction individualDirection = currentDirection[multiThrottleIndex];
-        for(int i=0;i<locomotives[multiThrottleIndex].size();i++) {
-            if (locomotives[multiThrottleIndex][i].equals(address)) {
-                individualDirection = locomotivesFacing[multiThrottleIndex][i];
-                break;
-            }
-        }
-        if (logLevel>0) { console->print("WiT:: getDirection(): individual dir: "); console->println(individualDirection); }
+        Direction individualDirection = throttle.direction;
+        int i = findConsistLoco(throttle, packAddress(address.c_str(), address.length()));
+        if (i >= 0) individualDirection = (throttle.reversed & (1UL << i)) ? Reverse : Forward;
+        if (WIT_LOG_AT(1)) { console->print("WiT:: getDirection(): individual dir: "); console->println(individualDirection); }
         return individualDirection;
     }
 }
@@ -1534,20 +2151,30 @@ void WiThrottleProtocol::emergencyStop(char multiThrottle) {
 }
 
 void WiThrottleProtocol::emergencyStop(char multiThrottle, String address) {
-    if (logLevel>0) { console->print("WiT:: emergencyStop(): "); console->print(multiThrottle);console->print(" address: "); console->print(address);  }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: emergencyStop(): "); console->print(multiThrottle);console->print(" address: "); console->print(address);  }
+    if (eventLog) eventLog->record(EventEmergencyStop, multiThrottle, 0, address.c_str(), address.length());
 
     String cmd; cmd.reserve(10);
     char multiThrottleChar = multiThrottle;
 
+    // don't let the stop wait behind speeds that haven't been sent yet
+    purgeQueuedSpeedCommands(multiThrottleChar);
+
     if (multiThrottleChar!='*') { // single throttle
+        if (getMultiThrottleIndex(multiThrottle) < 0) return;
         setSpeed(multiThrottle,0);
         cmd = "M" + String(multiThrottle) + "A" + address + PROPERTY_SEPARATOR + "X";
         sendDelayedCommand(cmd);
-    } else { // all throttles
-        for (int i=0; i<MAX_WIT_THROTTLES; i++) {
-            multiThrottleChar = '0' + i;
-            cmd = "M" + String(multiThrottleChar) + "A" + address + PROPERTY_SEPARATOR + "X";
-            sendDelayedCommand(cmd);
+    } else { // every throttle, as the server may have locos on one that this session doesn't know about
+        // the throttles with locos go first. The others only while they don't push a stop out of a full queue
+        for (int pass = 0; pass < 2; pass++) {
+            for (int i=0; i<MAX_WIT_THROTTLES; i++) {
+                if ((throttles[i].consistSize > 0) != (pass == 0)) continue;
+                if ( (pass == 1) && (outboundLaneCount[OutboundLaneSafety] >= WIT_OUTBOUND_QUEUE_SIZE) ) break;
+                multiThrottleChar = getMultiThrottleId(i);
+                cmd = "M" + String(multiThrottleChar) + "A" + address + PROPERTY_SEPARATOR + "X";
+                sendDelayedCommand(cmd);
+            }
         }
     }
 }
@@ -1567,11 +2194,13 @@ void WiThrottleProtocol::setFunction(char multiThrottle, String address, int fun
 }
 
 void WiThrottleProtocol::setFunction(char multiThrottle, String address, int funcNum, bool pressed, bool force) {
-    if (logLevel>0) { console->print("WiT:: setFunction(): "); console->print(multiThrottle); console->print(" : "); console->println(funcNum); }
+    if (WIT_LOG_AT(1)) { console->print("WiT:: setFunction(): "); console->print(multiThrottle); console->print(" : "); console->println(funcNum); }
 
     int multiThrottleIndex = getMultiThrottleIndex(multiThrottle);
-    if (!locomotiveSelected[multiThrottleIndex]) {
-        if (logLevel>0) console->println("WiT:: setFunction(): end - not selected");
+    if (multiThrottleIndex < 0) return;
+    const ThrottleState &throttle = throttles[multiThrottleIndex];
+    if (throttle.consistSize == 0) {
+        if (WIT_LOG_AT(1)) console->println("WiT:: setFunction(): end - not selected");
         return;
     }
 
@@ -1581,7 +2210,7 @@ void WiThrottleProtocol::setFunction(char multiThrottle, String address, int fun
 
     String cmd = "M" + String(multiThrottle) + "A";
     if (address.equals("")) {
-        cmd.concat(currentAddress[multiThrottleIndex]);
+        cmd.concat(addressToString(throttle.consist[0]));
     } else {
         cmd.concat(address);
     }
@@ -1602,7 +2231,7 @@ void WiThrottleProtocol::setFunction(char multiThrottle, String address, int fun
     cmd += funcNum;
     sendDelayedCommand(cmd);
 
-    if (logLevel>1) console->println("WiT:: setFunction(): end"); 
+    if (WIT_LOG_AT(2)) console->println("WiT:: setFunction(): end"); 
 }
 
 // ******************************************************************************************************
@@ -1640,3 +2269,167 @@ long WiThrottleProtocol::getLastServerResponseTime() {
   return lastServerResponseTime;   
 }
 
+
+// ******************************************************************************************************
+// WiThrottleStringView and WiThrottleProtocolDelegate
+
+String WiThrottleStringView::toString() const {
+    return viewToString(data, length);
+}
+
+static String addressString(uint16_t address) {
+    char buffer[8];
+    WiThrottleProtocol::formatAddress(address, buffer);
+    return String(buffer);
+}
+
+void WiThrottleProtocolDelegate::onVersion(WiThrottleStringView version) {
+    receivedVersion(version.toString());
+}
+
+void WiThrottleProtocolDelegate::onServerType(WiThrottleStringView type) {
+    receivedServerType(type.toString());
+}
+
+void WiThrottleProtocolDelegate::onServerDescription(WiThrottleStringView description) {
+    receivedServerDescription(description.toString());
+}
+
+void WiThrottleProtocolDelegate::onMessage(WiThrottleStringView message) {
+    receivedMessage(message.toString());
+}
+
+void WiThrottleProtocolDelegate::onAlert(WiThrottleStringView alert) {
+    receivedAlert(alert.toString());
+}
+
+void WiThrottleProtocolDelegate::onRosterEntries(int rosterSize) {
+    receivedRosterEntries(rosterSize);
+}
+
+void WiThrottleProtocolDelegate::onRosterEntry(int index, WiThrottleStringView name, uint16_t address) {
+    receivedRosterEntry(index, name.toString(), address & WIT_ADDRESS_MASK, (address & WIT_LONG_ADDRESS) ? 'L' : 'S');
+}
+
+void WiThrottleProtocolDelegate::onTurnoutEntries(int turnoutListSize) {
+    receivedTurnoutEntries(turnoutListSize);
+}
+
+void WiThrottleProtocolDelegate::onTurnoutEntry(int index, WiThrottleStringView sysName, WiThrottleStringView userName, int state) {
+    receivedTurnoutEntry(index, sysName.toString(), userName.toString(), state);
+}
+
+void WiThrottleProtocolDelegate::onRouteEntries(int routeListSize) {
+    receivedRouteEntries(routeListSize);
+}
+
+void WiThrottleProtocolDelegate::onRouteEntry(int index, WiThrottleStringView sysName, WiThrottleStringView userName, int state) {
+    receivedRouteEntry(index, sysName.toString(), userName.toString(), state);
+}
+
+void WiThrottleProtocolDelegate::onFastTime(uint32_t time) {
+    fastTimeChanged(time);
+}
+
+void WiThrottleProtocolDelegate::onFastTimeRate(double rate) {
+    fastTimeRateChanged(rate);
+}
+
+void WiThrottleProtocolDelegate::onHeartbeatConfig(int seconds) {
+    heartbeatConfig(seconds);
+}
+
+void WiThrottleProtocolDelegate::onFunctionState(char multiThrottle, uint8_t func, bool state) {
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        receivedFunctionState(func, state);
+    } else {
+        receivedFunctionStateMultiThrottle(multiThrottle, func, state);
+    }
+}
+
+void WiThrottleProtocolDelegate::onFunctionLabels(char multiThrottle, const WiThrottleStringView *labels, int count) {
+    String functions[MAX_FUNCTIONS];
+    for (int i = 0; i < count && i < MAX_FUNCTIONS; i++) functions[i] = labels[i].toString();
+
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        receivedRosterFunctionList(functions);
+    } else {
+        receivedRosterFunctionListMultiThrottle(multiThrottle, functions);
+    }
+}
+
+void WiThrottleProtocolDelegate::onSpeed(char multiThrottle, int speed) {
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        receivedSpeed(speed);
+    } else {
+        receivedSpeedMultiThrottle(multiThrottle, speed);
+    }
+}
+
+void WiThrottleProtocolDelegate::onDirection(char multiThrottle, Direction dir) {
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        receivedDirection(dir);
+    } else {
+        receivedDirectionMultiThrottle(multiThrottle, dir);
+    }
+}
+
+void WiThrottleProtocolDelegate::onLocoDirection(char multiThrottle, uint16_t address, Direction dir) {
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        receivedDirection(addressString(address), dir);
+    } else {
+        receivedDirectionMultiThrottle(multiThrottle, addressString(address), dir);
+    }
+}
+
+void WiThrottleProtocolDelegate::onSpeedSteps(char multiThrottle, int steps) {
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        receivedSpeedSteps(steps);
+    } else {
+        receivedSpeedStepsMultiThrottle(multiThrottle, steps);
+    }
+}
+
+void WiThrottleProtocolDelegate::onWebPort(int port) {
+    receivedWebPort(port);
+}
+
+void WiThrottleProtocolDelegate::onTrackPower(TrackPower state) {
+    receivedTrackPower(state);
+}
+
+void WiThrottleProtocolDelegate::onAddressAdded(char multiThrottle, uint16_t address, WiThrottleStringView entry) {
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        addressAdded(addressString(address), entry.toString());
+    } else {
+        addressAddedMultiThrottle(multiThrottle, addressString(address), entry.toString());
+    }
+}
+
+void WiThrottleProtocolDelegate::onAddressRemoved(char multiThrottle, uint16_t address, char command) {
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        addressRemoved(addressString(address), String(command));
+    } else {
+        addressRemovedMultiThrottle(multiThrottle, addressString(address), String(command));
+    }
+}
+
+void WiThrottleProtocolDelegate::onAddressStealNeeded(char multiThrottle, uint16_t address, WiThrottleStringView entry) {
+    if (multiThrottle == DEFAULT_MULTITHROTTLE) {
+        addressStealNeeded(addressString(address), entry.toString());
+    } else {
+        addressStealNeededMultiThrottle(multiThrottle, addressString(address), entry.toString());
+    }
+}
+
+void WiThrottleProtocolDelegate::onTurnoutAction(WiThrottleStringView systemName, TurnoutState state) {
+    receivedTurnoutAction(systemName.toString(), state);
+}
+
+void WiThrottleProtocolDelegate::onRouteAction(WiThrottleStringView systemName, RouteState state) {
+    receivedRouteAction(systemName.toString(), state);
+}
+
+void WiThrottleProtocolDelegate::onUnknownCommand(WiThrottleStringView unknownCommand) {
+    receivedUnknownCommand(unknownCommand.toString());
+}
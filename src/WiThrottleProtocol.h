@@ -29,6 +29,31 @@
 /*
 Version information:
 
+1.1.28   - Inbound loco action (MxA V/R/F/s) parsing works on views of the input buffer, with no heap allocation
+         - check() reads the stream in chunks and frames commands with a single scan
+         - Add processInput() to feed data received by other means
+         - Outbound commands are queued in a fixed size ring (WIT_OUTBOUND_QUEUE_SIZE) instead of a String, with a choice of overflow policy
+         - Queued speed and direction commands for a loco are replaced by newer ones, and an emergency stop purges queued speeds
+         - Outbound commands are sent in priority order (safety, session, motion, functions, accessories, heartbeats) with per lane counters
+         - Roster, turnout and route lists are processed as each entry arrives, so the input buffer is now 1K (WIT_INPUT_BUFFER_SIZE) rather than 32K
+         - Roster, turnout and route entries are parsed in a single pass without creating intermediate Strings
+         - Optional WiThrottleLayoutStore (WiThrottleLayoutStore.h), keeping a local copy of the roster, turnout and route lists (setLayoutStore())
+         - Incoming commands are dispatched with switches on their first characters rather than a chain of comparisons
+         - WiThrottleConnectionManager (WiThrottleConnectionManager.h), driving sessions with several servers from one loop, and received byte/command counters
+         - Add getTimeUntilNextEvent(), so that hosts can sleep between events rather than calling check() continuously
+         - WiThrottleServer (WiThrottleServer.h), the server side of the protocol for many throttle clients
+         - WiThrottleServer serializes each broadcast once into a shared message, queued to each client and sent from check()
+         - Each throttle's state is kept in one struct, with its consist as packed addresses in a fixed size array (WIT_MAX_CONSIST). The public locomotives and locomotivesFacing vectors are removed (use getLocomotiveAtPosition() and getDirection()), and <vector> is no longer included
+         - MAX_WIT_THROTTLES can be set at compile time, with throttle ids '0'-'9', 'A'-'Z' and 'a'-'z'. Unknown throttle ids are rejected rather than treated as throttle 0
+         - WIT_MAX_LOG_LEVEL leaves the log messages above that level out of the build
+         - WiThrottleEventLog (WiThrottleEventLog.h) records commands and other events in a binary ring buffer (setEventLog()), for the WiThrottleLogDecode host tool
+         - WiThrottleProtocolDelegateV2 passes the received text as views and loco addresses packed, without copying. WiThrottleProtocolDelegate is built on it
+         - WIT_PARSE_ROSTER, WIT_PARSE_TURNOUTS, WIT_PARSE_ROUTES and WIT_PARSE_LOCOS leave the parsers of unneeded commands out of the build
+         - setMessageFamilies() discards the commands the sketch does not need before they are parsed
+         - The fast clock is worked out in integers from the last fast time received, so it no longer drifts. check() no longer always returns true
+         - setFastTimeGranularity() sets clockChanged only as the displayed fast time changes, and getTimeUntilNextEvent() gives the time until then. The delegate's onFastTime() and onFastTimeRate() are now called
+         - Fix for the last character of the system name being lost from turnout and route actions
+         - Fix for function label lists overrunning the labels array, and for loco removal (Mx-) not reaching the delegate
 1.1.27   - Minor updates to the examples. 
          - Additional example of using mDNS to browse for WiThrottle servers
          - Additional example of using multiThrottle methods
@@ -66,7 +91,6 @@ Version information:
 #define WITHROTTLE_H
 
 #include "Arduino.h"
-#include <vector>  //https://github.com/arduino-libraries/Arduino_AVRSTL
 
 // Protocol special characters
 // see: https://www.jmri.org/help/en/package/jmri/jmrit/withrottle/Protocol.shtml#StringParsing
@@ -78,9 +102,83 @@ Version information:
 #define DEFAULT_MULTITHROTTLE 'T'
 #define ALL_LOCOS_ON_THROTTLE "*"
 
+// Number of throttles (multiThrottle ids '0'-'9', then 'A'-'Z' without 'T', then 'a'-'z'), at most 61.
+// Each one costs about 30 bytes
+#ifndef MAX_WIT_THROTTLES
 #define MAX_WIT_THROTTLES 6
+#endif
+#if MAX_WIT_THROTTLES > 61
+#error "MAX_WIT_THROTTLES can be at most 61"
+#endif
 #define MAX_FUNCTIONS 32
 
+// Highest log level (see setLogLevel()) that is compiled in. Log messages above it are left out of the
+// build, with their strings, and cost nothing at run time. 0 leaves out all the logging. Level 5, tracing of
+// calls made for every command (e.g. throttle id lookups), is only compiled in when this is raised to 5
+#ifndef WIT_MAX_LOG_LEVEL
+#define WIT_MAX_LOG_LEVEL 4
+#endif
+// True if messages of the given log level are to be logged (used inside the classes, which have a logLevel)
+#define WIT_LOG_AT(level) ((level) <= WIT_MAX_LOG_LEVEL && logLevel >= (level))
+
+// The families of commands that WiThrottleProtocol parses. Setting one to 0 leaves its parser, and its delegate calls,
+// out of the build, and its commands are ignored (a list is skipped as it arrives, without being buffered):
+//   WIT_PARSE_ROSTER    the roster list (RL)
+//   WIT_PARSE_TURNOUTS  the turnout list and actions (PTL, PTA)
+//   WIT_PARSE_ROUTES    the route list and actions (PRL, PRA)
+//   WIT_PARSE_LOCOS     the loco commands (M), i.e. the speed, direction, functions, labels and adds/removes of the throttles
+#ifndef WIT_PARSE_ROSTER
+#define WIT_PARSE_ROSTER 1
+#endif
+#ifndef WIT_PARSE_TURNOUTS
+#define WIT_PARSE_TURNOUTS 1
+#endif
+#ifndef WIT_PARSE_ROUTES
+#define WIT_PARSE_ROUTES 1
+#endif
+#ifndef WIT_PARSE_LOCOS
+#define WIT_PARSE_LOCOS 1
+#endif
+
+// Number of locos that can be on each throttle (a consist), at most 32
+#ifndef WIT_MAX_CONSIST
+#define WIT_MAX_CONSIST 8
+#endif
+#if WIT_MAX_CONSIST > 32
+#error "WIT_MAX_CONSIST can be at most 32"
+#endif
+
+// Loco addresses are held packed into 16 bits: the DCC address in the low 14 bits, with this bit set for a long address
+#define WIT_LONG_ADDRESS 0x8000
+#define WIT_ADDRESS_MASK 0x3FFF
+
+// Highest fast clock rate accepted from the server, in thousandths. The fast clock is kept in
+// integers, and this keeps its arithmetic within 32 bits
+#define WIT_FAST_TIME_MAX_RATE 1000000
+
+// Size of the buffer holding a command as it is received. The roster, turnout and route lists
+// are processed an entry at a time, so this only needs to hold the longest single entry or other command
+#ifndef WIT_INPUT_BUFFER_SIZE
+#define WIT_INPUT_BUFFER_SIZE 1024
+#endif
+
+// Number of bytes check() reads from the stream at a time (on the stack)
+#ifndef WIT_READ_CHUNK_SIZE
+#define WIT_READ_CHUNK_SIZE 128
+#endif
+
+// Number of commands the outbound queue can hold, and the longest command (including the terminator)
+#ifndef WIT_OUTBOUND_QUEUE_SIZE
+#define WIT_OUTBOUND_QUEUE_SIZE 16
+#endif
+#ifndef WIT_OUTBOUND_COMMAND_SIZE
+#define WIT_OUTBOUND_COMMAND_SIZE 64
+#endif
+// Longest time (ms) a command in one of the lower priority lanes waits before it is sent ahead of higher priority ones
+#ifndef WIT_OUTBOUND_MAX_WAIT
+#define WIT_OUTBOUND_MAX_WAIT 2000
+#endif
+
 /// @brief Loco/Throttle Direction options
 enum Direction {
     Reverse = 0,
@@ -116,6 +214,45 @@ enum RouteState {
     RouteInconsistent = 8
 };
 
+/// @brief What to do with a new outbound command when the outbound queue is full
+enum OutboundOverflowPolicy {
+    OutboundDropOldest = 0,   ///< discard the oldest queued command to make room
+    OutboundReject = 1,       ///< discard the new command
+    OutboundCoalesce = 2      ///< replace a queued speed/direction/speed step command for the same loco, or an identical command. Otherwise discard the new command
+};
+
+/// @brief Priority lanes of the outbound queue. Lower numbers are sent first
+enum OutboundLane {
+    OutboundLaneSafety = 0,        ///< emergency stops and track power
+    OutboundLaneSession = 1,       ///< device name and ID, heartbeat requests, quit
+    OutboundLaneMotion = 2,        ///< speed, direction, acquire and release
+    OutboundLaneFunction = 3,      ///< loco functions
+    OutboundLaneAccessory = 4,     ///< turnouts, routes and anything not recognised
+    OutboundLaneHousekeeping = 5   ///< heartbeats
+};
+#define WIT_OUTBOUND_LANES 6
+
+/// @brief Families of commands from the server, for WiThrottleProtocol::setMessageFamilies(). Heartbeat (*) commands are always processed
+enum MessageFamily {
+    MessageFamilyRoster = 0x01,         ///< the roster list (RL)
+    MessageFamilyTurnouts = 0x02,       ///< the turnout list and actions (PTL, PTA)
+    MessageFamilyRoutes = 0x04,         ///< the route list and actions (PRL, PRA)
+    MessageFamilyLocos = 0x08,          ///< the loco commands (M): speed, direction, functions, labels, adds/removes
+    MessageFamilyFastTime = 0x10,       ///< the fast time (PFT)
+    MessageFamilyTrackPower = 0x20,     ///< the track power (PPA)
+    MessageFamilyServerInfo = 0x40,     ///< the version, server type and description and web port (VN, HT, Ht, PW)
+    MessageFamilyMessages = 0x80,       ///< messages and alerts (Hm, HM)
+    MessageFamilyAll = 0xFF
+};
+
+/// @brief Counters for one lane of the outbound queue, since connect()
+struct OutboundLaneStats {
+    unsigned long sent = 0;         ///< commands sent
+    unsigned long dropped = 0;      ///< commands discarded because the queue was full (or the command too long)
+    unsigned long totalWaitMs = 0;  ///< total time that the sent commands waited in the queue
+    unsigned long maxWaitMs = 0;    ///< longest time that a sent command waited in the queue
+};
+
 ///
 /// ----
 ///
@@ -153,8 +290,176 @@ class NullStream : public Stream {
 /// ----
 ///
 
-/// @brief Class for the Delegate methods
-class WiThrottleProtocolDelegate
+/// @brief Part of a received command, passed to the WiThrottleProtocolDelegateV2 methods without being copied.
+/// It is not null terminated, and is only valid until the delegate method returns
+struct WiThrottleStringView {
+    const char *data;   ///< first character
+    int length;         ///< number of characters
+
+    /// @brief Copy the characters into a String
+    String toString() const;
+
+    /// @brief Compare with a null terminated string
+    /// @param s string to compare with
+    /// @return True if they are the same
+    bool equals(const char *s) const { return (strncmp(data, s, length) == 0) && (s[length] == 0); }
+};
+
+/// @brief Class for the Delegate methods, with the text of the commands passed as WiThrottleStringViews and the loco
+/// addresses packed into numbers (see WiThrottleProtocol::packAddress()), so that nothing is copied or allocated.
+/// Every loco method has the throttle: DEFAULT_MULTITHROTTLE ('T') for commands for the non multiThrottle methods.
+/// WiThrottleProtocolDelegate is built on this, so a delegate can derive from either, or override these methods of
+/// a WiThrottleProtocolDelegate for the commands where it matters.
+class WiThrottleProtocolDelegateV2
+{
+  public:
+    virtual ~WiThrottleProtocolDelegateV2() {}
+
+    /// @brief Delegate method to receive the WiThrottle version
+    /// @param version Version Number
+    virtual void onVersion(WiThrottleStringView version) {}
+
+    /// @brief Delegate method to receive the Server Type
+    /// @param type Server Type
+    virtual void onServerType(WiThrottleStringView type) {}
+
+    /// @brief Delegate method to receive the Server Description
+    /// @param description Server Description
+    virtual void onServerDescription(WiThrottleStringView description) {}
+
+    /// @brief Delegate method to receive a message from the WiThrottle Server
+    /// @param message Message Content
+    virtual void onMessage(WiThrottleStringView message) {}
+
+    /// @brief Delegate method to receive a broadcast Alert from the WiThrottle Server
+    /// @param alert Broadcast Alert content
+    virtual void onAlert(WiThrottleStringView alert) {}
+
+    /// @brief Delegate method to receive the total number of Roster Entries
+    /// @param rosterSize total number of Roster Entries
+    virtual void onRosterEntries(int rosterSize) {}
+
+    /// @brief Delegate method to receive a single Roster Entry
+    /// @param index sequence number
+    /// @param name Roster entry name
+    /// @param address packed DCC address
+    virtual void onRosterEntry(int index, WiThrottleStringView name, uint16_t address) {}
+
+    /// @brief Delegate method to receive the total number of Turnout/Point Entries
+    /// @param turnoutListSize total number of Turnout/Point Entries
+    virtual void onTurnoutEntries(int turnoutListSize) {}
+
+    /// @brief Delegate method to receive a single Turnout/Point Entry
+    /// @param index sequence number
+    /// @param sysName Turnout/Point system name
+    /// @param userName Turnout/Point user name
+    /// @param state current state of the Turnout/Point
+    virtual void onTurnoutEntry(int index, WiThrottleStringView sysName, WiThrottleStringView userName, int state) {}
+
+    /// @brief Delegate method to receive the total number of Route Entries
+    /// @param routeListSize total number of Route Entries
+    virtual void onRouteEntries(int routeListSize) {}
+
+    /// @brief Delegate method to receive a single Route Entry
+    /// @param index sequence number
+    /// @param sysName Route system name
+    /// @param userName Route user name
+    /// @param state current state of the Route
+    virtual void onRouteEntry(int index, WiThrottleStringView sysName, WiThrottleStringView userName, int state) {}
+
+    /// @brief Delegate method to receive the fast time
+    /// @param time fast time (seconds since midnight)
+    virtual void onFastTime(uint32_t time) {}
+
+    /// @brief Delegate method to receive the fast time rate
+    /// @param rate Rate of the fast time clock
+    virtual void onFastTimeRate(double rate) {}
+
+    /// @brief Delegate method to receive the Server heartbeat configuration
+    /// @param seconds Number of seconds between heartbeats
+    virtual void onHeartbeatConfig(int seconds) {}
+
+    /// @brief Delegate method to receive the state of a function
+    /// @param multiThrottle Which Throttle
+    /// @param func Function number (0-31)
+    /// @param state Function State (Boolean True= active/pressed, False = inactive/not pressed)
+    virtual void onFunctionState(char multiThrottle, uint8_t func, bool state) {}
+
+    /// @brief Delegate method to receive the function labels of the roster entry on a throttle
+    /// @param multiThrottle Which Throttle
+    /// @param labels the labels, in function number order
+    /// @param count number of labels (at most MAX_FUNCTIONS)
+    virtual void onFunctionLabels(char multiThrottle, const WiThrottleStringView *labels, int count) {}
+
+    /// @brief Delegate method to receive the speed of a throttle
+    /// @param multiThrottle Which Throttle
+    /// @param speed Speed (0-126)
+    virtual void onSpeed(char multiThrottle, int speed) {}
+
+    /// @brief Delegate method to receive the direction of a throttle
+    /// @param multiThrottle Which Throttle
+    /// @param dir Direction
+    virtual void onDirection(char multiThrottle, Direction dir) {}
+
+    /// @brief Delegate method to receive the direction of one loco (not the lead loco) in a throttle's consist
+    /// @param multiThrottle Which Throttle
+    /// @param address packed DCC address
+    /// @param dir Direction
+    virtual void onLocoDirection(char multiThrottle, uint16_t address, Direction dir) {}
+
+    /// @brief Delegate method to receive the speed steps of a throttle
+    /// @param multiThrottle Which Throttle
+    /// @param steps 1 = 128step, 2 = 28step, 4 = 27step or 8 = 14step
+    virtual void onSpeedSteps(char multiThrottle, int steps) {}
+
+    /// @brief Delegate method to receive the port of the server's web server
+    /// @param port port number
+    virtual void onWebPort(int port) {}
+
+    /// @brief Delegate method to receive the track power state
+    /// @param state PowerOff, PowerOn or PowerUnknown
+    virtual void onTrackPower(TrackPower state) {}
+
+    /// @brief Delegate method called when a loco has been added to a throttle
+    /// @param multiThrottle Which Throttle
+    /// @param address packed DCC address
+    /// @param entry roster entry
+    virtual void onAddressAdded(char multiThrottle, uint16_t address, WiThrottleStringView entry) {}
+
+    /// @brief Delegate method called when a loco has been removed from a throttle
+    /// @param multiThrottle Which Throttle
+    /// @param address packed DCC address
+    /// @param command 'd' dispatched or 'r' released
+    virtual void onAddressRemoved(char multiThrottle, uint16_t address, char command) {}
+
+    /// @brief Delegate method called when a loco needs to be stolen before it can be added to a throttle
+    /// @param multiThrottle Which Throttle
+    /// @param address packed DCC address
+    /// @param entry roster entry
+    virtual void onAddressStealNeeded(char multiThrottle, uint16_t address, WiThrottleStringView entry) {}
+
+    /// @brief Delegate method to receive the new state of a Turnout/Point
+    /// @param systemName system name of the Turnout/Point
+    /// @param state new state
+    virtual void onTurnoutAction(WiThrottleStringView systemName, TurnoutState state) {}
+
+    /// @brief Delegate method to receive the new state of a Route
+    /// @param systemName system name of the Route
+    /// @param state new state
+    virtual void onRouteAction(WiThrottleStringView systemName, RouteState state) {}
+
+    /// @brief Delegate method to receive a command that was not recognised
+    /// @param unknownCommand the command
+    virtual void onUnknownCommand(WiThrottleStringView unknownCommand) {}
+};
+
+///
+/// ----
+///
+
+/// @brief Class for the Delegate methods. The WiThrottleProtocolDelegateV2 methods copy what was received into
+/// Strings and call these
+class WiThrottleProtocolDelegate : public WiThrottleProtocolDelegateV2
 {
   public:
     /// @brief Delegate method to receive the WiThrottle version
@@ -232,13 +537,13 @@ class WiThrottleProtocolDelegate
     virtual void receivedRosterFunctionList(String functions[MAX_FUNCTIONS]) { }
 
     /// @brief Delegate method to received from the Withrottle Server
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param func Function number (0-31)
     /// @param state Function State (Boolean True= active/pressed, False = inactive/not pressed)
     virtual void receivedFunctionStateMultiThrottle(char multiThrottle, uint8_t func, bool state) { }
     
     /// @brief Delegate method to receive  from the Withrottle Server
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param functions TBA
     virtual void receivedRosterFunctionListMultiThrottle(char multiThrottle, String functions[MAX_FUNCTIONS]) { }
 
@@ -260,23 +565,23 @@ class WiThrottleProtocolDelegate
     virtual void receivedSpeedSteps(int steps) { }        // snn
 
     /// @brief Delegate method to receive the speed for a specific throttle from the Withrottle Server
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param speed TBA
     virtual void receivedSpeedMultiThrottle(char multiThrottle, int speed) { }             // Vnnn
     
     /// @brief Delegate method to receive the direction for a specific throttle from the Withrottle Server
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param dir Direction (Forward or Reverse)
     virtual void receivedDirectionMultiThrottle(char multiThrottle, Direction dir) { }     // R{0,1}
 
     /// @brief Delegate method to receive the direction for a specific throttle for an individual loco from the Withrottle Server
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').
     /// @param address DCC Address (String containing the DCC address as number preceeded with "S" or "L")
     /// @param dir (Forward or Reverse)
     virtual void receivedDirectionMultiThrottle(char multiThrottle, String address, Direction dir) { }     // R{0,1}
 
     /// @brief Delegate method to receive the speed steps for a specific throttle from the Withrottle Server
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param steps 1=128step, 2=28step, 4=27step or 8=14step
     virtual void receivedSpeedStepsMultiThrottle(char multiThrottle, int steps) { }        // snn
 
@@ -304,19 +609,19 @@ class WiThrottleProtocolDelegate
     virtual void addressStealNeeded(String address, String entry) { } // MTSaddr<;>addr
 
     /// @brief Delegate method to receive a message that a loco has been added to a specific throttle, from the Withrottle Server
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').
     /// @param address DCC Address (String containing the DCC address as number preceeded with "S" or "L")
     /// @param entry TBA
     virtual void addressAddedMultiThrottle(char multiThrottle, String address, String entry) { }  // M0+addr<;>roster entry
 
     /// @brief Delegate method to receive a message that a loco has been dropped from a specific throttle, from the Withrottle Server
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address (String containing the DCC address as number preceeded with "S" or "L")
     /// @param command TBA
     virtual void addressRemovedMultiThrottle(char multiThrottle, String address, String command) { } // M0-addr<;>[dr]
 
     /// @brief Delegate method to receive a message for the need to steal the loco for a specific throttle, from the Withrottle Server. Only relevant to DigiTrax systems
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address (String containing the DCC address as number preceeded with "S" or "L")
     /// @param entry TBA
     virtual void addressStealNeededMultiThrottle(char multiThrottle, String address, String entry) { } // MTSaddr<;>addr
@@ -334,6 +639,36 @@ class WiThrottleProtocolDelegate
     /// @brief Delegate method to receive an unknown command from the Withrottle Server
     /// @param unknownCommand command received
     virtual void receivedUnknownCommand(String unknownCommand) { }
+
+    // the WiThrottleProtocolDelegateV2 methods, passed on to the ones above
+    void onVersion(WiThrottleStringView version);
+    void onServerType(WiThrottleStringView type);
+    void onServerDescription(WiThrottleStringView description);
+    void onMessage(WiThrottleStringView message);
+    void onAlert(WiThrottleStringView alert);
+    void onRosterEntries(int rosterSize);
+    void onRosterEntry(int index, WiThrottleStringView name, uint16_t address);
+    void onTurnoutEntries(int turnoutListSize);
+    void onTurnoutEntry(int index, WiThrottleStringView sysName, WiThrottleStringView userName, int state);
+    void onRouteEntries(int routeListSize);
+    void onRouteEntry(int index, WiThrottleStringView sysName, WiThrottleStringView userName, int state);
+    void onFastTime(uint32_t time);
+    void onFastTimeRate(double rate);
+    void onHeartbeatConfig(int seconds);
+    void onFunctionState(char multiThrottle, uint8_t func, bool state);
+    void onFunctionLabels(char multiThrottle, const WiThrottleStringView *labels, int count);
+    void onSpeed(char multiThrottle, int speed);
+    void onDirection(char multiThrottle, Direction dir);
+    void onLocoDirection(char multiThrottle, uint16_t address, Direction dir);
+    void onSpeedSteps(char multiThrottle, int steps);
+    void onWebPort(int port);
+    void onTrackPower(TrackPower state);
+    void onAddressAdded(char multiThrottle, uint16_t address, WiThrottleStringView entry);
+    void onAddressRemoved(char multiThrottle, uint16_t address, char command);
+    void onAddressStealNeeded(char multiThrottle, uint16_t address, WiThrottleStringView entry);
+    void onTurnoutAction(WiThrottleStringView systemName, TurnoutState state);
+    void onRouteAction(WiThrottleStringView systemName, RouteState state);
+    void onUnknownCommand(WiThrottleStringView unknownCommand);
 };
 
 ///
@@ -341,6 +676,9 @@ class WiThrottleProtocolDelegate
 /// ==================
 ///
 
+class WiThrottleLayoutStore;  // see WiThrottleLayoutStore.h
+class WiThrottleEventLog;  // see WiThrottleEventLog.h
+
 /// @brief This library implements the WiThrottle protocol
 /// @details (as used in JMRI and other servers), allowing an device to connect to the server and act as a client (such as a dedicated fast clock device or a hardware based throttle).
 class WiThrottleProtocol
@@ -354,26 +692,34 @@ class WiThrottleProtocol
   public:
     
     /// @brief Initialise the WiThrottle Protocol
-    /// @param server TBA
+    /// @param server True if this end is the server, which adds a blank line after each command sent. The server side itself is WiThrottleServer (WiThrottleServer.h)
 	WiThrottleProtocol(bool server = false);
 
     /// @brief Set the Delegate 
-    /// @param delegate pointer to the delegate
-	void setDelegate(WiThrottleProtocolDelegate *delegate);
+    /// @param delegate pointer to the delegate (a WiThrottleProtocolDelegate or a WiThrottleProtocolDelegateV2)
+	void setDelegate(WiThrottleProtocolDelegateV2 *delegate);
 
     // /// @brief TBA
     // /// @param delegate TBA
     // /// @param delayBetweenCommandsSent TBA
 	// void setDelegate(WiThrottleProtocolDelegate *delegate, int delayBetweenCommandsSent);
 
+    /// @brief Keep a local copy of the roster, turnout and route lists in a store. The store is cleared on connect
+    /// @param store pointer to the store, or NULL to stop using it
+    void setLayoutStore(WiThrottleLayoutStore *store);
+
     /// @brief Set the log stream
     /// @param console pointer to the serial console
     void setLogStream(Stream *console);
 
     /// @brief Set the console log level
-    /// @param level Log Level (0 = off 1 = basic 2 = high)
+    /// @param level Log Level (0 = off 1 = basic 2 = high, 4 = raw input, 5 = per call tracing). Levels above WIT_MAX_LOG_LEVEL are not compiled in
     void setLogLevel(int level);
 
+    /// @brief Record the commands sent and received, and other events, in an event log. This is independent of the log level
+    /// @param eventLog pointer to the event log (which can be shared with other sessions), or NULL to stop recording
+    void setEventLog(WiThrottleEventLog *eventLog);
+
     /// @brief Configure the server so that outgoing commands are always preceeded with an extra CrLf. The extra CrLF is now sent by default. This can be used to disable it.
     /// @param needed TBA
     void setCommandsNeedLeadingCrLf(bool needed);
@@ -387,6 +733,54 @@ class WiThrottleProtocol
     /// @param delayBetweenCommandsSent Delay Between Commands Sent - Minimum time allowable between outgoing commands
     void connect(Stream *stream, int delayBetweenCommandsSent);
 
+    /// @brief Set the families of commands from the server that are processed. The others are discarded as they are
+    /// received, before they are parsed (and a long list without being buffered), so their delegate methods are not called,
+    /// and the state they carry (e.g. the throttles' speeds, the layout store) is not kept up to date. The default is MessageFamilyAll
+    /// @param families MessageFamily values or'ed together
+    void setMessageFamilies(int families);
+
+    /// @brief Get the families of commands from the server that are processed
+    /// @return MessageFamily values or'ed together
+    int getMessageFamilies() { return messageFamilies; }
+
+    /// @brief Set what happens to new commands when the outbound queue is full. The default is OutboundDropOldest
+    /// @param policy OutboundDropOldest, OutboundReject or OutboundCoalesce
+    void setOutboundOverflowPolicy(OutboundOverflowPolicy policy);
+
+    /// @brief Get the number of commands waiting in the outbound queue
+    /// @return Number of queued commands
+    int getOutboundQueueDepth();
+
+    /// @brief Get the number of commands waiting in one lane of the outbound queue
+    /// @param lane Priority lane
+    /// @return Number of queued commands in the lane
+    int getOutboundQueueDepth(OutboundLane lane);
+
+    /// @brief Get the counters for one lane of the outbound queue. Commands are sent in priority order (safety first), while still honouring the minimum delay between commands
+    /// @param lane Priority lane
+    /// @return Commands sent and dropped, and how long they waited
+    OutboundLaneStats getOutboundLaneStats(OutboundLane lane);
+
+    /// @brief Get the largest number of commands that have been waiting in the outbound queue since connect()
+    /// @return High water mark of the outbound queue
+    int getOutboundQueueHighWaterMark();
+
+    /// @brief Get the number of outbound commands discarded because the queue was full or the command was too long
+    /// @return Number of discarded commands since connect()
+    unsigned long getOutboundCommandsDropped();
+
+    /// @brief Get the number of speed/direction commands that replaced an earlier one for the same loco that was still waiting to be sent
+    /// @return Number of coalesced commands since connect()
+    unsigned long getOutboundCommandsCoalesced();
+
+    /// @brief Get the number of bytes read from the WiThrottle server
+    /// @return Number of bytes since connect()
+    unsigned long getBytesReceived();
+
+    /// @brief Get the number of commands (lines) received from the WiThrottle server
+    /// @return Number of commands since connect()
+    unsigned long getCommandsReceived();
+
     /// @brief Disconnect from the WiThrottle server
     void disconnect();
 
@@ -403,6 +797,16 @@ class WiThrottleProtocol
     /// @returns True if there have been updates from the server.
     bool check();
 
+    /// @brief Get how long until check() next has timer work to do (a heartbeat, a fast clock tick or a queued command). Between now and then check() only needs to be called when the stream has data, so a host can sleep (e.g. in poll()) until either happens.
+    /// @return Milliseconds until the next timer is due (0 if it is due now), or -1 if there are no timers running
+    long getTimeUntilNextEvent();
+
+    /// @brief Process data received from the WiThrottle server by some other means than the stream given to connect(). check() calls this for everything it reads.
+    /// @param data Data received. Does not need to start or end on a command boundary.
+    /// @param length Number of bytes in data
+    /// @returns True if there have been updates from the server.
+    bool processInput(const char *data, size_t length);
+
     /// @brief Send an arbitary command to the WiThrottle server
     /// @param cmd WiThrottle command to send
     void sendCommand(String cmd);
@@ -414,11 +818,32 @@ class WiThrottleProtocol
     /// @return the current fast time
 	double getCurrentFastTime();
 
+    /// @brief Get the current Fast Time, without floating point. It is worked out from when the server last sent it and the rate, so it does not drift
+    /// @param milliseconds If not NULL, set to the milliseconds past the second
+    /// @return the current fast time in whole seconds, as sent by the server
+    uint32_t getFastTime(uint16_t *milliseconds = NULL);
+
     /// @brief Get the current Fast Time rate
     /// @return The current fast time rate
     float getFastTimeRate();
 
-    /// @brief TBA
+    /// @brief Get the current Fast Time rate, without floating point
+    /// @return The current fast time rate in thousandths (4000 for 4:1), 0 if the clock is stopped
+    uint32_t getFastTimeRateThousandths();
+
+    /// @brief Set how often clockChanged is set and the delegate's onFastTime() called while the fast clock is running.
+    /// With 0 (the default) it is once a (real) second. Otherwise it is each time the fast time reaches a multiple of
+    /// that many (fast) seconds, e.g. 60 for a display of hours and minutes, and getTimeUntilNextEvent() gives the
+    /// time until then, so the sketch can sleep in between
+    /// @param seconds Fast seconds, at most 86400
+    void setFastTimeGranularity(uint32_t seconds);
+
+    /// @brief Get the time until clockChanged is next set
+    /// @return Milliseconds (0 if it is due now), or -1 if the fast clock is stopped
+    long getTimeUntilFastTimeChange();
+
+    /// @brief Set by check() while the fast clock is running, once a (real) second or as set by setFastTimeGranularity(),
+    /// and when the server sends the fast time. The delegate's onFastTime() is called each time it is set
     bool clockChanged;
 
     /// @brief The name of the client device
@@ -462,36 +887,36 @@ class WiThrottleProtocol
     // multiThrottle support
 
     /// @brief Add a specfied loco to a specified throttle. Will be added to the end of the consist of one or more locos are currently assigned to that Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address Address of the loco to add.
     /// @return True if the loco was added
     bool addLocomotive(char multiThrottle, String address);  // address is [S|L]nnnn (where n is 0-10000)
 
     /// @brief Steal a specified loco. Only relevant to DigiTrax systems
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address Address of the Loco to steal
     /// @return TBA
     bool stealLocomotive(char multiThrottle, String address);   // address is [S|L]nnnn (where n is 0-10000)
 
     /// @brief Release one or all locos from a specied throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address of the loco to drop (String containing the DCC address as number preceeded with "S" or "L") or "*" to drop all locos on the throttle
     /// @return Always true
     bool releaseLocomotive(char multiThrottle, String address = "*");
 
     /// @brief Get the address of the loco in the lead positon, currently assigned to a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @return DCC Address of the loco (String containing the DCC address as number preceeded with "S" or "L")
     String getLeadLocomotive(char multiThrottle);
 
     /// @brief Get the address of the loco at a specified positon, currently assigned to a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param position Postion of the loco to retrieve
     /// @return DCC Address of the loco (String containing the DCC address as number preceeded with "S" or "L")
     String getLocomotiveAtPosition(char multiThrottle, int position);
 
     /// @brief Get the number of locos currently assigned to a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @return Number of locos (in consist/Multiple Unit) on the throttle
     int getNumberOfLocomotives(char multiThrottle);
 
@@ -503,20 +928,20 @@ class WiThrottleProtocol
     // multiThrottle support
 
     /// @brief Set a Function on the a specified Throttle. Assumes a button is being pressed hence Press or Release. [Deprecated. Use the multiThrottle version]
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param funcnum Function Number (0-31)
     /// @param pressed Press or Release (True = pressed, False = released)
     void setFunction(char multiThrottle, int funcnum, bool pressed);
 
     /// @brief Set a Function on a specified Loco only, on a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address of the loco to set (String containing the DCC address as number preceeded with "S" or "L")
     /// @param funcnum Function Number (0-31)
     /// @param pressed Press or Release (True = pressed, False = released)
     void setFunction(char multiThrottle, String address, int funcnum, bool pressed);
 
     /// @brief Set a Function on a specified Loco only, on a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address of the loco to set (String containing the DCC address as number preceeded with "S" or "L")
     /// @param funcnum Function Number (0-31)
     /// @param pressed Press or Release (True = pressed, False = released)
@@ -548,7 +973,7 @@ class WiThrottleProtocol
     // multiThrottle support
 
     /// @brief Get the speed step of a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @return Speed Step setting (1 = 128step, 2 = 28step, 4 = 27step or 8 = 14step)
     int getSpeedSteps(char multiThrottle);
 
@@ -559,52 +984,52 @@ class WiThrottleProtocol
     
     // multiThrottle support
     /// @brief Set the speed step of a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param steps 1=128step, 2=28step, 4=27step or 8=14step
     /// @return True if the 'steps' is valid
     bool setSpeedSteps(char multiThrottle, int steps);
 
     // multiThrottle support
     /// @brief Set the speed of a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param speed Speed 0-126
     /// @return True if the requested speed is valid and there is a loco on the specified throttle. Otherwise False
     bool setSpeed(char multiThrottle, int speed);
 
     /// @brief Set the speed of a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param speed Speed 0-126
     /// @param forceSend Option to force the command to be sent, even if the protocol thinks it is at that speed
     /// @return True if the requested speed is valid and there is a loco on the specified throttle. Otherwise False
     bool setSpeed(char multiThrottle, int speed, bool forceSend);
 
     /// @brief Get the speed of a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @return Speed (0-126)
     int getSpeed(char multiThrottle);
 
     /// @brief Set the direction of a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param direction Direction. (Reverse or Forward)
     /// @return True if there is a loco on the specified throttle. Otherwise False
     bool setDirection(char multiThrottle, Direction direction);
 
     /// @brief Set the direction of a specified Throttle, with the option to force the send
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param direction Direction. (Reverse or Forward)
     /// @param forceSend Option to force the command to be sent, even if the protocol thinks it is in that Direction
     /// @return True if there is a loco on the specified throttle. Otherwise False
     bool setDirection(char multiThrottle, Direction direction, bool forceSend);
 
     /// @brief Set the direction of a specific locomotive on a specified Throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address of the loco to set (String containing the DCC address as number preceeded with "S" or "L")
     /// @param direction Direction. (Reverse or Forward)
     /// @return True if there is a loco on the specified throttle. Otherwise False
     bool setDirection(char multiThrottle, String address, Direction direction);
 
     /// @brief et the direction of a specific locomotive on a specified Throttle, with the option to force the send
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address of the loco to set (String containing the DCC address as number preceeded with "S" or "L")
     /// @param direction Direction. (Forward or Reverse)
     /// @param ForceSend Option to force the command to be sent, even if the protocol thinks it is in that Direction
@@ -612,22 +1037,22 @@ class WiThrottleProtocol
     bool setDirection(char multiThrottle, String address, Direction direction, bool ForceSend);
 
     /// @brief Get the direction of a specific throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @return Direction (Forward or Reverse)
     Direction getDirection(char multiThrottle);
 
     /// @brief Get the direction of a specific locomotives on a specific throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address of the loco to get (String containing the DCC address as number preceeded with "S" or "L")
     /// @return Direction (Forward or Reverse)
     Direction getDirection(char multiThrottle, String address);
 
     /// @brief Emergency Stop all locomotives on a specific throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     void emergencyStop(char multiThrottle);
 
     /// @brief Emergency Stop a specific locomotives on a specific throttle
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param address DCC Address of the loco to stop (String containing the DCC address as number preceeded with "S" or "L")
     void emergencyStop(char multiThrottle, String address);
 	
@@ -635,7 +1060,8 @@ class WiThrottleProtocol
     /// @param state State required. One of - PowerOff = 0, PowerOn = 1
 	void setTrackPower(TrackPower state);
 
-    /// @brief Emergency Stop all locomotives on the default (first) throttle
+    /// @brief Emergency Stop all locomotives on every throttle, whether or not this session knows of locos on it. The throttles
+    /// with locos go first, and with MAX_WIT_THROTTLES above WIT_OUTBOUND_QUEUE_SIZE, the others only as long as they fit in the queue
     void emergencyStop();
 
     /// @brief Set the state of a Turnout/Point 
@@ -649,15 +1075,27 @@ class WiThrottleProtocol
     /// @return always True
     bool setRoute(String address);   // address is turnout system name e.g. IO:AUTO:0008
 
-    /// @brief Used to record the locos in a consist (on each Throttle)
-    std::vector<String> locomotives[6];
-
-    /// @brief Used to record the direction the locos in a consist (on each Throttle) are facing
-    std::vector<Direction> locomotivesFacing[6];
-
-    /// @brief Get the Throttle index number from a char Throttle Id. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
-    /// @param multiThrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.
+    /// @brief Pack a loco address in the form used by the protocol ("S3", "L1234") into 16 bits. See WIT_LONG_ADDRESS
+    /// @param address the address
+    /// @param len length of the address
+    /// @return The packed address, or -1 if it is not an address
+    static int packAddress(const char *address, int len);
+
+    /// @brief Write a packed address in the form used by the protocol ("S3", "L1234")
+    /// @param packed packed address
+    /// @param buffer at least 7 characters. The address is null terminated
+    /// @return The length of the address
+    static int formatAddress(uint16_t packed, char *buffer);
+
+    /// @brief Get the Throttle index number from a char Throttle Id. The ids are '0'-'9', then 'A'-'Z' (without 'T') and 'a'-'z', up to MAX_WIT_THROTTLES of them.  ('T' is the same as '0', for compatibility with the non multiThrottle methods.)
+    /// @param multiThrottle Which Throttle
+    /// @return The index, or -1 if there is no such throttle. Methods given an unknown throttle do nothing (and return false)
     int getMultiThrottleIndex(char multiThrottle);
+
+    /// @brief Get the char Throttle Id of a Throttle index number
+    /// @param index Throttle index number (0 to MAX_WIT_THROTTLES-1)
+    /// @return The Throttle Id, or 0 if there is no such throttle
+    static char getMultiThrottleId(int index);
     
     /// @brief Get the last time that the server sent a resonse to the client 
     long getLastServerResponseTime();  
@@ -676,12 +1114,32 @@ class WiThrottleProtocol
     int logLevel = 1;
     Stream *console;
 	NullStream nullStream;
-    String outboundBuffer;
+    WiThrottleEventLog *eventLog = NULL;
+    // queued commands are held in a shared pool of slots, and each lane is a ring of slot numbers
+    char outboundQueue[WIT_OUTBOUND_QUEUE_SIZE][WIT_OUTBOUND_COMMAND_SIZE];
+    unsigned long outboundQueueTime[WIT_OUTBOUND_QUEUE_SIZE];  // when each slot was queued
+    unsigned long outboundQueueSequence[WIT_OUTBOUND_QUEUE_SIZE];  // the order the slots were queued in, over all the lanes
+    unsigned long outboundSequence;  // for the next command queued
+    uint8_t outboundFreeSlots[WIT_OUTBOUND_QUEUE_SIZE];
+    int outboundFreeCount;
+    uint8_t outboundLaneSlots[WIT_OUTBOUND_LANES][WIT_OUTBOUND_QUEUE_SIZE];
+    int outboundLaneHead[WIT_OUTBOUND_LANES];  // oldest entry in each lane's ring
+    int outboundLaneCount[WIT_OUTBOUND_LANES];
+    OutboundLaneStats outboundLaneStats[WIT_OUTBOUND_LANES];
+    int outboundQueueCount;
+    int outboundQueueHighWaterMark;
+    unsigned long outboundCmdsCoalesced;
+    unsigned long bytesReceived;
+    unsigned long commandsReceived;
+    OutboundOverflowPolicy outboundOverflowPolicy = OutboundDropOldest;
+    int messageFamilies = MessageFamilyAll;
+    uint32_t fastTimeGranularity = 0;
     double outboundCmdsTimeLastSent;
     int outboundCmdsMininumDelay;
     bool commandsNeedLeadingCrLf = false;
 	
-	WiThrottleProtocolDelegate *delegate = NULL;
+	WiThrottleProtocolDelegateV2 *delegate = NULL;
+    WiThrottleLayoutStore *layoutStore = NULL;
 
     ///
     /// Inbound Command processing
@@ -694,7 +1152,7 @@ class WiThrottleProtocol
     bool processCommand(char *c, int len);
 
     /// @brief Process an incoming command from the Command Station - specific to locomotives
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param c Command to process
     /// @param len length of the command
     bool processLocomotiveAction(char multiThrottle, char *c, int len);
@@ -710,7 +1168,7 @@ class WiThrottleProtocol
     bool processHeartbeat(char *c, int len);
 
     /// @brief Process an incoming Roster command from the Command Station
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param c Command to process
     /// @param len length of the command
     bool processRosterFunctionList(char multiThrottle, char *c, int len);
@@ -745,20 +1203,43 @@ class WiThrottleProtocol
     /// @param len length of the message
     void processWebPort(char *c, int len);
 
-    /// @brief Process an incoming Roster List from the Command Station. This is the complete list of all the locos in the Roster.
-    /// @param c Roster list to process
-    /// @param len length of the list
-	void processRosterList(char *c, int len);
+    /// @brief Check if the line being received is a roster, turnout or route list and, if so, process the entries received so far and remove them from the input buffer
+    /// @return True if any entries were processed
+    bool processListEntries();
 
-    /// @brief Process an incoming Turnout/Points List from the Command Station. This is the complete list of all the locos in the Roster.
-    /// @param c Turnout/Points list to process
-    /// @param len length of the list
-    void processTurnoutList(char *c, int len);
+    /// @brief Process one segment of a roster, turnout or route list. The first segment is the list header
+    /// @param c Segment to process (not terminated)
+    /// @param len length of the segment
+    void processListSegment(const char *c, int len);
 
-    /// @brief Process an incoming Routes List from the Command Station. This is the complete list of all the locos in the Roster.
-    /// @param c Routes list to process
-    /// @param len length of the list
-    void processRouteList(char *c, int len);
+    /// @brief Finish a roster, turnout or route list, at the end of the line or when it is too long for the input buffer
+    /// @param complete True at the end of the line, to process the last entry. False if the list was cut short:
+    /// the entry being received and the rest of the list are lost, and the layout store keeps the entries that were not received
+    /// @return Always true
+    bool finishList(bool complete);
+
+    /// @brief Process a single entry of the Roster List from the Command Station.
+    /// @param index sequence number of the entry
+    /// @param c Entry to process (not terminated)
+    /// @param len length of the entry
+	void processRosterEntry(int index, const char *c, int len);
+
+    /// @brief Process a single entry of the Turnout/Points List from the Command Station.
+    /// @param index sequence number of the entry
+    /// @param c Entry to process (not terminated)
+    /// @param len length of the entry
+    void processTurnoutEntry(int index, const char *c, int len);
+
+    /// @brief Process a single entry of the Routes List from the Command Station.
+    /// @param index sequence number of the entry
+    /// @param c Entry to process (not terminated)
+    /// @param len length of the entry
+    void processRouteEntry(int index, const char *c, int len);
+
+    /// @brief Log the three segments of a roster, turnout or route entry
+    /// @param segment start of each segment
+    /// @param segmentLen length of each segment
+    void logListSegments(const char *segment[], int segmentLen[]);
 
     /// @brief Process an incoming Track Power information from the Command Station
     /// @param c Information to process
@@ -766,43 +1247,50 @@ class WiThrottleProtocol
     void processTrackPower(char *c, int len);
 
     /// @brief TBA
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param functionData TBA
-    void processFunctionState(char multiThrottle, const String& functionData);
+    /// @param len length of the function data
+    void processFunctionState(char multiThrottle, const char *functionData, int len);
 
     /// @brief TBA
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param s TBA
-    void processRosterFunctionListEntries(char multiThrottle, const String& s);
+    /// @param len length of the list
+    void processRosterFunctionListEntries(char multiThrottle, const char *s, int len);
 
     /// @brief TBA
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param speedStepData TBA
-    void processSpeedSteps(char multiThrottle, const String& speedStepData);
+    /// @param len length of the speed step data
+    void processSpeedSteps(char multiThrottle, const char *speedStepData, int len);
 
     /// @brief Process an incoming Direction command from the Command Station for a specific multiThrottle
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param directionStr TBA
-    void processDirection(char multiThrottle, const String& directionStr);
+    /// @param len length of the direction string
+    void processDirection(char multiThrottle, const char *directionStr, int len);
 
     /// @brief Process an incoming Direction command from the Command Station for a specific multiThrottle
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
-    /// @param loco TBA
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
+    /// @param address DCC Address of the loco (not terminated)
+    /// @param addressLen length of the address
     /// @param directionStr TBA
-    void processDirection(char multiThrottle, String& loco, const String& directionStr);
+    /// @param len length of the direction string
+    void processDirection(char multiThrottle, const char *address, int addressLen, const char *directionStr, int len);
 
     /// @brief Process an incoming Speed command from the Command Station for a specific multiThrottle
     /// @param speedData TBA
-    void processSpeed(char multiThrottle, const String& speedData);
+    /// @param len length of the speed data
+    void processSpeed(char multiThrottle, const char *speedData, int len);
 
     /// @brief Process an incoming command from the Command Station to add or remove on or more locomotives from a specified multiThrottle
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param c Command to process
     /// @param len length of the command
     void processAddRemove(char multiThrottle, char *c, int len);
 
     /// @brief Process an incoming command from the Command Station to to advice that a steal command is required to aquire a locomotive. Specific the DigiTrack Command Stations only.
-    /// @param multithrottle Which Throttle. Supported multiThrottle codes are 'T' '0' '1' '2' '3' '4' '5' only.  ('T' is include for compatibiilty with the non multiThrottle methods.)
+    /// @param multithrottle Which Throttle. '0'-'9', then 'A'-'Z' (without 'T'), then 'a'-'z', up to MAX_WIT_THROTTLES of them (by default 6, '0'-'5').  ('T' is the same throttle as '0', for compatibility with the non multiThrottle methods.)
     /// @param c Command to process
     /// @param len length of the command
     void processStealNeeded(char multiThrottle, char *c, int len);
@@ -826,22 +1314,86 @@ class WiThrottleProtocol
     /// ^^^^^^^^^^^^^^^^^
     ///
 
-    /// @brief TBA
+    /// @brief Tick the fast clock once a (real) second, or when it reaches the next multiple of the granularity
+    /// @return True if it ticked
     bool checkFastTime();
 
+    /// @brief Move the fast clock's sync point on by the whole (real) seconds since it
+    void advanceFastTime();
+
     /// @brief TBA    
     bool checkHeartbeat();
 
-    /// @brief TBA
-    /// @param cmd TBA
+    /// @brief Queue a command in the lane that suits it, and send the next queued command if the minimum delay since the last one has passed
+    /// @param cmd Command to queue
     void sendDelayedCommand(String cmd);
 
-    /// @brief TBA
-    /// @param s TBA
-    void setCurrentFastTime(const String& s);
+    /// @brief Queue a command in a specific lane, and send the next queued command if the minimum delay since the last one has passed
+    /// @param cmd Command to queue
+    /// @param lane Priority lane
+    void sendDelayedCommand(String cmd, OutboundLane lane);
+
+    /// @brief Work out which priority lane a command belongs in
+    /// @param cmd Command
+    /// @param len length of the command
+    OutboundLane outboundLaneFor(const char *cmd, int len);
+
+    /// @brief Copy a command into the outbound queue, applying the overflow policy if it is full
+    /// @param cmd Command to queue
+    /// @param len length of the command
+    /// @param lane Priority lane
+    /// @return True if the command was queued
+    bool queueOutboundCommand(const char *cmd, int len, OutboundLane lane);
+
+    /// @brief Slot holding the i'th (0 = oldest) command of a lane
+    int outboundLaneSlot(int lane, int i);
+
+    /// @brief Remove the i'th (0 = oldest) command of a lane from the queue
+    void removeOutboundCommand(int lane, int i);
+
+    /// @brief Check if a command for a throttle has been queued (in any lane) after a queue slot
+    /// @param multiThrottle Which Throttle
+    /// @param slot queue slot
+    bool outboundThrottleQueuedAfter(char multiThrottle, int slot);
+
+    /// @brief Find the command to send in place of the oldest one of a lane, so that a throttle's commands are not reordered across its acquire or release
+    /// @param lane lane picked to send from, changed if another lane's command has to go first
+    /// @return index of the command to send in lane
+    int outboundSessionOrder(int *lane);
 
-    char inputbuffer[32767];
+    /// @brief Remove the speed commands for a throttle that are still waiting in the outbound queue
+    /// @param multiThrottle Which Throttle, or '*' for all throttles
+    void purgeQueuedSpeedCommands(char multiThrottle);
+
+    /// @brief Send the next queued command (in priority order) if the minimum delay since the last one has passed
+    void sendQueuedCommand();
+
+    /// @brief Restart the fast clock from the time and rate the server sent, then call the delegate's onFastTime()
+    /// @param t fast time received from the server
+    /// @param rate rate in thousandths (0 when stopped)
+    void setCurrentFastTime(long t, uint32_t rate);
+
+    /// @brief Set clockChanged and tell the delegate the fast time
+    /// @param t current fast time
+    void notifyFastTime(uint32_t t);
+
+    char inputbuffer[WIT_INPUT_BUFFER_SIZE];
     ssize_t nextChar;  // where the next character to be read goes in the buffer
+    bool inputDiscarding;  // skipping the rest of a line that was too long
+
+    // what the line being received is. The lists are processed as each entry arrives
+    enum InputLineType {
+        InputLineUnknown,
+        InputLineCommand,
+        InputLineRosterList,
+        InputLineTurnoutList,
+        InputLineRouteList,
+        InputLineDiscard    // a line that is not parsed, skipped as it arrives
+    };
+    InputLineType inputLineType;
+    int listStart;  // where the entries start in the buffer, after the RL/PTL/PRL
+    int listSegment;  // number of segments of the list processed so far
+    int listScanFrom;  // where to look for the next entry separator
 
     //Chrono heartbeatTimer;
 	unsigned long heartbeatTimer;
@@ -849,22 +1401,33 @@ class WiThrottleProtocol
     bool heartbeatEnabled = false;
 	unsigned long timeLastLocoAcquired;
 
-    //Chrono fastTimeTimer;
-	unsigned long fastTimeTimer;
-    double currentFastTime;
-    float currentFastTimeRate;
+    // the fast clock is the time the server last sent, plus the real time since then at
+    // the rate (see getFastTime()). Nothing is added up tick by tick, so it does not drift
+	unsigned long fastTimeSyncMillis;  // millis() at the sync point
+    uint32_t fastTimeSeconds;  // fast time at the sync point
+    uint16_t fastTimeMillis;  // and the milliseconds past that second
+    uint32_t fastTimeRate;  // in thousandths
+    uint32_t fastTimeNotified;  // fast time (seconds) when clockChanged was last set
+    unsigned long fastTimeTickMillis;  // millis() of the last once a second tick (granularity 0). Not the sync point, which getFastTime() moves on
 
     void resetChangeFlags();
 
     void init();
 
-    bool locomotiveSelected[MAX_WIT_THROTTLES] = {false, false, false, false, false, false};
-
-    String currentAddress[MAX_WIT_THROTTLES];
-
-    int currentSpeed[MAX_WIT_THROTTLES];
-    int speedSteps[MAX_WIT_THROTTLES];  // 1=128, 2=28, 4=27, 8=14, 16=28Mot
-    Direction currentDirection[MAX_WIT_THROTTLES];
+    // the state of a throttle. A loco is selected when the consist is not empty
+    struct ThrottleState {
+        uint16_t consist[WIT_MAX_CONSIST];  // packed addresses, the lead loco first
+        uint32_t reversed;                  // bit n set if consist[n] faces in reverse
+        uint8_t consistSize;
+        uint8_t speedSteps;                 // 1=128, 2=28, 4=27, 8=14, 16=28Mot
+        int16_t speed;
+        Direction direction;
+    };
+    ThrottleState throttles[MAX_WIT_THROTTLES];
+
+    int findConsistLoco(const ThrottleState &throttle, int packed);
+    void removeConsistLoco(ThrottleState &throttle, int index);
+    String addressToString(uint16_t packed);
 
     String mostRecentTurnout;
     TurnoutState mostRecentTurnoutState;
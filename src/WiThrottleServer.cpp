@@ -0,0 +1,741 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocol
+ *
+ * This package implements a WiThrottle protocol connection,
+ * allow a device to communicate with a JMRI server or other
+ * WiThrottleProtocol device (like the Digitrax LNWI).
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "WiThrottleServer.h"
+#include "WiThrottleEventLog.h"
+#include "WiThrottleLayoutStore.h"
+
+// locos are held as packed addresses (see WIT_LONG_ADDRESS)
+static uint16_t packAddress(int address, char length) {
+    return (length == 'L' ? WIT_LONG_ADDRESS : 0) | (address & WIT_ADDRESS_MASK);
+}
+
+static int addressNumber(uint16_t packed) {
+    return packed & WIT_ADDRESS_MASK;
+}
+
+static char addressLength(uint16_t packed) {
+    return (packed & WIT_LONG_ADDRESS) ? 'L' : 'S';
+}
+
+// what a client's queued broadcasts are copied into, so that they go out in as few writes as possible
+#define FLUSH_BUFFER_SIZE 256
+
+static int findSeparator(const char *c, int len) {
+    for (int i = 0; i + 2 < len; i++) {
+        if (c[i] == '<' && c[i+1] == ';' && c[i+2] == '>') return i;
+    }
+    return -1;
+}
+
+static int parseInt(const char *c, int len) {
+    bool negative = (len > 0 && c[0] == '-');
+    int value = 0;
+    for (int i = negative ? 1 : 0; i < len && c[i] >= '0' && c[i] <= '9'; i++) value = value * 10 + (c[i] - '0');
+    return negative ? -value : value;
+}
+
+WiThrottleServer::WiThrottleServer() {
+    console = &nullStream;
+    clientCount = 0;
+    for (int i = 0; i < WIT_SERVER_MAX_CLIENTS; i++) clients[i].stream = NULL;
+    for (int i = 0; i < WIT_SERVER_MAX_LOCOS; i++) locos[i].holders = 0;
+    for (int i = 0; i < WIT_SERVER_MESSAGES; i++) {
+        messages[i].references = 0;
+        freeMessages[i] = i;
+    }
+    freeMessageCount = WIT_SERVER_MESSAGES;
+    trackPower = PowerUnknown;
+    fastTime = 0;
+    fastTimeRate = 0;
+    fastTimeMillis = 0;
+    fastTimeSet = false;
+}
+
+void WiThrottleServer::setDelegate(WiThrottleServerDelegate *delegate) {
+    this->delegate = delegate;
+}
+
+void WiThrottleServer::setLayoutStore(WiThrottleLayoutStore *store) {
+    layoutStore = store;
+}
+
+void WiThrottleServer::setLogStream(Stream *console) {
+    this->console = console;
+}
+
+void WiThrottleServer::setLogLevel(int level) {
+    logLevel = level;
+}
+
+void WiThrottleServer::setEventLog(WiThrottleEventLog *eventLog) {
+    this->eventLog = eventLog;
+}
+
+int WiThrottleServer::addClient(Stream *stream) {
+    for (int i = 0; i < WIT_SERVER_MAX_CLIENTS; i++) {
+        Client &client = clients[i];
+        if (client.stream) continue;
+
+        client.stream = stream;
+        client.inputLength = 0;
+        client.discarding = false;
+        client.name[0] = 0;
+        client.id[0] = 0;
+        client.heartbeatMonitoring = false;
+        client.heartbeatExpired = false;
+        client.lastReceived = millis();
+        client.heldCount = 0;
+        client.queueHead = 0;
+        client.queueCount = 0;
+        clientCount++;
+
+        if (WIT_LOG_AT(1)) { console->print("WiT:: server: client connected: "); console->println(i); }
+        if (eventLog) eventLog->record(EventServerClientConnected, i);
+        sendGreeting(client);
+        if (delegate) delegate->clientConnected(i);
+        return i;
+    }
+    if (WIT_LOG_AT(1)) console->println("WiT:: server: too many clients");
+    return -1;
+}
+
+void WiThrottleServer::removeClient(int client) {
+    if (!getClientStream(client)) return;
+    while (clients[client].heldCount > 0) releaseLoco(client, clients[client].heldCount - 1);
+    discardQueue(clients[client]);
+    clients[client].stream = NULL;
+    clientCount--;
+
+    if (WIT_LOG_AT(1)) { console->print("WiT:: server: client disconnected: "); console->println(client); }
+    if (eventLog) eventLog->record(EventServerClientDisconnected, client);
+    if (delegate) delegate->clientDisconnected(client);
+}
+
+Stream *WiThrottleServer::getClientStream(int client) {
+    return (client >= 0 && client < WIT_SERVER_MAX_CLIENTS) ? clients[client].stream : NULL;
+}
+
+const char *WiThrottleServer::getClientName(int client) {
+    return getClientStream(client) ? clients[client].name : "";
+}
+
+bool WiThrottleServer::check() {
+    bool changed = false;
+    for (int i = 0; i < WIT_SERVER_MAX_CLIENTS; i++) {
+        if (!clients[i].stream) continue;
+        if (clients[i].stream->available() > 0) {
+            processClientInput(i);
+            changed = true;
+        }
+        if (clients[i].stream) checkHeartbeat(clients[i]);
+    }
+    flush();
+    return changed;
+}
+
+void WiThrottleServer::flush() {
+    for (int i = 0; i < WIT_SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].stream && clients[i].queueCount > 0) flushClient(clients[i]);
+    }
+}
+
+// what a client is sent when it connects
+void WiThrottleServer::sendGreeting(Client &client) {
+    Stream *stream = client.stream;
+    char buffer[24];
+
+    sendLine(client, "VN2.0");
+
+    if (layoutStore) {
+        stream->print("RL");
+        stream->print(layoutStore->getRosterCount());
+        for (const WiThrottleStoreRosterEntry *entry = layoutStore->firstRosterEntry(); entry; entry = entry->next) {
+            stream->print(ENTRY_SEPARATOR);
+            stream->print(entry->name);
+            stream->print(SEGMENT_SEPARATOR);
+            stream->print(entry->address);
+            stream->print(SEGMENT_SEPARATOR);
+            stream->print(entry->length);
+        }
+        stream->print("\n");
+    }
+
+    sprintf(buffer, "PPA%d", (int) trackPower);
+    sendLine(client, buffer);
+
+    if (layoutStore && layoutStore->getTurnoutCount() > 0) {
+        stream->print("PTL");
+        for (const WiThrottleStoreAccessory *entry = layoutStore->firstTurnout(); entry; entry = entry->next) {
+            stream->print(ENTRY_SEPARATOR);
+            stream->print(entry->systemName);
+            stream->print(SEGMENT_SEPARATOR);
+            stream->print(entry->userName);
+            stream->print(SEGMENT_SEPARATOR);
+            stream->print(entry->state);
+        }
+        stream->print("\n");
+    }
+
+    if (layoutStore && layoutStore->getRouteCount() > 0) {
+        stream->print("PRL");
+        for (const WiThrottleStoreAccessory *entry = layoutStore->firstRoute(); entry; entry = entry->next) {
+            stream->print(ENTRY_SEPARATOR);
+            stream->print(entry->systemName);
+            stream->print(SEGMENT_SEPARATOR);
+            stream->print(entry->userName);
+            stream->print(SEGMENT_SEPARATOR);
+            stream->print(entry->state);
+        }
+        stream->print("\n");
+    }
+
+    if (fastTimeSet) {
+        char line[48];
+        sendLine(client, line, formatFastTime(line, sizeof(line)));
+    }
+}
+
+// the fast time has moved on by (elapsed time x rate) since it was set, and the rate is sent
+// from its thousandths, so that a rate such as 0.25 isn't rounded, and without needing float
+// support in printf
+int WiThrottleServer::formatFastTime(char *line, size_t size) {
+    unsigned long elapsed = millis() - fastTimeMillis;
+    unsigned long time = fastTime + (unsigned long) ((uint64_t) elapsed * fastTimeRate / 1000000);
+    unsigned long fraction = fastTimeRate % 1000;
+    int digits = 3;
+    if (fraction % 100 == 0) { fraction /= 100; digits = 1; }
+    else if (fraction % 10 == 0) { fraction /= 10; digits = 2; }
+    return snprintf(line, size, "PFT%lu" PROPERTY_SEPARATOR "%lu.%0*lu",
+                    time, (unsigned long) (fastTimeRate / 1000), digits, fraction);
+}
+
+// each line goes out in a single write, so that it isn't split over several packets. Anything
+// already queued for the client is sent first, so that it sees the changes in order
+void WiThrottleServer::sendLine(Client &client, const char *line, int len) {
+    char buffer[WIT_SERVER_INPUT_SIZE + 1];
+    if (len < 0) return;
+    if (client.queueCount > 0) flushClient(client);
+    if (len >= (int) sizeof(buffer)) {
+        client.stream->write(line, len);
+        client.stream->write('\n');
+        return;
+    }
+    memcpy(buffer, line, len);
+    buffer[len] = '\n';
+    client.stream->write(buffer, len + 1);
+}
+
+void WiThrottleServer::sendLine(Client &client, const char *line) {
+    sendLine(client, line, strlen(line));
+}
+
+void WiThrottleServer::broadcast(const char *line, int len) {
+    if (len < 0) return;
+    if (len + 1 > WIT_SERVER_MESSAGE_SIZE) {
+        for (int i = 0; i < WIT_SERVER_MAX_CLIENTS; i++) {
+            if (clients[i].stream) sendLine(clients[i], line, len);
+        }
+        return;
+    }
+
+    int message = newMessage(line, len);
+    for (int i = 0; i < WIT_SERVER_MAX_CLIENTS; i++) {
+        if (clients[i].stream) queueMessage(clients[i], message, 0);
+    }
+    releaseMessage(message);
+}
+
+// send M<throttle>A<address><;><action> to every client throttle holding the loco.
+// The line is serialized once, and only the throttle character is patched in per client when it is sent
+void WiThrottleServer::broadcastLocoAction(int loco, const char *action, int len) {
+    char line[WIT_SERVER_MESSAGE_SIZE];
+    int n = 3;
+    line[0] = 'M';
+    line[1] = '0';
+    line[2] = 'A';
+    n += WiThrottleProtocol::formatAddress(locos[loco].address, line + n);
+    memcpy(line + n, PROPERTY_SEPARATOR, 3);
+    n += 3;
+    if (len > (int) sizeof(line) - n - 1) len = sizeof(line) - n - 1;
+    memcpy(line + n, action, len);
+    n += len;
+
+    int message = newMessage(line, n);
+    for (int i = 0; i < WIT_SERVER_MAX_CLIENTS; i++) {
+        Client &client = clients[i];
+        if (!client.stream) continue;
+        for (int h = 0; h < client.heldCount; h++) {
+            if (client.heldLoco[h] == loco) queueMessage(client, message, client.heldThrottle[h]);
+        }
+    }
+    releaseMessage(message);
+}
+
+// a message to share between clients. The caller holds one reference, and releases it when it has queued it
+int WiThrottleServer::newMessage(const char *line, int len) {
+    if (freeMessageCount == 0) flush();  // sending everything that is queued frees every message
+    int message = freeMessages[--freeMessageCount];
+    Message &m = messages[message];
+    m.references = 1;
+    memcpy(m.text, line, len);
+    m.text[len] = '\n';
+    m.length = len + 1;
+    return message;
+}
+
+void WiThrottleServer::queueMessage(Client &client, int message, char multiThrottle) {
+    if (client.queueCount == WIT_SERVER_CLIENT_QUEUE) flushClient(client);
+    int slot = (client.queueHead + client.queueCount) % WIT_SERVER_CLIENT_QUEUE;
+    client.queue[slot] = message;
+    client.queueThrottle[slot] = multiThrottle;
+    client.queueCount++;
+    messages[message].references++;
+}
+
+void WiThrottleServer::releaseMessage(int message) {
+    if (--messages[message].references == 0) freeMessages[freeMessageCount++] = message;
+}
+
+void WiThrottleServer::flushClient(Client &client) {
+    char buffer[FLUSH_BUFFER_SIZE];
+    int n = 0;
+    while (client.queueCount > 0) {
+        int slot = client.queueHead;
+        const Message &m = messages[client.queue[slot]];
+        if (n + m.length > (int) sizeof(buffer)) {
+            client.stream->write(buffer, n);
+            n = 0;
+        }
+        memcpy(buffer + n, m.text, m.length);
+        if (client.queueThrottle[slot]) buffer[n + 1] = client.queueThrottle[slot];
+        n += m.length;
+        client.queueHead = (slot + 1) % WIT_SERVER_CLIENT_QUEUE;
+        client.queueCount--;
+        releaseMessage(client.queue[slot]);
+    }
+    if (n > 0) client.stream->write(buffer, n);
+}
+
+void WiThrottleServer::discardQueue(Client &client) {
+    while (client.queueCount > 0) {
+        releaseMessage(client.queue[client.queueHead]);
+        client.queueHead = (client.queueHead + 1) % WIT_SERVER_CLIENT_QUEUE;
+        client.queueCount--;
+    }
+}
+
+// the state of a loco, sent to a throttle when it acquires it
+void WiThrottleServer::sendLocoState(Client &client, char multiThrottle, int loco) {
+    Loco &l = locos[loco];
+    char line[48];
+    int n = sprintf(line, "M%cA", multiThrottle);
+    n += WiThrottleProtocol::formatAddress(l.address, line + n);
+    n += sprintf(line + n, PROPERTY_SEPARATOR);
+
+    for (int f = 0; f < MAX_FUNCTIONS; f++) {
+        int m = sprintf(line + n, "F%d%d", (l.functions >> f) & 1, f);
+        sendLine(client, line, n + m);
+    }
+    sendLine(client, line, n + sprintf(line + n, "V%d", l.speed));
+    sendLine(client, line, n + sprintf(line + n, "R%d", (int) l.direction));
+    sendLine(client, line, n + sprintf(line + n, "s%d", l.speedSteps));
+}
+
+void WiThrottleServer::processClientInput(int client) {
+    int available;
+    while (clients[client].stream && (available = clients[client].stream->available()) > 0) {
+        Client &c = clients[client];
+        char chunk[WIT_READ_CHUNK_SIZE];
+        size_t n = c.stream->readBytes(chunk, ((size_t) available < sizeof(chunk)) ? available : sizeof(chunk));
+        if (n == 0) break;
+
+        for (size_t i = 0; i < n; i++) {
+            char ch = chunk[i];
+            if (ch == '\n' || ch == '\r') {
+                if (!c.discarding && c.inputLength > 0) {
+                    c.input[c.inputLength] = 0;
+                    int length = c.inputLength;
+                    c.inputLength = 0;
+                    processCommand(client, c.input, length);
+                    if (!c.stream) return;  // the client quit
+                }
+                c.inputLength = 0;
+                c.discarding = false;
+            }
+            else if (c.discarding) {
+                continue;
+            }
+            else if (c.inputLength < WIT_SERVER_INPUT_SIZE - 1) {
+                c.input[c.inputLength++] = ch;
+            }
+            else {
+                if (WIT_LOG_AT(1)) { console->print("WiT:: server: command too long from client "); console->println(client); }
+                if (eventLog) eventLog->record(EventServerCommandTooLong, client);
+                c.discarding = true;
+            }
+        }
+    }
+}
+
+void WiThrottleServer::processCommand(int client, char *c, int len) {
+    Client &cl = clients[client];
+    if (WIT_LOG_AT(2)) { console->print("WiT:: server: <== "); console->print(client); console->print(" "); console->println(c); }
+    if (eventLog) eventLog->record(EventServerReceived, client, 0, c, len);
+
+    cl.lastReceived = millis();
+    cl.heartbeatExpired = false;
+
+    switch (c[0]) {
+        case '*':
+            // heartbeat, or heartbeat monitoring on (*+) or off (*-)
+            if (len > 1 && c[1] == '+') cl.heartbeatMonitoring = true;
+            else if (len > 1 && c[1] == '-') cl.heartbeatMonitoring = false;
+            return;
+
+        case 'N': {
+            // device name. Reply with the heartbeat period
+            int n = (len - 1 < (int) sizeof(cl.name) - 1) ? len - 1 : sizeof(cl.name) - 1;
+            memcpy(cl.name, c + 1, n);
+            cl.name[n] = 0;
+            char line[8];
+            sprintf(line, "*%d", WIT_SERVER_HEARTBEAT);
+            sendLine(cl, line);
+            return;
+        }
+
+        case 'H':
+            if (len > 1 && c[1] == 'U') {
+                int n = (len - 2 < (int) sizeof(cl.id) - 1) ? len - 2 : sizeof(cl.id) - 1;
+                memcpy(cl.id, c + 2, n);
+                cl.id[n] = 0;
+                return;
+            }
+            break;
+
+        case 'Q':
+            removeClient(client);
+            return;
+
+        case 'M':
+            if (len > 3) {
+                processLocoCommand(client, c[1], c[2], c + 3, len - 3);
+                return;
+            }
+            break;
+
+        case 'P':
+            if (len > 3 && c[1] == 'T' && c[2] == 'A') {
+                // PTA<C|T|2><system name>
+                const char *systemName = c + 4;
+                TurnoutState state;
+                if (c[3] == 'C') state = TurnoutClosed;
+                else if (c[3] == 'T') state = TurnoutThrown;
+                else if (c[3] == '2') {
+                    bool thrown = layoutStore && (layoutStore->getTurnoutState(systemName) == TurnoutThrown);
+                    state = thrown ? TurnoutClosed : TurnoutThrown;
+                }
+                else break;
+                setTurnoutState(systemName, state);
+                if (delegate) delegate->turnoutChanged(systemName, state);
+                return;
+            }
+            if (len > 3 && c[1] == 'R' && c[2] == 'A' && c[3] == '2') {
+                // PRA2<system name>
+                setRouteState(c + 4, RouteActive);
+                if (delegate) delegate->routeSet(c + 4);
+                return;
+            }
+            if (len > 3 && c[1] == 'P' && c[2] == 'A') {
+                TrackPower state = (c[3] == '1') ? PowerOn : PowerOff;
+                setTrackPower(state);
+                if (delegate) delegate->trackPowerChanged(state);
+                return;
+            }
+            break;
+    }
+
+    if (WIT_LOG_AT(1)) { console->print("WiT:: server: unknown command: "); console->println(c); }
+    if (eventLog) eventLog->record(EventServerUnknownCommand, client, 0, c, len);
+    if (delegate) delegate->receivedUnknownCommand(client, c);
+}
+
+// M<throttle><+|-|A><address|*><;><...>
+void WiThrottleServer::processLocoCommand(int client, char multiThrottle, char op, char *c, int len) {
+    Client &cl = clients[client];
+    int p = findSeparator(c, len);
+    if (p < 0) return;
+    const char *rest = c + p + 3;
+    int restLen = len - p - 3;
+    bool all = (p == 1 && c[0] == '*');
+    int address = all ? -1 : WiThrottleProtocol::packAddress(c, p);
+    if (!all && address < 0) return;
+
+    if (op == '+') {
+        if (all) return;
+        int held = acquireLoco(client, multiThrottle, address);
+        if (held < 0) {
+            sendLine(cl, "HMNo more locos can be acquired");
+            return;
+        }
+        char line[24];
+        int n = sprintf(line, "M%c+", multiThrottle);
+        n += WiThrottleProtocol::formatAddress(address, line + n);
+        memcpy(line + n, PROPERTY_SEPARATOR, 3);
+        sendLine(cl, line, n + 3);
+        sendLocoState(cl, multiThrottle, cl.heldLoco[held]);
+    }
+    else if (op == '-') {
+        for (int h = cl.heldCount - 1; h >= 0; h--) {
+            if (cl.heldThrottle[h] != multiThrottle) continue;
+            uint16_t heldAddress = locos[cl.heldLoco[h]].address;
+            if (!all && heldAddress != address) continue;
+            char line[24];
+            int n = sprintf(line, "M%c-", multiThrottle);
+            n += WiThrottleProtocol::formatAddress(heldAddress, line + n);
+            memcpy(line + n, PROPERTY_SEPARATOR, 3);
+            releaseLoco(client, h);
+            sendLine(cl, line, n + 3);
+        }
+    }
+    else if (op == 'A') {
+        if (restLen < 1) return;
+        for (int h = 0; h < cl.heldCount; h++) {
+            if (cl.heldThrottle[h] != multiThrottle) continue;
+            if (!all && locos[cl.heldLoco[h]].address != address) continue;
+            processLocoAction(client, multiThrottle, cl.heldLoco[h], rest, restLen);
+        }
+    }
+    else {
+        if (delegate) delegate->receivedUnknownCommand(client, c - 3);
+    }
+}
+
+void WiThrottleServer::processLocoAction(int client, char multiThrottle, int loco, const char *action, int len) {
+    Loco &l = locos[loco];
+    int address = addressNumber(l.address);
+    char length = addressLength(l.address);
+
+    switch (action[0]) {
+        case 'V': {
+            int speed = parseInt(action + 1, len - 1);
+            if (speed < 0) speed = 0;
+            if (speed > 126) speed = 126;
+            applySpeed(loco, speed);
+            if (delegate) delegate->speedChanged(address, length, speed);
+            break;
+        }
+        case 'R': {
+            Direction direction = (len > 1 && action[1] == '0') ? Reverse : Forward;
+            applyDirection(loco, direction);
+            if (delegate) delegate->directionChanged(address, length, direction);
+            break;
+        }
+        case 'F':
+        case 'f': {
+            // F1nn is a button press, which toggles the function (F0nn, the release, is ignored). f<0|1>nn sets it
+            if (len < 3) break;
+            int function = parseInt(action + 2, len - 2);
+            if (function < 0 || function >= MAX_FUNCTIONS) break;
+            bool state;
+            if (action[0] == 'F') {
+                if (action[1] != '1') break;
+                state = !((l.functions >> function) & 1);
+            } else {
+                state = (action[1] == '1');
+            }
+            applyFunction(loco, function, state);
+            if (delegate) delegate->functionChanged(address, length, function, state);
+            break;
+        }
+        case 'X':
+            if (delegate) delegate->emergencyStop(address, length);
+            applySpeed(loco, 0);
+            break;
+        case 'I':
+            applySpeed(loco, 0);
+            if (delegate) delegate->speedChanged(address, length, 0);
+            break;
+        case 's': {
+            // 1 = 128step, 2 = 28step, 4 = 27step, 8 = 14step or 16 = 28step (alternate)
+            char reply[8];
+            int steps = parseInt(action + 1, len - 1);
+            if (steps != 1 && steps != 2 && steps != 4 && steps != 8 && steps != 16) break;
+            l.speedSteps = steps;
+            broadcastLocoAction(loco, reply, sprintf(reply, "s%d", l.speedSteps));
+            break;
+        }
+        case 'q': {
+            // query, answered to the asking throttle only
+            if (len < 2) break;
+            char line[32];
+            int n = sprintf(line, "M%cA", multiThrottle);
+            n += WiThrottleProtocol::formatAddress(l.address, line + n);
+            n += sprintf(line + n, PROPERTY_SEPARATOR);
+            if (action[1] == 'V') sendLine(clients[client], line, n + sprintf(line + n, "V%d", l.speed));
+            else if (action[1] == 'R') sendLine(clients[client], line, n + sprintf(line + n, "R%d", (int) l.direction));
+            break;
+        }
+    }
+}
+
+// a client that asked for heartbeat monitoring (*+) and has gone quiet has its locos stopped, once
+void WiThrottleServer::checkHeartbeat(Client &client) {
+    if (!client.heartbeatMonitoring || client.heartbeatExpired) return;
+    if (millis() - client.lastReceived <= WIT_SERVER_HEARTBEAT * 1000UL) return;
+
+    if (WIT_LOG_AT(1)) { console->print("WiT:: server: heartbeat lost, stopping locos of client "); console->println((int) (&client - clients)); }
+    if (eventLog) eventLog->record(EventServerHeartbeatLost, (int) (&client - clients));
+    client.heartbeatExpired = true;
+    for (int h = 0; h < client.heldCount; h++) {
+        int loco = client.heldLoco[h];
+        applySpeed(loco, 0);
+        if (delegate) delegate->speedChanged(addressNumber(locos[loco].address), addressLength(locos[loco].address), 0);
+    }
+}
+
+int WiThrottleServer::findLoco(uint16_t address) {
+    for (int i = 0; i < WIT_SERVER_MAX_LOCOS; i++) {
+        if (locos[i].holders > 0 && locos[i].address == address) return i;
+    }
+    return -1;
+}
+
+// returns the index of the loco in the client's held list, or -1 if there is no room
+int WiThrottleServer::acquireLoco(int client, char multiThrottle, uint16_t address) {
+    Client &cl = clients[client];
+    int loco = findLoco(address);
+    if (loco >= 0) {
+        for (int h = 0; h < cl.heldCount; h++) {
+            if (cl.heldLoco[h] == loco && cl.heldThrottle[h] == multiThrottle) return h;  // already held
+        }
+    }
+    if (cl.heldCount >= WIT_SERVER_CLIENT_LOCOS) return -1;
+
+    if (loco < 0) {
+        for (int i = 0; i < WIT_SERVER_MAX_LOCOS && loco < 0; i++) {
+            if (locos[i].holders == 0) loco = i;
+        }
+        if (loco < 0) return -1;
+        Loco &l = locos[loco];
+        l.address = address;
+        l.speed = 0;
+        l.direction = Forward;
+        l.speedSteps = 1;  // 128 steps
+        l.functions = 0;
+    }
+
+    locos[loco].holders++;
+    cl.heldThrottle[cl.heldCount] = multiThrottle;
+    cl.heldLoco[cl.heldCount] = loco;
+    if (delegate) delegate->locoAcquired(client, multiThrottle, addressNumber(address), addressLength(address));
+    return cl.heldCount++;
+}
+
+void WiThrottleServer::releaseLoco(int client, int held) {
+    Client &cl = clients[client];
+    int loco = cl.heldLoco[held];
+    char multiThrottle = cl.heldThrottle[held];
+    cl.heldCount--;
+    for (int h = held; h < cl.heldCount; h++) {
+        cl.heldLoco[h] = cl.heldLoco[h + 1];
+        cl.heldThrottle[h] = cl.heldThrottle[h + 1];
+    }
+    locos[loco].holders--;
+    if (delegate) delegate->locoReleased(client, multiThrottle, addressNumber(locos[loco].address), addressLength(locos[loco].address));
+}
+
+void WiThrottleServer::applySpeed(int loco, int speed) {
+    char action[8];
+    locos[loco].speed = speed;
+    broadcastLocoAction(loco, action, sprintf(action, "V%d", speed));
+}
+
+void WiThrottleServer::applyDirection(int loco, Direction direction) {
+    char action[4];
+    locos[loco].direction = direction;
+    broadcastLocoAction(loco, action, sprintf(action, "R%d", (int) direction));
+}
+
+void WiThrottleServer::applyFunction(int loco, int function, bool state) {
+    char action[8];
+    if (state) locos[loco].functions |= (1UL << function);
+    else locos[loco].functions &= ~(1UL << function);
+    broadcastLocoAction(loco, action, sprintf(action, "F%d%d", state ? 1 : 0, function));
+}
+
+void WiThrottleServer::setTrackPower(TrackPower state) {
+    char line[16];
+    trackPower = state;
+    int len = snprintf(line, sizeof(line), "PPA%d", (int) state);
+    if (len >= (int) sizeof(line)) return;
+    broadcast(line, len);
+}
+
+void WiThrottleServer::setTurnoutState(const char *systemName, TurnoutState state) {
+    char line[WIT_SERVER_INPUT_SIZE];
+    int len = snprintf(line, sizeof(line), "PTA%d%s", (int) state, systemName);
+    if (len >= (int) sizeof(line)) return;
+    if (layoutStore) layoutStore->setTurnoutState(systemName, strlen(systemName), state);
+    broadcast(line, len);
+}
+
+void WiThrottleServer::setRouteState(const char *systemName, RouteState state) {
+    char line[WIT_SERVER_INPUT_SIZE];
+    int len = snprintf(line, sizeof(line), "PRA%d%s", (int) state, systemName);
+    if (len >= (int) sizeof(line)) return;
+    if (layoutStore) layoutStore->setRouteState(systemName, strlen(systemName), state);
+    broadcast(line, len);
+}
+
+void WiThrottleServer::setFastTime(unsigned long time, float rate) {
+    char line[48];
+    fastTime = time;
+    if (rate <= 0) fastTimeRate = 0;
+    else if (rate >= WIT_FAST_TIME_MAX_RATE / 1000) fastTimeRate = WIT_FAST_TIME_MAX_RATE;
+    else fastTimeRate = (uint32_t) (rate * 1000 + 0.5);
+    fastTimeMillis = millis();
+    fastTimeSet = true;
+    broadcast(line, formatFastTime(line, sizeof(line)));
+}
+
+void WiThrottleServer::setSpeed(int address, char length, int speed) {
+    int loco = findLoco(packAddress(address, length));
+    if (loco >= 0) applySpeed(loco, speed);
+}
+
+void WiThrottleServer::setDirection(int address, char length, Direction direction) {
+    int loco = findLoco(packAddress(address, length));
+    if (loco >= 0) applyDirection(loco, direction);
+}
+
+void WiThrottleServer::setFunction(int address, char length, int function, bool state) {
+    if (function < 0 || function >= MAX_FUNCTIONS) return;
+    int loco = findLoco(packAddress(address, length));
+    if (loco >= 0) applyFunction(loco, function, state);
+}
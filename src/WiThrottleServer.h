@@ -0,0 +1,347 @@
+/* -*- c++ -*-
+ *
+ * WiThrottleProtocol
+ *
+ * This package implements a WiThrottle protocol connection,
+ * allow a device to communicate with a JMRI server or other
+ * WiThrottleProtocol device (like the Digitrax LNWI).
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#ifndef WITHROTTLE_SERVER_H
+#define WITHROTTLE_SERVER_H
+
+#include "WiThrottleProtocol.h"
+
+// Number of throttle clients the server can have connected at once
+#ifndef WIT_SERVER_MAX_CLIENTS
+#define WIT_SERVER_MAX_CLIENTS 64
+#endif
+
+// Number of different locos that can be on clients' throttles at once
+#ifndef WIT_SERVER_MAX_LOCOS
+#define WIT_SERVER_MAX_LOCOS 64
+#endif
+#if WIT_SERVER_MAX_LOCOS > 256
+#error "WIT_SERVER_MAX_LOCOS can be at most 256"  // the clients' held locos are indexed in bytes
+#endif
+
+// Number of locos each client can hold (over all of its throttles)
+#ifndef WIT_SERVER_CLIENT_LOCOS
+#define WIT_SERVER_CLIENT_LOCOS 8
+#endif
+
+// Longest command the server accepts from a client
+#ifndef WIT_SERVER_INPUT_SIZE
+#define WIT_SERVER_INPUT_SIZE 128
+#endif
+
+// Number of broadcast messages that can be waiting to be sent. Each change is serialized once into one of
+// these, and the clients it goes to queue a reference to it
+#ifndef WIT_SERVER_MESSAGES
+#define WIT_SERVER_MESSAGES 32
+#endif
+
+// Longest broadcast message (longer ones are written to each client directly)
+#ifndef WIT_SERVER_MESSAGE_SIZE
+#define WIT_SERVER_MESSAGE_SIZE 48
+#endif
+
+// Number of broadcast messages that can be waiting for each client. A client's queue is sent
+// in one write from check(), or earlier if it fills up
+#ifndef WIT_SERVER_CLIENT_QUEUE
+#define WIT_SERVER_CLIENT_QUEUE 16
+#endif
+
+// messages are indexed, and the client queues counted, in bytes. A loco action is referenced by one
+// queue entry for each client throttle holding the loco, plus one while it is being queued
+#if WIT_SERVER_MESSAGES > 256
+#error "WIT_SERVER_MESSAGES can be at most 256"
+#endif
+#if WIT_SERVER_MESSAGE_SIZE > 255
+#error "WIT_SERVER_MESSAGE_SIZE can be at most 255"
+#endif
+#if WIT_SERVER_CLIENT_QUEUE > 255
+#error "WIT_SERVER_CLIENT_QUEUE can be at most 255"
+#endif
+#if WIT_SERVER_MAX_CLIENTS * WIT_SERVER_CLIENT_LOCOS > 65534
+#error "WIT_SERVER_MAX_CLIENTS * WIT_SERVER_CLIENT_LOCOS can be at most 65534"  // also the most holders a loco can have
+#endif
+
+// Heartbeat period (seconds) the server asks clients for. A client that has turned on
+// heartbeat monitoring (*+) and is not heard from for this long has its locos stopped
+#ifndef WIT_SERVER_HEARTBEAT
+#define WIT_SERVER_HEARTBEAT 10
+#endif
+
+/// @brief Class for the Delegate methods of a WiThrottleServer. These report what the clients asked for, so that it can be passed to the command station
+class WiThrottleServerDelegate
+{
+  public:
+    /// @brief Delegate method called when a client is added
+    /// @param client client number
+    virtual void clientConnected(int client) {}
+
+    /// @brief Delegate method called when a client quits (Q), or is removed. Its locos have been released. The sketch should close the client's connection
+    /// @param client client number
+    virtual void clientDisconnected(int client) {}
+
+    /// @brief Delegate method called when a client acquires a loco
+    /// @param client client number
+    /// @param multiThrottle throttle on the client
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    virtual void locoAcquired(int client, char multiThrottle, int address, char length) {}
+
+    /// @brief Delegate method called when a client releases a loco
+    /// @param client client number
+    /// @param multiThrottle throttle on the client
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    virtual void locoReleased(int client, char multiThrottle, int address, char length) {}
+
+    /// @brief Delegate method called when a loco's speed is changed by a client
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    /// @param speed new speed (0-126)
+    virtual void speedChanged(int address, char length, int speed) {}
+
+    /// @brief Delegate method called when a loco's direction is changed by a client
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    /// @param direction new direction
+    virtual void directionChanged(int address, char length, Direction direction) {}
+
+    /// @brief Delegate method called when a loco function is changed by a client
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    /// @param function function number
+    /// @param state new state of the function
+    virtual void functionChanged(int address, char length, int function, bool state) {}
+
+    /// @brief Delegate method called when a client asks for a loco to be emergency stopped
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    virtual void emergencyStop(int address, char length) {}
+
+    /// @brief Delegate method called when a client changes a Turnout/Point. The new state has already been sent to all the clients
+    /// @param systemName system name of the Turnout/Point
+    /// @param state new state
+    virtual void turnoutChanged(const char *systemName, TurnoutState state) {}
+
+    /// @brief Delegate method called when a client sets a Route. The new state has already been sent to all the clients
+    /// @param systemName system name of the Route
+    virtual void routeSet(const char *systemName) {}
+
+    /// @brief Delegate method called when a client turns the track power on or off
+    /// @param state new state
+    virtual void trackPowerChanged(TrackPower state) {}
+
+    /// @brief Delegate method called when a client sends a command the server does not recognise
+    /// @param client client number
+    /// @param command the command
+    virtual void receivedUnknownCommand(int client, const char *command) {}
+};
+
+///
+/// ----
+///
+
+/// @brief The server side of the WiThrottle protocol. Clients (throttles) are added with the Stream of their connection,
+/// and the server answers their commands, tracks the locos each one holds, and sends every change to all the clients concerned.
+/// The server does not accept connections itself, so it works with any network stack.
+class WiThrottleServer {
+
+  public:
+    /// @brief Create a server with no clients
+    WiThrottleServer();
+
+    /// @brief Set the Delegate
+    /// @param delegate pointer to the delegate
+    void setDelegate(WiThrottleServerDelegate *delegate);
+
+    /// @brief Set the store holding the roster, turnouts and routes that are sent to clients when they connect. Turnout and route changes are recorded in it
+    /// @param store pointer to the store
+    void setLayoutStore(WiThrottleLayoutStore *store);
+
+    /// @brief Set the log stream
+    /// @param console pointer to the serial console
+    void setLogStream(Stream *console);
+
+    /// @brief Set the console log level
+    /// @param level Log Level (0 = off 1 = basic 2 = high). Levels above WIT_MAX_LOG_LEVEL are not compiled in
+    void setLogLevel(int level);
+
+    /// @brief Record the clients connecting and disconnecting, their commands, and other events, in an event log
+    /// @param eventLog pointer to the event log, or NULL to stop recording
+    void setEventLog(WiThrottleEventLog *eventLog);
+
+    /// @brief Add a client, and send it the server version, roster, turnouts, routes, track power and fast time
+    /// @param stream stream of the client's connection
+    /// @return Client number, or -1 if the server is full (WIT_SERVER_MAX_CLIENTS)
+    int addClient(Stream *stream);
+
+    /// @brief Remove a client (e.g. when its connection has closed), releasing its locos
+    /// @param client client number
+    void removeClient(int client);
+
+    /// @brief Get the number of connected clients
+    int getClientCount() { return clientCount; }
+
+    /// @brief Get the stream of a client
+    /// @param client client number
+    /// @return Stream, or NULL if there is no such client
+    Stream *getClientStream(int client);
+
+    /// @brief Get the name a client sent (N command)
+    /// @param client client number
+    /// @return Name, or an empty string
+    const char *getClientName(int client);
+
+    /// @brief Process the commands received from all the clients, check their heartbeats, and send the changes waiting for each client. Should be called repeatedly, and often, in the main loop.
+    /// @return True if any commands were processed
+    bool check();
+
+    /// @brief Send the changes waiting for each client now, rather than at the next check()
+    void flush();
+
+    /// @brief Set the track power state, and send it to all the clients
+    /// @param state new state
+    void setTrackPower(TrackPower state);
+
+    /// @brief Set the state of a Turnout/Point (e.g. when it is changed by the command station), and send it to all the clients
+    /// @param systemName system name of the Turnout/Point
+    /// @param state new state
+    void setTurnoutState(const char *systemName, TurnoutState state);
+
+    /// @brief Set the state of a Route, and send it to all the clients
+    /// @param systemName system name of the Route
+    /// @param state new state
+    void setRouteState(const char *systemName, RouteState state);
+
+    /// @brief Set the fast time, and send it to all the clients
+    /// @param time fast time (seconds since midnight)
+    /// @param rate fast time rate (0 = stopped), kept to thousandths
+    void setFastTime(unsigned long time, float rate);
+
+    /// @brief Set the speed of a loco (e.g. when it is changed by the command station), and send it to the clients holding it
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    /// @param speed new speed (0-126)
+    void setSpeed(int address, char length, int speed);
+
+    /// @brief Set the direction of a loco, and send it to the clients holding it
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    /// @param direction new direction
+    void setDirection(int address, char length, Direction direction);
+
+    /// @brief Set a function of a loco, and send it to the clients holding it
+    /// @param address DCC address
+    /// @param length 'S'|'L' Short or Long address
+    /// @param function function number
+    /// @param state new state of the function
+    void setFunction(int address, char length, int function, bool state);
+
+  private:
+    // a loco on at least one client's throttle
+    struct Loco {
+        uint16_t address;   // packed: bit 15 set for a long address
+        uint16_t holders;   // number of client throttles holding it, 0 when the slot is free
+        uint8_t speedSteps;
+        int16_t speed;
+        Direction direction;
+        uint32_t functions;
+    };
+
+    // a serialized broadcast, shared by the queues of all the clients it goes to
+    struct Message {
+        uint16_t references; // number of client queue entries using it, 0 when it is free
+        uint8_t length;
+        char text[WIT_SERVER_MESSAGE_SIZE];  // including the newline
+    };
+
+    struct Client {
+        Stream *stream;     // NULL when the slot is free
+        char input[WIT_SERVER_INPUT_SIZE];
+        int inputLength;
+        bool discarding;    // skipping the rest of a line that was too long
+        char name[32];
+        char id[24];
+        bool heartbeatMonitoring;
+        bool heartbeatExpired;
+        unsigned long lastReceived;
+        int heldCount;
+        char heldThrottle[WIT_SERVER_CLIENT_LOCOS];
+        uint8_t heldLoco[WIT_SERVER_CLIENT_LOCOS];  // index into locos
+        uint8_t queue[WIT_SERVER_CLIENT_QUEUE];     // index into messages
+        char queueThrottle[WIT_SERVER_CLIENT_QUEUE];   // throttle to patch into a loco action, or 0
+        uint8_t queueHead;
+        uint8_t queueCount;
+    };
+
+    WiThrottleServerDelegate *delegate = NULL;
+    WiThrottleLayoutStore *layoutStore = NULL;
+    NullStream nullStream;
+    Stream *console;
+    WiThrottleEventLog *eventLog = NULL;
+    int logLevel = 1;
+
+    Client clients[WIT_SERVER_MAX_CLIENTS];
+    int clientCount;
+    Loco locos[WIT_SERVER_MAX_LOCOS];
+    Message messages[WIT_SERVER_MESSAGES];
+    uint8_t freeMessages[WIT_SERVER_MESSAGES];
+    int freeMessageCount;
+    TrackPower trackPower;
+    unsigned long fastTime;         // fast time when it was set, at fastTimeMillis
+    uint32_t fastTimeRate;          // in thousandths
+    unsigned long fastTimeMillis;
+    bool fastTimeSet;
+
+    void sendGreeting(Client &client);
+    int formatFastTime(char *line, size_t size);
+    void sendLine(Client &client, const char *line, int len);
+    void sendLine(Client &client, const char *line);
+    void broadcast(const char *line, int len);
+    void broadcastLocoAction(int loco, const char *action, int len);
+    void sendLocoState(Client &client, char multiThrottle, int loco);
+    int newMessage(const char *line, int len);
+    void queueMessage(Client &client, int message, char multiThrottle);
+    void releaseMessage(int message);
+    void flushClient(Client &client);
+    void discardQueue(Client &client);
+
+    void processClientInput(int client);
+    void processCommand(int client, char *c, int len);
+    void processLocoCommand(int client, char multiThrottle, char op, char *c, int len);
+    void processLocoAction(int client, char multiThrottle, int loco, const char *action, int len);
+    void checkHeartbeat(Client &client);
+
+    int findLoco(uint16_t address);
+    int acquireLoco(int client, char multiThrottle, uint16_t address);
+    void releaseLoco(int client, int held);
+    void applySpeed(int loco, int speed);
+    void applyDirection(int loco, Direction direction);
+    void applyFunction(int loco, int function, bool state);
+};
+
+#endif // WITHROTTLE_SERVER_H